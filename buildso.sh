@@ -1,9 +1,11 @@
 #!/bin/sh
 
-gcc -O2 -o wrap_open.so -shared -fPIC  wrap_open.c debugme.c -ldl
+gcc -O2 -o wrap_open.so -shared -fPIC  wrap_open.c wrapchain.c wrapcache.c wrapsession.c wrapserver.c wrapprefetch.c wraprules.c wrapsniff.c wraptrace.c wrapexec.c wraphash.c debugme.c -ldl -lpthread
 
 
-gcc -O2 -o gccwrap -DTARGET_GCC gccwrap.c debugme.c
+gcc -O2 -o gccwrap -DTARGET_GCC gccwrap.c wrapsession.c wraprules.c wrapargs.c wrapprepass.c wrapsplit.c wrapchain.c wrapcache.c wrapsniff.c wrapprefetch.c wraphash.c debugme.c -lpthread
 
-gcc -O2 -o clangwrap -DTARGET_CLANG gccwrap.c debugme.c
+gcc -O2 -o clangwrap -DTARGET_CLANG gccwrap.c wrapsession.c wraprules.c wrapargs.c wrapprepass.c wrapsplit.c wrapchain.c wrapcache.c wrapsniff.c wrapprefetch.c wraphash.c debugme.c -lpthread
 
+
+gcc -O2 -o gccwrap-server gccwrap-server.c wrapserver.c wrapchain.c wraphash.c debugme.c -lpthread
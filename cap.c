@@ -19,6 +19,10 @@
  *
  */
 
+/* for copy_file_range() and splice()
+ */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <ctype.h>
 #include <malloc.h>
@@ -31,6 +35,7 @@
 
 #include <sys/stat.h>
 #include <sys/fcntl.h>
+#include <sys/mman.h>
 
 #include <stdlib.h>
 
@@ -97,7 +102,6 @@ static int apply_return_macro = FALSE ;
 /* File streaming macros used mostly for brevity and consistency
  */
 
-static FILE *fin = NULL ;
 static FILE *fout = NULL ;
 
 
@@ -108,9 +112,13 @@ static FILE *fout = NULL ;
                         (fs) = NULL ; \
                     }
 
-#define FPUT(c)     fputc( (int)(c), fout )
+#define FPUT(c)     out_put( (int)(c) )
+
+#define FPUTS(b)    out_puts( (b) )
 
-#define FPUTS(b)    fputs( (b), fout )
+#define FPRINTF(...)    { out_flush() ; fprintf( fout, __VA_ARGS__ ) ; }
+
+static void out_flush() ;
 
 
 static boolean skip_is_on = FALSE ;
@@ -160,71 +168,731 @@ static int lastchar = -1 ;
 
 
 
-#define iswhitespace(c)     ( ( (c) == ' ' ) || ( (c) == '\t' ) )
-
 #define istrueeol()         ( ( currentchar_read == '\n' ) && ( lastchar_read != '\\' ) )
 
+
 /*******************************************************
  */
 
-static int iskeyword( char *str )
+/* Character classes, looked up in one go rather than through
+ * the ctype functions.  The first three are what the ctype
+ * functions gave in the C locale, the rest are the characters
+ * that stop passthrough() in the various loops.
+ *
+ * EOF ( -1 ) looks up the same as 0xFF, which is in no class.
+ */
+
+#define CC_SPACE        0x0001      /* isspace() */
+#define CC_BLANK        0x0002      /* space and tab */
+#define CC_SYMBOL       0x0004      /* isalnum() and underscore */
+
+#define CC_EOL          0x0010
+#define CC_STAR         0x0020
+#define CC_QUOTE        0x0040
+#define CC_SLASH        0x0080
+#define CC_R            0x0100
+#define CC_BRACE        0x0200
+
+static unsigned short chartable[256] ;
+
+#define charclass(c)        ( chartable[ (unsigned char)(c) ] )
+
+#define iswhitespace(c)     ( charclass(c) & CC_BLANK )
+
+#define isspacechar(c)      ( charclass(c) & CC_SPACE )
+
+
+/* the characters behind the stop classes, for the scanners
+ * that compare characters rather than look them up
+ */
+#define NSTOPCHARS  7
+
+static struct {
+    unsigned short  cls ;
+    char            c ;
+    } stopchars[NSTOPCHARS] = {
+        { CC_EOL,   '\n' },
+        { CC_STAR,  '*' },
+        { CC_QUOTE, '"' },
+        { CC_SLASH, '/' },
+        { CC_R,     'r' },
+        { CC_BRACE, '{' },
+        { CC_BRACE, '}' }
+    } ;
+
+
+static void init_chartable()
 {
-    int retv = 0 ;
-    
-    if( buff[0] != macrochar )
+    int c = 0 ;
+    int i = 0 ;
+
+    for( c = 0 ; c < 256 ; c++ )
+    {
+        chartable[c] = 0 ;
+
+        if( ( c == ' ' ) || ( ( c >= '\t' ) && ( c <= '\r' ) ) )
+            chartable[c] |= CC_SPACE ;
+
+        if( ( c == ' ' ) || ( c == '\t' ) )
+            chartable[c] |= CC_BLANK ;
+
+        if( ( c == '_' ) || ( ( c >= '0' ) && ( c <= '9' ) ) || ( ( c >= 'a' ) && ( c <= 'z' ) ) || ( ( c >= 'A' ) && ( c <= 'Z' ) ) )
+            chartable[c] |= CC_SYMBOL ;
+    }
+
+    for( i = 0 ; i < NSTOPCHARS ; i++ )
+    {
+        chartable[ (unsigned char)stopchars[i].c ] |= stopchars[i].cls ;
+    }
+}
+
+
+/*******************************************************
+ */
+
+/* Find the first character from p up to end in one of the
+ * classes in mask, or end if there is none.
+ *
+ * Plain code and the bodies of comments and strings are most
+ * of any input, so on x86 the characters are compared 16, or
+ * with AVX2 32, at a time.  scan points at the best one the
+ * CPU can run.
+ */
+
+static char *scan_scalar( char *p, char *end, unsigned short mask )
+{
+    while( ( p < end ) && ! ( charclass(*p) & mask ) )
+        p++ ;
+
+    return p ;
+}
+
+
+#ifdef __SSE2__
+
+#include <immintrin.h>
+
+static char *scan_sse2( char *p, char *end, unsigned short mask )
+{
+    __m128i want[NSTOPCHARS] ;
+    __m128i v ;
+    __m128i hit ;
+
+    int n = 0 ;
+    int i = 0 ;
+    int bits = 0 ;
+
+    for( i = 0 ; i < NSTOPCHARS ; i++ )
+    {
+        if( stopchars[i].cls & mask )
+            want[n++] = _mm_set1_epi8( stopchars[i].c ) ;
+    }
+
+    if( n == 0 )
+        return end ;
+
+    while( p + 16 <= end )
+    {
+        v = _mm_loadu_si128( (__m128i *)p ) ;
+
+        hit = _mm_cmpeq_epi8( v, want[0] ) ;
+
+        for( i = 1 ; i < n ; i++ )
+            hit = _mm_or_si128( hit, _mm_cmpeq_epi8( v, want[i] ) ) ;
+
+        bits = _mm_movemask_epi8( hit ) ;
+
+        if( bits != 0 )
+            return p + __builtin_ctz( bits ) ;
+
+        p += 16 ;
+    };
+
+    return scan_scalar( p, end, mask ) ;
+}
+
+
+__attribute__(( target( "avx2" ) ))
+static char *scan_avx2( char *p, char *end, unsigned short mask )
+{
+    __m256i want[NSTOPCHARS] ;
+    __m256i v ;
+    __m256i hit ;
+
+    int n = 0 ;
+    int i = 0 ;
+    unsigned int bits = 0 ;
+
+    for( i = 0 ; i < NSTOPCHARS ; i++ )
+    {
+        if( stopchars[i].cls & mask )
+            want[n++] = _mm256_set1_epi8( stopchars[i].c ) ;
+    }
+
+    if( n == 0 )
+        return end ;
+
+    while( p + 32 <= end )
+    {
+        v = _mm256_loadu_si256( (__m256i *)p ) ;
+
+        hit = _mm256_cmpeq_epi8( v, want[0] ) ;
+
+        for( i = 1 ; i < n ; i++ )
+            hit = _mm256_or_si256( hit, _mm256_cmpeq_epi8( v, want[i] ) ) ;
+
+        bits = (unsigned int)_mm256_movemask_epi8( hit ) ;
+
+        if( bits != 0 )
+            return p + __builtin_ctz( bits ) ;
+
+        p += 32 ;
+    };
+
+    return scan_sse2( p, end, mask ) ;
+}
+
+#endif /* __SSE2__ */
+
+
+static char *(*scan)( char *p, char *end, unsigned short mask ) = scan_scalar ;
+
+
+static void init_scan()
+{
+    scan = scan_scalar ;
+
+#ifdef __SSE2__
+    scan = scan_sse2 ;
+
+    __builtin_cpu_init() ;
+
+    if( __builtin_cpu_supports( "avx2" ) )
+        scan = scan_avx2 ;
+#endif
+}
+
+
+/*******************************************************
+ */
+
+/* Input is read through a window on the file rather than
+ * a character at a time through stdio.
+ *
+ * A regular file is mapped whole, so the window is the file.
+ * Anything else, stdin or a pipe from an earlier command, is
+ * read INBLOCK characters at a time into inbuffer.  Each new
+ * block goes in behind the last BUFFLEN characters of the one
+ * before so there is always something to look back at.
+ *
+ * inptr is the next character to read and inend is the end of
+ * what has been read so far.
+ */
+
+#define INBLOCK 65536
+
+static int fin = -1 ;
+
+static char *inmap = NULL ;
+static size_t inmaplen = 0 ;
+
+static char *inbuffer = NULL ;
+
+static char *inbase = NULL ;
+static char *inptr = NULL ;
+static char *inend = NULL ;
+
+static boolean in_eof = FALSE ;
+
+/* the character nextchar() last returned, see pendchar()
+ */
+static char *lastreadp = NULL ;
+
+
+/* open the named input, "-" being stdin
+ *
+ * returns 0 or -1 on error
+ */
+static int input_open( char *name )
+{
+    struct stat st ;
+
+    off_t off = 0 ;
+
+    if( strcmp( name, "-" ) == 0 )
+    {
+        fin = 0 ;
+    }
+    else
+    {
+        fin = open( name, O_RDONLY ) ;
+    }
+
+    if( fin == -1 )
+        return -1 ;
+
+    inbase = NULL ;
+    inptr = NULL ;
+    inend = NULL ;
+
+    in_eof = FALSE ;
+
+    /* stdin may be a file someone has already read part of, so
+     * start where they left off and leave it read to the end
+     */
+
+    if( ( fstat( fin, &st ) == 0 ) && S_ISREG( st.st_mode ) && ( ( off = lseek( fin, 0, SEEK_CUR ) ) >= 0 ) && ( st.st_size > off ) )
+    {
+        inmap = (char *)mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fin, 0 ) ;
+
+        if( inmap != MAP_FAILED )
+        {
+            madvise( inmap, st.st_size, MADV_SEQUENTIAL ) ;
+
+            inmaplen = st.st_size ;
+
+            inbase = inmap ;
+            inptr = inmap + off ;
+            inend = inmap + inmaplen ;
+
+            lseek( fin, 0, SEEK_END ) ;
+
+            /* there is no more to come
+             */
+            in_eof = TRUE ;
+
+            return 0 ;
+        }
+
+        inmap = NULL ;
+    }
+
+    if( inbuffer == NULL )
+    {
+        inbuffer = (char *)malloc( BUFFLEN + INBLOCK ) ;
+
+        if( inbuffer == NULL )
+            return -1 ;
+    }
+
+    inbase = inbuffer ;
+    inptr = inbuffer ;
+    inend = inbuffer ;
+
+    return 0 ;
+}
+
+
+/* read the next block of a stream
+ *
+ * returns the number of characters read, 0 at EOF
+ */
+static int input_fill()
+{
+    ssize_t n = 0 ;
+    size_t keep = 0 ;
+
+    if( in_eof )
         return 0 ;
-    
-    /* need to avoid white spaces in comparisons
-     * as we'd like spacing to be legal
-     *
-     * We assume that "keyword" is space trimmed
-     * which it should be.
+
+    /* the output may still point at what is about to move
      */
-    int i = 1 ;
-    int j = 0 ;
-    
-    while( iswhitespace( buff[i] ) )
-        i++ ;
-    
-    while( buff[i] == str[j] )
+    out_flush() ;
+
+    keep = inend - inbase ;
+
+    if( keep > BUFFLEN )
+        keep = BUFFLEN ;
+
+    memmove( inbase, inend - keep, keep ) ;
+
+    inptr = inbase + keep ;
+    inend = inptr ;
+
+    do
+    {
+        n = read( fin, inend, INBLOCK ) ;
+    }
+    while( ( n == -1 ) && ( errno == EINTR ) ) ;
+
+    if( n <= 0 )
     {
-        if( str[j] == 0 )
+        in_eof = TRUE ;
+
+        return 0 ;
+    }
+
+    inend += n ;
+
+    return (int)n ;
+}
+
+
+static void input_close()
+{
+    out_flush() ;
+
+    if( inmap != NULL )
+    {
+        munmap( inmap, inmaplen ) ;
+
+        inmap = NULL ;
+    }
+
+    if( fin > 0 )
+    {
+        close( fin ) ;
+    }
+
+    fin = -1 ;
+
+    inbase = NULL ;
+    inptr = NULL ;
+    inend = NULL ;
+}
+
+
+/*******************************************************
+ */
+
+/* Most of the input goes to the output unchanged, so rather
+ * than write it a character at a time cap notes the span of
+ * the input window it has been asked to output so far and
+ * writes that in one go when something else has to be output.
+ *
+ * A character extends the span if it is the same as the next
+ * input character after it, wherever the character came from,
+ * so only text cap has rewritten is written out separately.
+ *
+ * Large spans of a mapped file are copied by the kernel from
+ * the input file, with copy_file_range() to a file or splice()
+ * to a pipe, so they are never copied through cap at all.
+ */
+
+#define OUTDIRECT   65536
+
+static char *spanstart = NULL ;
+static char *spanend = NULL ;
+
+
+/* copy the first len characters of the span from the input
+ * file to the output
+ *
+ * returns the number of characters copied
+ */
+static size_t out_direct( size_t len )
+{
+    loff_t off = spanstart - inmap ;
+
+    ssize_t n = 0 ;
+    size_t done = 0 ;
+
+    int fd = fileno( fout ) ;
+
+    if( fflush( fout ) != 0 )
+        return 0 ;
+
+    while( done < len )
+    {
+        n = copy_file_range( fin, &off, fd, NULL, len - done, 0 ) ;
+
+        if( n <= 0 )
             break ;
-        
-        i++ ;
-        j++ ;
+
+        done += n ;
     };
-    
-    if( buff[i] == str[j] )
+
+    /* copy_file_range() only goes between files
+     */
+
+    while( done < len )
+    {
+        n = splice( fin, &off, fd, NULL, len - done, 0 ) ;
+
+        if( n <= 0 )
+            break ;
+
+        done += n ;
+    };
+
+    return done ;
+}
+
+
+static void out_flush()
+{
+    size_t len = 0 ;
+    size_t done = 0 ;
+
+    if( spanstart == spanend )
+        return ;
+
+    len = spanend - spanstart ;
+
+    if( ( inmap != NULL ) && ( len >= OUTDIRECT ) )
     {
-        retv = 1 ;
+        done = out_direct( len ) ;
     }
-    else
+
+    if( done < len )
     {
-        retv = 0 ;
+        fwrite( spanstart + done, 1, len - done, fout ) ;
     }
-    
-    return retv ;
+
+    spanstart = NULL ;
+    spanend = NULL ;
+}
+
+
+static inline void out_put( int c )
+{
+    if( ( spanend != NULL ) && ( spanend < inptr ) && ( *spanend == (char)c ) )
+    {
+        spanend++ ;
+
+        return ;
+    }
+
+    /* start a new span if it is the character just read
+     */
+
+    if( ( lastreadp != NULL ) && ( lastreadp >= inbase ) && ( lastreadp < inptr ) && ( *lastreadp == (char)c ) )
+    {
+        out_flush() ;
+
+        spanstart = lastreadp ;
+        spanend = lastreadp + 1 ;
+
+        return ;
+    }
+
+    out_flush() ;
+
+    fputc( c, fout ) ;
+}
+
+
+/* carry on the output from p, a character read earlier, so
+ * that what follows can be added to the span again
+ */
+static void out_resume( char *p )
+{
+    if( ( p == NULL ) || ( p < inbase ) || ( p >= inptr ) )
+        return ;
+
+    out_flush() ;
+
+    spanstart = p ;
+    spanend = p ;
+}
+
+
+/* output the characters of the input window from p up to q
+ */
+static void out_span( char *p, char *q )
+{
+    if( spanend != p )
+    {
+        out_flush() ;
+
+        spanstart = p ;
+    }
+
+    spanend = q ;
+}
+
+
+static void out_puts( char *b )
+{
+    while( *b != 0 )
+    {
+        out_put( (unsigned char)*b++ ) ;
+    };
 }
 
 
 /*******************************************************
  */
 
-struct wordstack_s {
-    struct wordstack_s  *next ;
-    char            *buff ;
-    } ;
+/* Memory for the symbols and word stack of a file comes from
+ * an arena, handed out in order from large blocks and all given
+ * back at once by arena_reset() when main_process() starts on
+ * the next file.
+ */
+
+#define ARENABLOCK  65536
+
+struct arenablock_s {
+    struct arenablock_s *next ;
+    size_t          size ;
+    size_t          used ;
+    char            data[] ;
+    } ;
+
+typedef struct arenablock_s arenablock_t ;
+
+static arenablock_t *arena = NULL ;
+
+
+static void *arena_alloc( size_t len )
+{
+    arenablock_t *block = NULL ;
+
+    size_t size = ARENABLOCK ;
+
+    char *retp = NULL ;
+
+    /* keep everything aligned for pointers
+     */
+    len = ( len + sizeof( void * ) - 1 ) & ~( sizeof( void * ) - 1 ) ;
+
+    if( ( arena == NULL ) || ( arena->size - arena->used < len ) )
+    {
+        if( len > size )
+            size = len ;
+
+        block = (arenablock_t *)malloc( sizeof( arenablock_t ) + size ) ;
+
+        if( block == NULL )
+            return NULL ;
+
+        block->size = size ;
+        block->used = 0 ;
+        block->next = arena ;
+
+        arena = block ;
+    }
+
+    retp = arena->data + arena->used ;
+
+    arena->used += len ;
+
+    return retp ;
+}
+
+
+/* give back everything allocated, keeping the first block for
+ * the next file
+ */
+static void arena_reset()
+{
+    arenablock_t *next = NULL ;
+
+    while( ( arena != NULL ) && ( arena->next != NULL ) )
+    {
+        next = arena->next ;
+
+        free( arena ) ;
+
+        arena = next ;
+    };
+
+    if( arena != NULL )
+        arena->used = 0 ;
+}
+
+
+/*******************************************************
+ */
+
+/* Symbols are interned, each name being stored once in a small
+ * hash table, and counted every time it is put on the word
+ * stack.  So whether a symbol is on the stack is one hash
+ * lookup however deep the stack is.
+ */
+
+#define SYMBOLSLOTS 256
+
+struct symbol_s {
+    struct symbol_s *next ;
+    unsigned int    hash ;
+    int             len ;
+    int             onstack ;
+    char            name[] ;
+    } ;
+
+typedef struct symbol_s symbol_t ;
+
+static symbol_t *symbols[SYMBOLSLOTS] ;
+
+
+/* find the symbol str, adding it if create is TRUE
+ *
+ * returns the symbol or NULL
+ */
+static symbol_t *intern( char *str, int create )
+{
+    symbol_t *sym = NULL ;
+
+    unsigned int hash = 2166136261u ;
+
+    int len = 0 ;
+
+    /* FNV-1a
+     */
+    while( str[len] != 0 )
+    {
+        hash ^= (unsigned char)str[len] ;
+        hash *= 16777619u ;
+
+        len++ ;
+    };
+
+    for( sym = symbols[ hash % SYMBOLSLOTS ] ; sym != NULL ; sym = sym->next )
+    {
+        if( ( sym->hash == hash ) && ( sym->len == len ) && ( memcmp( sym->name, str, len ) == 0 ) )
+            return sym ;
+    };
+
+    if( ! create )
+        return NULL ;
+
+    sym = (symbol_t *)arena_alloc( sizeof( symbol_t ) + len + 1 ) ;
+
+    if( sym == NULL )
+        return NULL ;
+
+    sym->hash = hash ;
+    sym->len = len ;
+    sym->onstack = 0 ;
+
+    memcpy( sym->name, str, len+1 ) ;
+
+    sym->next = symbols[ hash % SYMBOLSLOTS ] ;
+    symbols[ hash % SYMBOLSLOTS ] = sym ;
+
+    return sym ;
+}
+
+
+/*******************************************************
+ */
+
+/* wordstack is a stack for storing copies of
+ * previously read symbols, the top being at
+ * wordstack[ wordstackdepth - 1 ].
+ *
+ * It is used in e.g. the "#def" directive.
+ */
+static symbol_t **wordstack = NULL ;
+
+static int wordstackdepth = 0 ;
 
-typedef struct wordstack_s  wordstack_t ;
+static int wordstacksize = 0 ;
 
 
-/* wordstackp is a stack for storing copies of
- * previously read symbols.
- *
- * It is used in e.g. the "#def" directive.
+/* forget everything for a new file
  */
-static wordstack_t *wordstackp = NULL ;
+static void symbols_reset()
+{
+    arena_reset() ;
+
+    memset( symbols, 0, sizeof( symbols ) ) ;
+
+    wordstack = NULL ;
+    wordstackdepth = 0 ;
+    wordstacksize = 0 ;
+}
 
 
 /*******************************************************
@@ -277,24 +945,40 @@ static int escape_pending = FALSE ;
 /* the following is used to allow us to backtrack the last
  * character we read
  *
- * if pendingchar is -1 then there is no character saved for
- * reading
+ * lastreadp points at the character nextchar() last returned,
+ * either in the input window or in the deferred buffer, and
+ * NULL at EOF.  Pending a character just points pendingp at
+ * it again, so pendingp is NULL if there is no character saved
+ * for reading.
  */
-static int pendingchar = -1 ;
+static char *pendingp = NULL ;
 
 
 void pendchar( int c )
 {
-    pendingchar = c ;
+    if( c == -1 )
+    {
+        pendingp = NULL ;
+    }
+    else
+    {
+        pendingp = lastreadp ;
+    }
 }
 
 
 /*******************************************************
  */
 
+/* deferredp is the next character to read from the deferred
+ * buffer, or NULL if it is empty, and deferredend is the end
+ * of what has been put in it.
+ */
 static char deferredbuffer[BUFFLEN+1] ;
 
-static int deferredbufferindex = -1 ;
+static char *deferredp = NULL ;
+
+static char *deferredend = deferredbuffer ;
 
 
 static void append_to_deferredbuffer( char *buff )
@@ -305,31 +989,18 @@ static void append_to_deferredbuffer( char *buff )
     if( buff[0] == 0 )
         return ;
 
-    int i = 0 ;
-    
-    int j = deferredbufferindex ;
-    
-    if( j == -1 )
-    {
-        j = 0 ;
-    }
-    else
+    if( deferredp == NULL )
     {
-        while( deferredbuffer[j] != 0 )
-            j++ ;
+        deferredp = deferredbuffer ;
+        deferredend = deferredbuffer ;
     }
 
-    while( ( buff[i] != 0 ) && ( j < BUFFLEN ) )
+    while( ( *buff != 0 ) && ( deferredend < deferredbuffer + BUFFLEN ) )
     {
-        deferredbuffer[j] = buff[i] ;
-        j++ ;
-        i++ ;
+        *deferredend++ = *buff++ ;
     };
     
-    deferredbuffer[j] = 0 ;
-    
-    if( deferredbufferindex == -1 )
-        deferredbufferindex = 0 ;
+    *deferredend = 0 ;
 }
 
 
@@ -340,16 +1011,20 @@ int read_from_deferred_buffer()
 {
     int retv = 0 ;
     
-    if( deferredbufferindex == -1 )
+    if( deferredp == NULL )
+    {
+        lastreadp = NULL ;
+
         return -1 ;
+    }
 
-    retv = (int)deferredbuffer[ deferredbufferindex ] ;
-    
-    deferredbufferindex++ ;
+    lastreadp = deferredp ;
+
+    retv = (unsigned char)*deferredp++ ;
     
-    if( deferredbuffer[ deferredbufferindex ] == 0 )
+    if( deferredp == deferredend )
     {
-        deferredbufferindex = -1 ;
+        deferredp = NULL ;
     }
     
     return retv ;
@@ -367,48 +1042,26 @@ static int currentchar_read = -1 ;
 
 static int in_quotes = FALSE ;
 
-/* The rotatingbuffer simply stores the last BUFFLEN
- * characters read by rotating the index value.  Note
- * that cap can take input from stdin so we cannot
- * assume that the source can be preloaded to a
- * buffer or presume the ability to change file
- * position.
- *
- * At ALL times rotatingbufferindex points to the NEXT
- * character position to fill.
- *
- * It is initialized to ALL zeros.
+
+/* Takes a NEGATIVE index value and reads characters going
+ * back from the last one read from the input.
  *
- * The extra character at the end of the buffer is NEVER
- * accessed by code but is there as a guard in case
- * the buffer is accessed by code expecting a nul terminator,
- * and so rotatingbuffe[BUFFLEN] == 0 at all times.
+ * This used to need a rotating buffer of its own as cap can
+ * take input from stdin, but the input window always holds at
+ * least the last BUFFLEN characters read.
  */
-static char rotatingbuffer[BUFFLEN+1] ;
-
-static int rotatingbufferindex = 0 ;
-
-
-static char get_rotatingbuffer_char( int nidx )
+static char get_previous_char( int nidx )
 {
-    /* Takes a NEGATIVE index value and reads characters
-     * going back in the rotating buffer
-     */
-    
     if( nidx > 0 )
         return 0 ;
     
-    if( nidx < BUFFLEN )
+    if( nidx < -BUFFLEN )
         return 0 ;
     
-    int j = rotatingbufferindex ;
-    
-    j += nidx ;
-    
-    if( j < 0 )
-        j += BUFFLEN ;
+    if( inptr + nidx < inbase )
+        return 0 ;
     
-    return rotatingbuffer[j] ;
+    return inptr[nidx] ;
 }
 
 
@@ -419,12 +1072,12 @@ int nextchar()
 {
     int retv = -1 ;
     
-    int i = 0 ;
-    
-    if( pendingchar != -1 )
+    if( pendingp != NULL )
     {
-        retv = pendingchar ;
-        pendingchar = -1 ;
+        lastreadp = pendingp ;
+        pendingp = NULL ;
+
+        retv = (unsigned char)*lastreadp ;
     }
     else
     {
@@ -433,7 +1086,18 @@ int nextchar()
         if( retv != -1 )
             return retv ;
 
-        retv = fgetc( fin ) ;
+        if( ( inptr < inend ) || ( input_fill() > 0 ) )
+        {
+            lastreadp = inptr ;
+
+            retv = (unsigned char)*inptr++ ;
+        }
+        else
+        {
+            lastreadp = NULL ;
+
+            retv = -1 ;
+        }
         
         /* check if we're need to replace braces
          */
@@ -458,14 +1122,58 @@ int nextchar()
     lastchar_read = currentchar_read ;
     currentchar_read = retv ;
     
-    if( ( ! in_quotes ) && ( ! in_comment ) )
+    return retv ;
+}
+
+/*******************************************************
+ */
+
+
+/* Output the plain characters of the input up to the next one
+ * in any of the classes in mask, leaving that to be read next,
+ * just as reading each with nextchar() and output with FPUT()
+ * would.
+ *
+ * The loops in main_process() call this for the characters
+ * they would only have copied to the output.
+ *
+ * returns the last character output, or c if there were none
+ */
+static int passthrough( int c, unsigned short mask )
+{
+    char *p = inptr ;
+    char *q = NULL ;
+
+    /* characters put back or deferred come first
+     */
+    if( ( pendingp != NULL ) || ( deferredp != NULL ) )
+        return c ;
+
+    if( ( ! in_quotes ) && ( ! in_comment ) && apply_brace_macros )
+        mask |= CC_BRACE ;
+
+    q = scan( p, inend, mask ) ;
+
+    if( q == p )
+        return c ;
+
+    out_span( p, q ) ;
+
+    if( q - p > 1 )
     {
-        rotatingbuffer[rotatingbufferindex] = retv ;
-        rotatingbufferindex++ ;
-        rotatingbufferindex %= BUFFLEN ;
+        lastchar_read = (unsigned char)q[-2] ;
     }
-    
-    return retv ;
+    else
+    {
+        lastchar_read = currentchar_read ;
+    }
+
+    currentchar_read = (unsigned char)q[-1] ;
+
+    lastreadp = q - 1 ;
+    inptr = q ;
+
+    return currentchar_read ;
 }
 
 /*******************************************************
@@ -487,7 +1195,7 @@ int readchar( int cwanted )
 
     c = nextchar() ;
 
-    while( ( c != -1 ) && !feof(fin) )
+    while( c != -1 )
     {
         if( !iswhitespace(c) )
         {
@@ -509,7 +1217,7 @@ int readchar( int cwanted )
  */
 
 
-#define issymbolchar(c)     ( ( (c) == '_' ) || isalnum((c)) )
+#define issymbolchar(c)     ( charclass(c) & CC_SYMBOL )
 
 /* reads the next symbol
  *
@@ -707,31 +1415,37 @@ int read_to_eol()
 
 void stackcopybuffer( char *buffer, int checklen )
 {
-    wordstack_t *node = NULL ;
-    int len = 0 ;
+    symbol_t **stack = NULL ;
+    symbol_t *sym = NULL ;
 
-    len = strlen(buffer) ;
-
-    if( ( checklen != 0 ) && ( len == 0 ) )
+    if( ( checklen != 0 ) && ( buffer[0] == 0 ) )
         return ;
 
-    len++ ;
+    if( wordstackdepth == wordstacksize )
+    {
+        /* the old stack stays in the arena until the file is done
+         */
+
+        stack = (symbol_t **)arena_alloc( ( wordstacksize + 16 ) * 2 * sizeof( symbol_t * ) ) ;
 
-    node = (wordstack_t *)malloc( sizeof(wordstack_t) ) ;
+        if( stack == NULL )
+            return ;
 
-    if( node == NULL )
-        return ;
+        if( wordstackdepth > 0 )
+            memcpy( stack, wordstack, wordstackdepth * sizeof( symbol_t * ) ) ;
 
-    node->buff = NULL ;
-    node->next = wordstackp ;
-    wordstackp = node ;
+        wordstack = stack ;
+        wordstacksize = ( wordstacksize + 16 ) * 2 ;
+    }
 
-    node->buff = (char *)malloc( len ) ;
+    sym = intern( buffer, TRUE ) ;
 
-    if( node->buff == NULL )
+    if( sym == NULL )
         return ;
 
-    memcpy( node->buff, buffer, len ) ;
+    sym->onstack++ ;
+
+    wordstack[ wordstackdepth++ ] = sym ;
 }
 
 /*******************************************************
@@ -760,77 +1474,41 @@ void stackcopybuffer( char *buffer, int checklen )
  */
 char *stackbuffat( int index )
 {
-    char *retp = NULL ;
-    wordstack_t *curr = wordstackp ;
-    wordstack_t *next = NULL ;
-    int i = 0 ;
-
-    if( index < 0 )
+    if( ( index < 0 ) || ( index >= wordstackdepth ) )
         return NULL ;
 
-    if( wordstackp == NULL )
-        return NULL ;
-
-    while( ( curr != NULL ) && ( i != index ) )
-    {
-        i++ ;
-
-        curr = curr->next ;
-    };
-
-    if( ( curr != NULL ) && ( i == index ) )
-    {
-        retp = curr->buff ;
-
-        /* debugf( "stackbuffat( %d ) = [ %s ]\n", index, retp ) ;
-         */
-    }
-
-    return retp ;
+    return wordstack[ wordstackdepth - 1 - index ]->name ;
 }
 
 /*******************************************************
  */
 
 
-/* pop the tos, freeing all memory for that node
+/* pop the tos
  */
 void stackpop()
 {
-    wordstack_t *next = NULL ;
-
-    if( wordstackp == NULL )
+    if( wordstackdepth == 0 )
         return ;
 
-    next = wordstackp->next ;
+    wordstackdepth-- ;
 
-    free( wordstackp->buff ) ;
-    free( wordstackp ) ;
-
-    wordstackp = next ;
+    wordstack[ wordstackdepth ]->onstack-- ;
 }
 
 /*******************************************************
  */
 
 
-/* release all memory used by the stack
- * and reset the stack pointer
+/* empty the stack, the memory goes back when the file
+ * is done
  */
 void stackfree()
 {
-    wordstack_t *curr = wordstackp ;
-    wordstack_t *next = NULL ;
-
-    while( curr != NULL )
+    while( wordstackdepth > 0 )
     {
-        free( curr->buff ) ;
-        next = curr->next ;
-        free( curr ) ;
-        curr = next ;
+        stackpop() ;
     };
-
-    wordstackp = NULL ;
 }
 
 /*******************************************************
@@ -843,23 +1521,12 @@ void stackfree()
  */
 int symbolonstack()
 {
-    int retv = FALSE ;
-    wordstack_t *curr = wordstackp ;
-
-    while( curr != NULL )
-    {
-        if( curr->buff != NULL )
-        {
-            if( strcmp( buff, curr->buff ) == 0 )
-            {
-                return TRUE ;
-            }
-        }
+    symbol_t *sym = intern( buff, FALSE ) ;
 
-        curr = curr->next ;
-    };
+    if( ( sym != NULL ) && ( sym->onstack > 0 ) )
+        return TRUE ;
 
-    return retv ;
+    return FALSE ;
 }
 
 /*******************************************************
@@ -964,7 +1631,7 @@ int process_quote()
     
     c = nextchar() ;
 
-    while( ( c != -1 ) && !feof(fin) )
+    while( c != -1 )
     {
         if( c == (int)'\n' )
         {
@@ -1038,11 +1705,11 @@ int process_comment()
     int retv = 0 ;
     int c = 0 ;
 
-    fprintf( fout, "\n/*\n * " ) ;
+    FPRINTF( "\n/*\n * " ) ;
     
     c = nextchar() ;
 
-    while( ( c != -1 ) && !feof(fin) )
+    while( c != -1 )
     {
         if( c == (int)macrochar )
         {
@@ -1058,7 +1725,7 @@ int process_comment()
 
         if( c == '\n' )
         {
-            fprintf( fout, "\n *" ) ;
+            FPRINTF( "\n *" ) ;
 
             /* if we don't check for the hash symbol coming next we
              * will add a space we don't want which sounds trivial
@@ -1080,7 +1747,7 @@ int process_comment()
         c = nextchar() ;
     };
 
-    fprintf( fout, "/\n" ) ;
+    FPRINTF( "/\n" ) ;
 
     return retv ;
 }
@@ -1127,8 +1794,8 @@ int process_redefine()
 
     c = readsymbol() ;
 
-    fprintf( fout, "#undef %s%s%s\n", prebuff, buff, postbuff ) ;
-    fprintf( fout, "#define %s%s%s", prebuff, buff, postbuff ) ;
+    FPRINTF( "#undef %s%s%s\n", prebuff, buff, postbuff ) ;
+    FPRINTF( "#define %s%s%s", prebuff, buff, postbuff ) ;
     
     /* Now read to first EOL with no continuation before the new line
      */
@@ -1181,7 +1848,7 @@ int process_def()
          */
         return -1 ;
 
-    fprintf( fout, "#define %s%s%s(", prebuff, buff, postbuff ) ;
+    FPRINTF( "#define %s%s%s(", prebuff, buff, postbuff ) ;
 
     i = 0 ;
 
@@ -1317,33 +1984,33 @@ int process_constants( int type )
 
     c = readsymbol() ;
     stackcopy() ;
-    pre = wordstackp->buff ;
+    pre = stackbuffat(0) ;
 
     c = readsymbol() ;
     stackcopy() ;
-    post = wordstackp->buff ;
+    post = stackbuffat(0) ;
 
     c = readsymbol() ;
     stackcopy() ;
-    base = wordstackp->buff ;
+    base = stackbuffat(0) ;
 
     if( ( type == 0 ) || ( type == 2 ) )
     {
-        fprintf( fout, "#define %s_%s_%s\t\t0\n", pre, base, post ) ;
+        FPRINTF( "#define %s_%s_%s\t\t0\n", pre, base, post ) ;
 
         i = 1 ;
     }
 
     if( type == 1 )
     {
-        fprintf( fout, "#define %s_%s_%s\t\t0x01\n", pre, base, post ) ;
+        FPRINTF( "#define %s_%s_%s\t\t0x01\n", pre, base, post ) ;
 
         i = 2 ;
     }
 
     if( type == 3 )
     {
-        fprintf( fout, "#define %s_%s_%s\t\t0\n", pre, base, post ) ;
+        FPRINTF( "#define %s_%s_%s\t\t0\n", pre, base, post ) ;
 
         i = -1 ;
     }
@@ -1356,7 +2023,7 @@ int process_constants( int type )
         {
             if( type == 0 )
             {
-                fprintf( fout, "#define %s_%s_%s\t\t%s_%s_%s + %d\n", pre, buff, post, pre, base, post, i ) ;
+                FPRINTF( "#define %s_%s_%s\t\t%s_%s_%s + %d\n", pre, buff, post, pre, base, post, i ) ;
 
                 i++ ;
 
@@ -1365,7 +2032,7 @@ int process_constants( int type )
 
             if( type == 1 )
             {
-                fprintf( fout, "#define %s_%s_%s\t\t0x0%X\n", pre, buff, post, i ) ;
+                FPRINTF( "#define %s_%s_%s\t\t0x0%X\n", pre, buff, post, i ) ;
 
                 i *= 2 ;
 
@@ -1374,7 +2041,7 @@ int process_constants( int type )
 
             if( type == 2 )
             {
-                fprintf( fout, "#define %s_%s_%s\t\t%d\n", pre, buff, post, i ) ;
+                FPRINTF( "#define %s_%s_%s\t\t%d\n", pre, buff, post, i ) ;
 
                 i++ ;
 
@@ -1383,7 +2050,7 @@ int process_constants( int type )
 
             if( type == 3 )
             {
-                fprintf( fout, "#define %s_%s_%s\t\t%d\n", pre, buff, post, i ) ;
+                FPRINTF( "#define %s_%s_%s\t\t%d\n", pre, buff, post, i ) ;
 
                 i-- ;
 
@@ -1565,6 +2232,147 @@ write_error:
 }
 
 
+/*******************************************************
+ */
+
+
+/* cap's directives, found with a hash of the keyword's length
+ * and its first and last characters.  The hash was picked so no
+ * two of these share a slot, so any other directive, #include,
+ * #define and so on, is turned away after a single compare.
+ *
+ * Adding a keyword may need a new hash, init_keywords() says
+ * if it does.
+ */
+
+enum {
+    KW_NONE = 0,
+    KW_skipoff,
+    KW_skipon,
+    KW_macrochar,
+    KW_debugon,
+    KW_debugoff,
+    KW_quote,
+    KW_comment,
+    KW_def,
+    KW_constants,
+    KW_flags,
+    KW_constants_values,
+    KW_constants_negative,
+    KW_command,
+    KW_redefine,
+    KW_brace_macros_on,
+    KW_brace_macros_off,
+    KW_def_open_brace,
+    KW_def_close_brace,
+    KW_return_macro_on,
+    KW_return_macro_off,
+    KW_def_return_macro
+    } ;
+
+struct keyword_s {
+    char    *name ;
+    int     len ;
+    int     id ;
+    } ;
+
+typedef struct keyword_s keyword_t ;
+
+#define KEYWORD( _name, _id )   { _name, sizeof( _name ) - 1, _id }
+
+static keyword_t keywords[] = {
+        KEYWORD( "skipoff",             KW_skipoff ),
+        KEYWORD( "skipon",              KW_skipon ),
+        KEYWORD( "macrochar",           KW_macrochar ),
+        KEYWORD( "debugon",             KW_debugon ),
+        KEYWORD( "debugoff",            KW_debugoff ),
+        KEYWORD( "quote",               KW_quote ),
+        KEYWORD( "comment",             KW_comment ),
+        KEYWORD( "def",                 KW_def ),
+        KEYWORD( "constants",           KW_constants ),
+        KEYWORD( "flags",               KW_flags ),
+        KEYWORD( "constants-values",    KW_constants_values ),
+        KEYWORD( "constants-negative",  KW_constants_negative ),
+        KEYWORD( "command",             KW_command ),
+        KEYWORD( "redefine",            KW_redefine ),
+        KEYWORD( "brace_macros_on",     KW_brace_macros_on ),
+        KEYWORD( "brace_macros_off",    KW_brace_macros_off ),
+        KEYWORD( "def_open_brace",      KW_def_open_brace ),
+        KEYWORD( "def_close_brace",     KW_def_close_brace ),
+        KEYWORD( "return_macro_on",     KW_return_macro_on ),
+        KEYWORD( "return_macro_off",    KW_return_macro_off ),
+        KEYWORD( "def_return_macro",    KW_def_return_macro ),
+        { NULL, 0, KW_NONE }
+    } ;
+
+#define KEYWORDSLOTS    32
+
+#define KEYWORDHASH( _kw, _len )    \
+            ( ( (_len) * 4 + (unsigned char)(_kw)[0] * 7 + (unsigned char)(_kw)[(_len)-1] * 5 ) & ( KEYWORDSLOTS - 1 ) )
+
+static keyword_t *keywordslots[KEYWORDSLOTS] ;
+
+
+static void init_keywords()
+{
+    keyword_t *k = NULL ;
+
+    int h = 0 ;
+
+    memset( keywordslots, 0, sizeof( keywordslots ) ) ;
+
+    for( k = keywords ; k->name != NULL ; k++ )
+    {
+        h = KEYWORDHASH( k->name, k->len ) ;
+
+        if( keywordslots[h] != NULL )
+        {
+            fprintf( stderr, "cap : keywords %s and %s share a hash slot\n", keywordslots[h]->name, k->name ) ;
+        }
+
+        keywordslots[h] = k ;
+    }
+}
+
+
+/*******************************************************
+ */
+
+
+/* find which of our keywords, if any, is in buff, which holds
+ * len characters
+ *
+ * returns its KW_ value or KW_NONE
+ */
+static int keyword( int len )
+{
+    keyword_t *k = NULL ;
+
+    char *kw = buff + 1 ;
+
+    if( buff[0] != macrochar )
+        return KW_NONE ;
+
+    /* need to avoid white spaces in comparisons
+     * as we'd like spacing to be legal
+     */
+    while( iswhitespace( *kw ) )
+        kw++ ;
+
+    len -= kw - buff ;
+
+    if( len <= 0 )
+        return KW_NONE ;
+
+    k = keywordslots[ KEYWORDHASH( kw, len ) ] ;
+
+    if( ( k == NULL ) || ( k->len != len ) || ( memcmp( k->name, kw, len ) != 0 ) )
+        return KW_NONE ;
+
+    return k->id ;
+}
+
+
 /*******************************************************
  */
 
@@ -1572,40 +2380,42 @@ write_error:
 /* process checks the keyword we read in and if it finds a valid
  * word it does our extension processing
  *
+ * len is the number of characters in buff
+ *
  * This returns 0 if a keyword was found and processed and
  * -1 if processing failed or no keyword was found.
  */
 
 #define process_keyword( _kw, _proc ) \
     \
-    if( iskeyword( #_kw ) ) \
-    { \
+    case KW_ ## _kw : \
+        \
         changes_made = TRUE ; \
         \
         retv = process_ ## _proc ; \
         \
         debugf( "Accepted keyword :: " #_kw "\n" ) ; \
         \
-        return retv ; \
-    }
+        return retv ;
 
 #define flag_keyword( _kw, _flag, _value ) \
     \
-    if( iskeyword( #_kw ) ) \
-    { \
+    case KW_ ## _kw : \
+        \
         (_flag) = (_value) ; \
         \
         changes_made = TRUE ; \
         \
         debugf( "Accepted flag:: " #_kw "\n" ) ; \
         \
-        return 0 ; \
-    }
+        return 0 ;
     
 
-int process()
+int process( int len )
 {
     int retv = -1 ;
+    
+    int kw = KW_NONE ;
 
     /* for safety
      */
@@ -1613,7 +2423,23 @@ int process()
 
     debugf( "buff = [%s]\n", buff ) ;
     
-    flag_keyword( skipoff, skip_is_on, FALSE ) ;
+    kw = keyword( len ) ;
+    
+    if( kw == KW_NONE )
+    {
+        return -1 ;
+    }
+    
+    if( kw == KW_skipoff )
+    {
+        skip_is_on = FALSE ;
+        
+        changes_made = TRUE ;
+        
+        debugf( "Accepted flag:: skipoff\n" ) ;
+        
+        return 0 ;
+    }
     
     /* NOTE :
      *
@@ -1629,63 +2455,64 @@ int process()
         return -1 ;
     }
 
-    flag_keyword( skipon, skip_is_on, TRUE ) ;
-    
-    process_keyword( macrochar, macrochar() ) ;
-    
-    if( iskeyword("debugon") )
+    switch( kw )
     {
-        /* turn on debug reporting from caps
-         */
-        debug_on() ;
+        flag_keyword( skipon, skip_is_on, TRUE ) ;
+        
+        process_keyword( macrochar, macrochar() ) ;
+        
+        case KW_debugon :
+            
+            /* turn on debug reporting from caps
+             */
+            debug_on() ;
 
-        changes_made = TRUE ;
+            changes_made = TRUE ;
 
-        return 0 ;
-    }
+            return 0 ;
 
-    if( iskeyword("debugoff") )
-    {
-        /* turn off debug reporting from caps
-         */
-        debug_off() ;
+        case KW_debugoff :
+            
+            /* turn off debug reporting from caps
+             */
+            debug_off() ;
 
-        changes_made = TRUE ;
+            changes_made = TRUE ;
 
-        return 0 ;
-    }
+            return 0 ;
 
-    process_keyword( quote, quote() ) ;
+        process_keyword( quote, quote() ) ;
 
-    process_keyword( comment, comment() ) ;
+        process_keyword( comment, comment() ) ;
 
-    process_keyword( def, def() ) ;
-    
-    process_keyword( constants, constants(0) ) ;
+        process_keyword( def, def() ) ;
+        
+        process_keyword( constants, constants(0) ) ;
 
-    process_keyword( flags, constants(1) ) ;
+        process_keyword( flags, constants(1) ) ;
 
-    process_keyword( constants-values, constants(2) ) ;
+        process_keyword( constants_values, constants(2) ) ;
 
-    process_keyword( constants-negative, constants(3) ) ;
+        process_keyword( constants_negative, constants(3) ) ;
 
-    process_keyword( command, command() ) ;
-    
-    process_keyword( redefine, redefine() ) ;
+        process_keyword( command, command() ) ;
+        
+        process_keyword( redefine, redefine() ) ;
 
-    flag_keyword( brace_macros_on, apply_brace_macros, TRUE ) ;    
-    
-    flag_keyword( brace_macros_off, apply_brace_macros, FALSE ) ;    
-    
-    process_keyword( def_open_brace, def_open_brace() ) ;
-    
-    process_keyword( def_close_brace, def_close_brace() ) ;
-    
-    flag_keyword( return_macro_on, apply_return_macro, TRUE ) ;
-    
-    flag_keyword( return_macro_off, apply_return_macro, FALSE ) ;
-    
-    process_keyword( def_return_macro, def_return_macro() ) ;
+        flag_keyword( brace_macros_on, apply_brace_macros, TRUE ) ;
+        
+        flag_keyword( brace_macros_off, apply_brace_macros, FALSE ) ;
+        
+        process_keyword( def_open_brace, def_open_brace() ) ;
+        
+        process_keyword( def_close_brace, def_close_brace() ) ;
+        
+        flag_keyword( return_macro_on, apply_return_macro, TRUE ) ;
+        
+        flag_keyword( return_macro_off, apply_return_macro, FALSE ) ;
+        
+        process_keyword( def_return_macro, def_return_macro() ) ;
+    }
     
     return retv ;
 }
@@ -1701,7 +2528,7 @@ int process()
  */
 int main_process()
 {
-    if( fin == NULL )
+    if( fin == -1 )
     {
         return 0 ;
     }
@@ -1713,6 +2540,8 @@ int main_process()
     
     int leadingspaces = 0 ;
     
+    char *directive = NULL ;
+    
     /* blank chars is needed because a blank might be a character
      * other than a space ( e.g. a tab ) and we want to output that
      * character, not just a space.  So we have to record blank chars
@@ -1724,7 +2553,8 @@ int main_process()
     
     apply_brace_macros = FALSE ;
     
-    deferredbufferindex = -1 ;
+    deferredp = NULL ;
+    deferredend = deferredbuffer ;
     deferredbuffer[0] = 0 ;
     
     escape_pending = FALSE ;
@@ -1737,12 +2567,10 @@ int main_process()
     
     buff[0] = 0 ;
     
-    rotatingbufferindex = 0 ;
-    memset( rotatingbuffer, 0, BUFFLEN+1 ) ;
-    
     macrochar = initial_macrochar ;
     
-    pendingchar = -1 ;
+    lastreadp = NULL ;
+    pendingp = NULL ;
     
     postbuff[0] = 0 ;
     prebuff[0] = 0 ;
@@ -1750,11 +2578,13 @@ int main_process()
     quote_pending = FALSE ;
     
     skip_is_on = FALSE ;
+    
+    symbols_reset() ;
 
     /* Now process the file ... 
      */
 
-    while( ( c != -1 ) && ( !feof(fin) ) )
+    while( c != -1 )
     {
         DBGLINE() ;
         
@@ -1774,8 +2604,20 @@ int main_process()
             
             FPUT(c) ;
 
-            while( ( c != '\n' ) && ( c != -1 ) && ( !feof(fin) ) )
+            while( ( c != '\n' ) && ( c != -1 ) )
             {
+                /* straight to the next character that might need
+                 * more than copying
+                 */
+                if( apply_return_macro )
+                {
+                    c = passthrough( c, CC_EOL | CC_STAR | CC_QUOTE | CC_R ) ;
+                }
+                else
+                {
+                    c = passthrough( c, CC_EOL | CC_STAR | CC_QUOTE ) ;
+                }
+                
                 c = nextchar() ;
 
                 if( c == -1 )
@@ -1794,7 +2636,7 @@ int main_process()
                     
                     FPUT(c) ;
                     
-                    while( ( c != -1 ) && ( !feof(fin) ) )
+                    while( c != -1 )
                     {
                         if( ( c == '/' ) && ( lastchar_read == '*' ) )
                         {
@@ -1804,6 +2646,8 @@ int main_process()
                             break ;
                         }
                         
+                        c = passthrough( c, CC_SLASH ) ;
+                        
                         c = nextchar() ;
                         
                         FPUT(c) ;
@@ -1833,7 +2677,7 @@ int main_process()
                     
                     FPUT(c) ;
                     
-                    while( ( c != -1 ) && ( !feof(fin) ) )
+                    while( c != -1 )
                     {
                         if( ( c == '"' ) && ( lastchar != '\\' ) )
                         {
@@ -1858,6 +2702,8 @@ int main_process()
                             return -1 ;
                         }
                         
+                        c = passthrough( c, CC_QUOTE | CC_EOL ) ;
+                        
                         c = nextchar() ;
                         
                         FPUT(c) ;
@@ -1927,7 +2773,7 @@ int main_process()
                             
                             c = nextchar() ;
                             
-                            while( ( c != -1 ) && ( c != ';' ) && ( !feof(fin) ) )
+                            while( ( c != -1 ) && ( c != ';' ) )
                             {
                                 FPUT( c ) ;
                                 c = nextchar() ;
@@ -1975,13 +2821,18 @@ int main_process()
 
             *buff = macrochar ;
             
+            /* where the directive started, so if it is output as
+             * it is the output can carry on from there
+             */
+            directive = lastreadp ;
+            
             i = 1 ;
             
             c = nextchar() ;
             
             leadingspaces = 0 ;
             
-            while( iswhitespace((char)c) )
+            while( iswhitespace(c) )
             {
                 blankchars[ leadingspaces++ ] = (char)c ;
                 
@@ -1990,7 +2841,7 @@ int main_process()
             
             blankchars[ leadingspaces ] = 0 ;
 
-            while( ( i < BUFFLEN ) && ( c != -1 ) && ( !isspace((char)c) ) )
+            while( ( i < BUFFLEN ) && ( c != -1 ) && ( !isspacechar(c) ) )
             {
                 buff[i] = (char)c ;
                 i++ ;
@@ -2010,6 +2861,8 @@ int main_process()
                 
                 DBGLINE() ;
                 
+                out_resume( directive ) ;
+                
                 FPUT( macrochar ) ;
                 
                 FPUTS( blankchars ) ;
@@ -2040,7 +2893,7 @@ int main_process()
                 
                 DBGLINE() ;
                 
-                retv = process() ;
+                retv = process( i ) ;
 
                 if( retv != 0 )
                 {
@@ -2049,6 +2902,8 @@ int main_process()
                     /* ouput the buffer if we did not recognize the word
                      */
 
+                    out_resume( directive ) ;
+
                     FPUT( macrochar ) ;
                     
                     FPUTS( blankchars ) ;
@@ -2072,17 +2927,19 @@ int main_process()
                     
                     c = nextchar() ;
                     
-                    while( ( c != -1 ) && ( !feof(fin) ) && ! istrueeol() )
+                    while( ( c != -1 ) && ! istrueeol() )
                     {
                         FPUT( c ) ;
                         
+                        c = passthrough( c, CC_EOL ) ;
+                        
                         c = nextchar() ;
                     };
                     
                     FPUT( c ) ;
                 }
 
-                if( isspace(c) )
+                if( isspacechar(c) )
                 {
                     /* if not EOF then we still have a character we read ahead
                      * that must be output
@@ -2126,7 +2983,7 @@ static int init_main( int argc, char **argv )
     int retv = 0 ;
     int i ;
 
-    fin     = NULL ;
+    fin     = -1 ;
     fout    = stdout ;
 
     int input_files = 0 ;
@@ -2137,7 +2994,13 @@ static int init_main( int argc, char **argv )
 
     escape_pending = FALSE ;
 
-    pendingchar = -1 ;
+    pendingp = NULL ;
+
+    init_chartable() ;
+
+    init_scan() ;
+
+    init_keywords() ;
 
 
     i = 1 ;
@@ -2183,6 +3046,8 @@ static int init_main( int argc, char **argv )
             if( i > argc )
                 return -1 ;
 
+            out_flush() ;
+
             if( fout != stdout )
             {
                 FCLOSE( fout ) ;
@@ -2212,22 +3077,9 @@ static int init_main( int argc, char **argv )
         /* This has to be a filename ( or a mistake )
          */
 
-        if( fin != stdin )
-        {
-            FCLOSE( fin ) ;
-            fin = NULL ;
-        }
-
-        if( strcmp( argv[i], "-" ) == 0 )
-        {
-            fin = stdin ;
-        }
-        else
-        {
-            fin = fopen( argv[i] , "r" ) ;
-        }
+        input_close() ;
 
-        if( fin == NULL )
+        if( input_open( argv[i] ) != 0 )
             return -1 ;
 
         input_files++ ;
@@ -2258,12 +3110,13 @@ static int deinit_main()
     /* close file channels
      */
 
+    out_flush() ;
+
     fflush( fout ) ;
 
-    if( fin != stdin )
-    {
-        FCLOSE( fin ) ;
-    }
+    input_close() ;
+
+    safe_free( inbuffer ) ;
 
     if( fout != stdout )
     {
@@ -2273,6 +3126,9 @@ static int deinit_main()
     safe_free( open_brace_macro ) ;
     safe_free( close_brace_macro ) ;
 
+    arena_reset() ;
+    safe_free( arena ) ;
+
     return retv ;
 }
 
@@ -0,0 +1,879 @@
+
+/*
+ * gccwrap-server
+ *
+ * An optional long lived preprocessing server for wrap_open.so
+ *
+ * The server listens on a Unix socket and keeps a pool of
+ * worker threads ready to run command chains, together with an
+ * in-memory cache of results.  wrap_open.so sends it the
+ * command string and the path of a source file and gets back a
+ * memfd holding the processed file, so the interposed open()
+ * costs one round trip instead of spawning the chain itself.
+ *
+ * Results stay cached for as long as the server runs, so they
+ * survive across make invocations.  If there is no server
+ * wrap_open.so simply does the work itself.
+ *
+ * Format is :
+ *
+ *   gccwrap-server [-s <socket>] [-j <workers>] [-m <max MB>]
+ *
+ * $Id$
+ */
+
+/* for memfd_create()
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapchain.h"
+
+#include "wrapserver.h"
+
+#include "wraphash.h"
+
+
+/**********************************************************************
+ */
+
+#define DEFAULT_MAX_MB      512
+
+/* must be a power of two
+ */
+#define NBUCKETS            4096
+
+#define BUCKETMOD           ( NBUCKETS - 1 )
+
+
+/* result states
+ */
+#define RESULT_BUSY     0
+#define RESULT_READY    1
+
+
+/* one chain for each distinct command string
+ */
+DEF_LISTNODE(   chainent,
+                char            *commandstr ;
+                wrapchain_t     *chain ;
+            )
+
+
+/* Results are kept apart by the client's working directory and
+ * by the identity of the binaries the chain runs, so rebuilding
+ * a preprocessor never hands out output from the old one
+ */
+DEF_LISTNODE(   result,
+                uint64_t         hash ;
+                char            *commandstr ;
+                char            *cwd ;
+                uint64_t         binid ;
+                char            *path ;
+                int              state ;
+                int              memfd ;
+                uint64_t         len ;
+                uint64_t         stamp ;
+                dev_t            dev ;
+                ino_t            ino ;
+                off_t            srcsize ;
+                struct timespec  mtime ;
+            )
+
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER ;
+
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER ;
+
+static chainent_t *chains = NULL ;
+
+static result_t *buckets[NBUCKETS] ;
+
+static uint64_t total_bytes = 0 ;
+
+static uint64_t max_bytes = ( (uint64_t)DEFAULT_MAX_MB << 20 ) ;
+
+static uint64_t clock_stamp = 0 ;
+
+static char sockpath[PATH_MAX] ;
+
+static int listenfd = -1 ;
+
+
+/**********************************************************************
+ */
+
+/* find or build the chain for a command string
+ *
+ * must be called with the lock held
+ */
+static wrapchain_t *get_chain( char *commandstr )
+{
+    chainent_t *ce = NULL ;
+    chainent_t *next = NULL ;
+
+    LIST_WALK(  chains,
+                ce,
+                next,
+
+                if( strcmp( ce->commandstr, commandstr ) == 0 )
+                {
+                    return ce->chain ;
+                }
+             )
+
+    /* build the double nul terminated list wrapchain_new()
+     * wants by splitting on commas
+     */
+
+    size_t len = strlen( commandstr ) ;
+
+    char *list = (char *)malloc( len + 2 ) ;
+
+    if( list == NULL )
+    {
+        return NULL ;
+    }
+
+    size_t i = 0 ;
+
+    for( i = 0 ; i <= len ; i++ )
+    {
+        list[i] = ( commandstr[i] == ',' ) ? 0 : commandstr[i] ;
+    }
+
+    list[len+1] = 0 ;
+
+    ce = (chainent_t *)malloc( sizeof( chainent_t ) ) ;
+
+    if( ce == NULL )
+    {
+        free( list ) ;
+
+        return NULL ;
+    }
+
+    ce->chain = wrapchain_new( list ) ;
+
+    free( list ) ;
+
+    ce->commandstr = strdup( commandstr ) ;
+
+    if( ( ce->chain == NULL ) || ( ce->commandstr == NULL ) )
+    {
+        wrapchain_free( ce->chain ) ;
+
+        free( ce->commandstr ) ;
+
+        free( ce ) ;
+
+        return NULL ;
+    }
+
+    ce->next = chains ;
+    chains = ce ;
+
+    return ce->chain ;
+}
+
+
+/**********************************************************************
+ */
+
+/* must be called with the lock held
+ */
+static void remove_result( result_t *r )
+{
+    result_t **pp = buckets + ( r->hash & BUCKETMOD ) ;
+
+    while( *pp != r )
+    {
+        pp = &( (*pp)->next ) ;
+    } ;
+
+    *pp = r->next ;
+
+    if( r->memfd != -1 )
+    {
+        close( r->memfd ) ;
+
+        total_bytes -= r->len ;
+    }
+
+    free( r->commandstr ) ;
+    free( r->cwd ) ;
+    free( r->path ) ;
+    free( r ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Evict least recently used results until we are under the cap
+ *
+ * must be called with the lock held
+ */
+static void evict()
+{
+    result_t *r = NULL ;
+    result_t *oldest = NULL ;
+
+    int i = 0 ;
+
+    while( total_bytes > max_bytes )
+    {
+        oldest = NULL ;
+
+        for( i = 0 ; i < NBUCKETS ; i++ )
+        {
+            for( r = buckets[i] ; r != NULL ; r = r->next )
+            {
+                if( ( r->state == RESULT_READY ) && ( ( oldest == NULL ) || ( r->stamp < oldest->stamp ) ) )
+                {
+                    oldest = r ;
+                }
+            }
+        }
+
+        if( oldest == NULL )
+        {
+            break ;
+        }
+
+        SJGF( "evicting %s", oldest->path ) ;
+
+        remove_result( oldest ) ;
+    } ;
+}
+
+
+/**********************************************************************
+ */
+
+static int same_source( result_t *r, struct stat *st )
+{
+    return     ( r->dev == st->st_dev )
+            && ( r->ino == st->st_ino )
+            && ( r->srcsize == st->st_size )
+            && ( r->mtime.tv_sec == st->st_mtim.tv_sec )
+            && ( r->mtime.tv_nsec == st->st_mtim.tv_nsec ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Hash the identity of every binary the chain runs
+ */
+static uint64_t chain_identity( wrapchain_t *chain )
+{
+    struct stat st ;
+
+    uint64_t id[5] ;
+
+    uint64_t h = WRAPHASH_FNV_BASIS ;
+
+    int i = 0 ;
+
+    for( i = 0 ; i < chain->nstages ; i++ )
+    {
+        memset( id, 0, sizeof( id ) ) ;
+
+        if( stat( chain->stages[i].path, &st ) == 0 )
+        {
+            id[0] = (uint64_t)st.st_dev ;
+            id[1] = (uint64_t)st.st_ino ;
+            id[2] = (uint64_t)st.st_size ;
+            id[3] = (uint64_t)st.st_mtim.tv_sec ;
+            id[4] = (uint64_t)st.st_mtim.tv_nsec ;
+        }
+
+        h = wraphash_fnv( id, sizeof( id ), h ) ;
+    }
+
+    return h ;
+}
+
+
+/**********************************************************************
+ */
+
+/* A descriptor of its own for a stored result.  Opening the
+ * memfd through /proc gives the client its own file offset,
+ * a plain dup() is only the fallback.
+ */
+static int reopen_result( int memfd )
+{
+    char fdpath[64] ;
+
+    int fd = -1 ;
+
+    snprintf( fdpath, sizeof( fdpath ), "/proc/self/fd/%d", memfd ) ;
+
+    fd = open( fdpath, O_RDONLY | O_CLOEXEC ) ;
+
+    if( fd == -1 )
+    {
+        fd = fcntl( memfd, F_DUPFD_CLOEXEC, 0 ) ;
+    }
+
+    return fd ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Produce the processed version of path for a client in cwd
+ *
+ * returns a descriptor the caller must close, or -1
+ */
+static int process_file( char *commandstr, char *cwd, char *path )
+{
+    struct stat st ;
+
+    result_t *r = NULL ;
+
+    wrapchain_t *chain = NULL ;
+
+    uint64_t h = 0 ;
+
+    uint64_t binid = 0 ;
+
+    int fd = -1 ;
+
+    int status = 0 ;
+
+    if( stat( path, &st ) != 0 )
+    {
+        return -1 ;
+    }
+
+    pthread_mutex_lock( &lock ) ;
+
+    chain = get_chain( commandstr ) ;
+
+    pthread_mutex_unlock( &lock ) ;
+
+    if( chain == NULL )
+    {
+        return -1 ;
+    }
+
+    binid = chain_identity( chain ) ;
+
+    h = wraphash_fnv( commandstr, strlen( commandstr ), WRAPHASH_FNV_BASIS ) ;
+    h = wraphash_fnv( cwd, strlen( cwd ), h ) ;
+    h = wraphash_fnv( path, strlen( path ), h ) ^ binid ;
+
+    pthread_mutex_lock( &lock ) ;
+
+    while( TRUE )
+    {
+        for( r = buckets[ h & BUCKETMOD ] ; r != NULL ; r = r->next )
+        {
+            if(    ( r->hash == h )
+                && ( r->binid == binid )
+                && ( strcmp( r->path, path ) == 0 )
+                && ( strcmp( r->cwd, cwd ) == 0 )
+                && ( strcmp( r->commandstr, commandstr ) == 0 )
+              )
+            {
+                break ;
+            }
+        }
+
+        if( r == NULL )
+        {
+            break ;
+        }
+
+        if( r->state == RESULT_BUSY )
+        {
+            /* another worker is on it
+             */
+
+            pthread_cond_wait( &done, &lock ) ;
+
+            continue ;
+        }
+
+        if( same_source( r, &st ) )
+        {
+            r->stamp = ++clock_stamp ;
+
+            fd = reopen_result( r->memfd ) ;
+
+            pthread_mutex_unlock( &lock ) ;
+
+            SJGF( "hit %s", path ) ;
+
+            return fd ;
+        }
+
+        /* the file has changed since
+         */
+
+        remove_result( r ) ;
+
+        r = NULL ;
+
+        break ;
+    } ;
+
+    r = (result_t *)calloc( 1, sizeof( result_t ) ) ;
+
+    if( r == NULL )
+    {
+        pthread_mutex_unlock( &lock ) ;
+
+        return -1 ;
+    }
+
+    r->hash = h ;
+    r->commandstr = strdup( commandstr ) ;
+    r->cwd = strdup( cwd ) ;
+    r->binid = binid ;
+    r->path = strdup( path ) ;
+    r->state = RESULT_BUSY ;
+    r->memfd = -1 ;
+    r->dev = st.st_dev ;
+    r->ino = st.st_ino ;
+    r->srcsize = st.st_size ;
+    r->mtime = st.st_mtim ;
+
+    r->next = buckets[ h & BUCKETMOD ] ;
+    buckets[ h & BUCKETMOD ] = r ;
+
+    pthread_mutex_unlock( &lock ) ;
+
+    /* run the chain without the lock
+     */
+
+    fd = memfd_create( "wrapo", MFD_CLOEXEC ) ;
+
+    if( fd != -1 )
+    {
+        status = wrapchain_run( chain, path, fd ) ;
+    }
+
+    pthread_mutex_lock( &lock ) ;
+
+    if( ( fd == -1 ) || ( status != 0 ) || ( r->commandstr == NULL ) || ( r->cwd == NULL ) || ( r->path == NULL ) )
+    {
+        /* a failed result is not kept
+         */
+
+        SJGF( "chain failed for %s", path ) ;
+
+        remove_result( r ) ;
+
+        if( fd != -1 )
+        {
+            close( fd ) ;
+
+            fd = -1 ;
+        }
+    }
+    else
+    {
+        struct stat fst ;
+
+        fstat( fd, &fst ) ;
+
+        r->memfd = fd ;
+        r->len = (uint64_t)fst.st_size ;
+        r->stamp = ++clock_stamp ;
+        r->state = RESULT_READY ;
+
+        total_bytes += r->len ;
+
+        fd = reopen_result( fd ) ;
+
+        evict() ;
+    }
+
+    pthread_cond_broadcast( &done ) ;
+
+    pthread_mutex_unlock( &lock ) ;
+
+    return fd ;
+}
+
+
+/**********************************************************************
+ */
+
+static int read_all( int sock, void *buf, size_t len )
+{
+    ssize_t n = 0 ;
+
+    char *p = (char *)buf ;
+
+    while( len > 0 )
+    {
+        n = read( sock, p, len ) ;
+
+        if( n <= 0 )
+        {
+            if( ( n == -1 ) && ( errno == EINTR ) )
+            {
+                continue ;
+            }
+
+            return -1 ;
+        }
+
+        p += n ;
+        len -= n ;
+    } ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+static void serve( int sock )
+{
+    wrapserver_req_t req ;
+
+    char *commandstr = NULL ;
+
+    char cwd[PATH_MAX] ;
+
+    char path[PATH_MAX] ;
+
+    int fd = -1 ;
+
+    if( read_all( sock, &req, sizeof( req ) ) != 0 )
+    {
+        return ;
+    }
+
+    if(    ( req.magic != WRAPSERVER_MAGIC )
+        || ( req.cmdlen == 0 ) || ( req.cmdlen > WRAPSERVER_MAXCMD )
+        || ( req.cwdlen == 0 ) || ( req.cwdlen >= PATH_MAX )
+        || ( req.pathlen == 0 ) || ( req.pathlen >= PATH_MAX )
+      )
+    {
+        wrapserver_send_fd( sock, -1, -1 ) ;
+
+        return ;
+    }
+
+    commandstr = (char *)malloc( req.cmdlen + 1 ) ;
+
+    if( commandstr == NULL )
+    {
+        return ;
+    }
+
+    if(    ( read_all( sock, commandstr, req.cmdlen ) == 0 )
+        && ( read_all( sock, cwd, req.cwdlen ) == 0 )
+        && ( read_all( sock, path, req.pathlen ) == 0 )
+      )
+    {
+        commandstr[req.cmdlen] = 0 ;
+        cwd[req.cwdlen] = 0 ;
+        path[req.pathlen] = 0 ;
+
+        fd = process_file( commandstr, cwd, path ) ;
+
+        wrapserver_send_fd( sock, ( fd == -1 ) ? -1 : 0, fd ) ;
+
+        if( fd != -1 )
+        {
+            close( fd ) ;
+        }
+    }
+
+    free( commandstr ) ;
+}
+
+
+/**********************************************************************
+ */
+
+static void *worker( void *arg )
+{
+    int sock = -1 ;
+
+    (void)arg ;
+
+    while( TRUE )
+    {
+        sock = accept4( listenfd, NULL, NULL, SOCK_CLOEXEC ) ;
+
+        if( sock == -1 )
+        {
+            if( ( errno == EINTR ) || ( errno == ECONNABORTED ) )
+            {
+                continue ;
+            }
+
+            errorf( "accept() failed ( %s )", strerror( errno ) ) ;
+
+            break ;
+        }
+
+        /* only the user running the server may have commands
+         * run as that user
+         */
+
+        if( ! wrapserver_peer_ok( sock ) )
+        {
+            SJGF( "refused a client run by another user" ) ;
+
+            close( sock ) ;
+
+            continue ;
+        }
+
+        serve( sock ) ;
+
+        close( sock ) ;
+    } ;
+
+    return NULL ;
+}
+
+
+/**********************************************************************
+ */
+
+static int open_socket()
+{
+    struct sockaddr_un addr ;
+
+    if( strlen( sockpath ) >= sizeof( addr.sun_path ) )
+    {
+        errorf( "Socket path too long : %s", sockpath ) ;
+
+        return -1 ;
+    }
+
+    memset( &addr, 0, sizeof( addr ) ) ;
+
+    addr.sun_family = AF_UNIX ;
+
+    strcpy( addr.sun_path, sockpath ) ;
+
+    if( wrapserver_mkdir( sockpath ) != 0 )
+    {
+        errorf( "Unsafe or missing directory for %s", sockpath ) ;
+
+        return -1 ;
+    }
+
+    listenfd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ;
+
+    if( listenfd == -1 )
+    {
+        return -1 ;
+    }
+
+    /* the socket is created 0600, there is no window in which
+     * someone else could connect to it
+     */
+
+    mode_t mask = umask( 077 ) ;
+
+    int retv = bind( listenfd, (struct sockaddr *)&addr, sizeof( addr ) ) ;
+
+    if( ( retv != 0 ) && ( errno == EADDRINUSE ) )
+    {
+        /* is another server using it or is it left over ?
+         */
+
+        int probe = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ;
+
+        if( connect( probe, (struct sockaddr *)&addr, sizeof( addr ) ) == 0 )
+        {
+            if( wrapserver_peer_ok( probe ) )
+            {
+                errorf( "A server is already running on %s", sockpath ) ;
+            }
+            else
+            {
+                errorf( "%s belongs to a server run by another user", sockpath ) ;
+            }
+
+            close( probe ) ;
+
+            umask( mask ) ;
+
+            return -1 ;
+        }
+
+        close( probe ) ;
+
+        unlink( sockpath ) ;
+
+        retv = bind( listenfd, (struct sockaddr *)&addr, sizeof( addr ) ) ;
+    }
+
+    umask( mask ) ;
+
+    if( retv != 0 )
+    {
+        return -1 ;
+    }
+
+    if( listen( listenfd, 128 ) != 0 )
+    {
+        return -1 ;
+    }
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+static void on_signal( int sig )
+{
+    (void)sig ;
+
+    unlink( sockpath ) ;
+
+    _exit( 0 ) ;
+}
+
+
+/**********************************************************************
+ */
+
+int main( int argc, char **argv )
+{
+    int nworkers = 0 ;
+
+    int i = 0 ;
+
+    TURN_ON_DEBUG() ;
+
+    if( wrapserver_path( sockpath, PATH_MAX ) != 0 )
+    {
+        sockpath[0] = 0 ;
+    }
+
+    nworkers = (int)sysconf( _SC_NPROCESSORS_ONLN ) ;
+
+    i = 1 ;
+
+    while( i < argc )
+    {
+        if( ( strcmp( argv[i], "-s" ) == 0 ) && ( i+1 < argc ) )
+        {
+            snprintf( sockpath, PATH_MAX, "%s", argv[i+1] ) ;
+
+            i += 2 ;
+
+            continue ;
+        }
+
+        if( ( strcmp( argv[i], "-j" ) == 0 ) && ( i+1 < argc ) )
+        {
+            nworkers = atoi( argv[i+1] ) ;
+
+            i += 2 ;
+
+            continue ;
+        }
+
+        if( ( strcmp( argv[i], "-m" ) == 0 ) && ( i+1 < argc ) )
+        {
+            max_bytes = strtoull( argv[i+1], NULL, 10 ) << 20 ;
+
+            i += 2 ;
+
+            continue ;
+        }
+
+        errorf( "Unknown argument %s\n\nFormat is %s [-s <socket>] [-j <workers>] [-m <max MB>]\n\n", argv[i], argv[0] ) ;
+
+        return -1 ;
+    } ;
+
+    if( nworkers < 1 )
+    {
+        nworkers = 1 ;
+    }
+
+    if( sockpath[0] == 0 )
+    {
+        errorf( "No socket path\n" ) ;
+
+        return -1 ;
+    }
+
+    /* children of the chain must never see the library
+     */
+
+    unsetenv( "LD_PRELOAD" ) ;
+
+    signal( SIGPIPE, SIG_IGN ) ;
+
+    if( open_socket() != 0 )
+    {
+        errorf( "Could not listen on %s ( %s )", sockpath, strerror( errno ) ) ;
+
+        return -1 ;
+    }
+
+    signal( SIGINT, on_signal ) ;
+    signal( SIGTERM, on_signal ) ;
+
+    SJGF( "listening on %s with %d workers\n", sockpath, nworkers ) ;
+
+    /* the main thread is one of the workers
+     */
+
+    pthread_t tid ;
+
+    for( i = 1 ; i < nworkers ; i++ )
+    {
+        if( pthread_create( &tid, NULL, worker, NULL ) != 0 )
+        {
+            break ;
+        }
+
+        pthread_detach( tid ) ;
+    }
+
+    worker( NULL ) ;
+
+    unlink( sockpath ) ;
+
+    return -1 ;
+}
+
+
+/**********************************************************************
+ */
+
@@ -14,19 +14,155 @@
 #include <limits.h>
 #include <unistd.h>
 
+#include "utils.h"
+
 
 // #define DEBUGME
 
 #include "debugme.h"
 
+#include "wrapsession.h"
+
+#include "wraprules.h"
+
+#include "wrapargs.h"
+
+#include "wrapprepass.h"
+
+#include "wrapsplit.h"
+
+/**********************************************************************
+ */
+
+/* Start a build session so every compiler process started from
+ * here shares its processed files, unless we are already running
+ * inside a session started by another gccwrap.
+ */
+static void start_session( char *commandstr )
+{
+    char fdstr[16] ;
+    
+    int fd = -1 ;
+    
+    if( wrapsession_attach( commandstr ) == 0 )
+    {
+        SJGF( "Using existing session\n" ) ;
+        
+        return ;
+    }
+    
+    fd = wrapsession_create() ;
+    
+    if( fd == -1 )
+    {
+        /* not fatal, each compiler just works alone
+         */
+        
+        SJGF( "Could not create session\n" ) ;
+        
+        return ;
+    }
+    
+    snprintf( fdstr, sizeof( fdstr ), "%d", fd ) ;
+    
+    setenv( WRAPSESSION_ENV, fdstr, 1 ) ;
+    
+    /* for the pre-pass
+     */
+    
+    wrapsession_attach( commandstr ) ;
+}
+
+/**********************************************************************
+ */
+
+/* Compile the WRAP_OPEN_RULES file once, here, so that every
+ * interposer started from here only has to map the result.
+ *
+ * returns 0 unless the rules file is broken
+ */
+static int start_rules()
+{
+    char fdstr[16] ;
+    
+    char *p = getenv( WRAPRULES_ENV ) ;
+    
+    int fd = -1 ;
+    
+    if( ( p == NULL ) || ( *p == 0 ) )
+    {
+        return 0 ;
+    }
+    
+    if( wraprules_attach( FALSE ) == 0 )
+    {
+        SJGF( "Using rules compiled by an outer gccwrap\n" ) ;
+        
+        return 0 ;
+    }
+    
+    fd = wraprules_compile( p ) ;
+    
+    if( fd == -1 )
+    {
+        return -1 ;
+    }
+    
+    snprintf( fdstr, sizeof( fdstr ), "%d", fd ) ;
+    
+    setenv( WRAPRULES_FD_ENV, fdstr, 1 ) ;
+    
+    return 0 ;
+}
+
+/**********************************************************************
+ */
+
+/* wrap_open.so lives alongside us
+ *
+ * returns 0 with its full name in path
+ */
+static int find_preload( char *path )
+{
+    char *p = NULL ;
+    
+    ssize_t n = readlink( "/proc/self/exe", path, PATH_MAX - sizeof( "wrap_open.so" ) ) ;
+    
+    if( n <= 0 )
+    {
+        errorf( "Cannot locate wrap_open.so\n" ) ;
+        
+        return -1 ;
+    }
+    
+    path[n] = 0 ;
+    
+    p = strrchr( path, '/' ) ;
+    
+    strcpy( ( p != NULL ) ? p+1 : path, "wrap_open.so" ) ;
+    
+    if( access( path, F_OK ) != 0 )
+    {
+        errorf( "Cannot find %s\n", path ) ;
+        
+        return -1 ;
+    }
+    
+    return 0 ;
+}
+
 /**********************************************************************
  */
  
 int main( int argc, char **argv )
 {
-    int retv = 0 ;
+    char path[PATH_MAX] ;
     
-    char *p = NULL ;
+    wrapargs_t wa ;
+    
+    char *compiler = NULL ;
+    
+    int retv = 0 ;
     
     TURN_ON_DEBUG() ;
     
@@ -39,91 +175,67 @@ int main( int argc, char **argv )
         return -1 ;
     }
     
-    char path[PATH_MAX] ;
-    
-    char *q = NULL ;
+    /* "gccwrap --session <command> ..." runs any command, e.g.
+     * make, inside one build session shared by every gccwrap
+     * it starts.
+     */
     
-    if( argv[0][0] != '/' )
+    if( strcmp( argv[1], "--session" ) == 0 )
     {
-        /* Not a proper path so need to find wrap_open.so
-         * somewhere on PATH
-         */
-        
-        SJGF( "Trying PATH search...( %s )\n", *argv ) ;
-        
-        q = getenv( "PATH" ) ;
-        
-        SJGF( "PATH = %s\n", q ) ;
-        
-        if( q == NULL )
+        if( argc < 3 )
         {
-            errorf( "Cannot locate wrap_open.so\n" ) ;
+            errorf( "Not enough arguments\n\nFormat is %s --session <command> <args>\n\n", argv[0] ) ;
             
             return -1 ;
         }
         
-        while( *q != 0 )
-        {
-            p = path ;
-            
-            while( *q != ':' )
-            {
-                *p++ = *q++ ;
-            };
-            
-            if( *p != '/' )
-                *p++ = '/' ;
-            
-            strcpy( p, "wrap_open.so" ) ;
-            
-            SJGF( "Trying path = [%s]\n", path ) ;
-            
-            if( access( path, F_OK ) == 0 )
-            {
-                SJGF( "Found wrap_open.so ..." ) ;
-                
-                break ;
-            }
-            
-            q++ ;
-        };
-    }
-    else
-    {
-        /* presumably a proper path so just use it
-         */
+        start_session( "" ) ;
         
-        SJGF( "Using path from %s ...", argv[0] ) ;
+        if( start_rules() != 0 )
+        {
+            return -1 ;
+        }
         
-        q = *argv ;
+        retv = execvp( argv[2], argv+2 ) ;
         
-        p = path ;
+        errorf( "Could not execvp( %s ... )\n", argv[2] ) ;
         
-        while( *q != 0 )
-        {
-            *p = *q ;
-            p++ ;
-            q++ ;
-        };
+        return retv ;
+    }
+    
+    /* We execvp() "gcc", "clang" or "cc" in the end
+     */
+    
+#ifdef TARGET_GCC
+    compiler = "gcc" ;
+#elif TARGET_CLANG
+    compiler = "clang" ;
+#else
+    compiler = "cc" ;
+#endif
+    
+    if( wrapargs_parse( &wa, argc-2, argv+2 ) != 0 )
+    {
+        errorf( "Out of memory\n" ) ;
         
-        while( ( p != path ) && ( *p != '/' ) )
-        {
-            p-- ;
-        };
+        return -1 ;
+    }
+    
+    if( wa.nsources == 0 )
+    {
+        /* Linking, assembling or nothing at all, no source will
+         * be opened so there is nothing to wrap
+         */
         
-        if( p == path )
-        {
-            *p++ = '.' ;
-            *p++ = '/' ;
-        }
-        else
-        {
-            p++ ;
-        }
+        SJGF( "No sources, running %s as it is", compiler ) ;
         
-        strcpy( p, "wrap_open.so" ) ;
+        goto run_compiler ;
     }
     
+    if( find_preload( path ) != 0 )
+    {
+        return -1 ;
+    }
     
     SJGF( "path = %s\n", path ) ;
     
@@ -145,16 +257,32 @@ int main( int argc, char **argv )
         return -1 ;
     }
     
-    /* Now execvp() using "gcc", "clang" or "cc" as argv[0]
+    start_session( argv[1] ) ;
+    
+    if( start_rules() != 0 )
+    {
+        return -1 ;
+    }
+    
+    /* get the sources and their headers processed while the
+     * compiler would still be working on the first of them
      */
     
-#ifdef TARGET_GCC
-    argv[1] = "gcc" ;
-#elif TARGET_CLANG
-    argv[1] = "clang" ;
-#else
-    argv[1] = "cc" ;
-#endif
+    wrapprepass_run( argv[1], &wa ) ;
+    
+    /* and maybe compile them in parallel too
+     */
+    
+    retv = wrapsplit_run( compiler, &wa ) ;
+    
+    if( retv != -1 )
+    {
+        return retv ;
+    }
+    
+run_compiler:
+    
+    argv[1] = compiler ;
     
     retv = execvp( argv[1], argv+1 ) ;
     
@@ -12,6 +12,7 @@
 #include <unistd.h>
 
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -22,6 +23,7 @@
 
 #include <fcntl.h>
 #include <dlfcn.h>
+#include <sys/mman.h>
 #include <stdarg.h>
 #include <sys/types.h>
 
@@ -31,9 +33,32 @@
 
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
 
 #include "utils.h"
 
+#include "wrapchain.h"
+
+#include "wrapcache.h"
+
+#include "wrapsession.h"
+
+#include "wrapserver.h"
+
+#include "wrapprefetch.h"
+
+#include "wraprules.h"
+
+#include "wrapsniff.h"
+
+#include "wraptrace.h"
+
+#include "wrapexec.h"
+
+#include "wraphash.h"
+
 /**********************************************************************
  */
 
@@ -43,7 +68,6 @@
 
 // #define COUNT_STATS
 
-// #define FULL_CLOSE
 
 
 
@@ -56,6 +80,18 @@ typedef int ( *open_fn_t )( const char *pathname, int flags, ... ) ;
 
 typedef int ( *close_fn_t )( int fd ) ;
 
+typedef int ( *chdir_fn_t )( const char *path ) ;
+
+typedef int ( *fchdir_fn_t )( int fd ) ;
+
+typedef int ( *dup_fn_t )( int oldfd ) ;
+
+typedef int ( *dup2_fn_t )( int oldfd, int newfd ) ;
+
+typedef int ( *dup3_fn_t )( int oldfd, int newfd, int flags ) ;
+
+typedef int ( *fcntl_fn_t )( int fd, int cmd, ... ) ;
+
 
 /**********************************************************************
  */
@@ -83,17 +119,111 @@ typedef int ( *close_fn_t )( int fd ) ;
  * but the final string is followed by another
  * nul char ( which means there are two nuls ! ).
  */
-static __thread char *commandlist = NULL ;
+static char *commandlist = NULL ;
+
+
+static wrapchain_t *chain = NULL ;
+
+
+/* Processed files are kept in memfds rather than in tempdir
+ * unless WRAP_OPEN_MEMFD=0 or the kernel has no memfd_create()
+ */
+static int use_memfd = TRUE ;
+
+
+/* Where processed files go without memfds.  WRAP_OPEN_TMPDIR,
+ * otherwise $XDG_RUNTIME_DIR or /dev/shm, which are both
+ * normally tmpfs, or /tmp as a last resort.
+ */
+static char *tempdir = "/tmp" ;
+
+/* Cleared if tempdir cannot have O_TMPFILE files
+ */
+static int use_tmpfile = TRUE ;
+
+
+/* WRAP_OPEN_FSYNC=1 syncs every descriptor opened for writing
+ * when it is closed.  Nothing is synced otherwise.
+ */
+static int use_fsync = FALSE ;
+
+
+/* Set when a gccwrap-server socket exists.  Cleared for the
+ * rest of the process the first time the server cannot be
+ * reached.
+ */
+static int use_server = FALSE ;
+
+static char *serverpath = NULL ;
+
+static char *commandstr = NULL ;
+
+
+/* Set when headers are prefetched by wrapprefetch.c
+ */
+static int use_prefetch = FALSE ;
+
+
+/* Set when there is a WRAP_OPEN_RULES rules file
+ */
+static int use_rules = FALSE ;
+
+static int rules_wanted = FALSE ;
+
+static pthread_once_t rules_once = PTHREAD_ONCE_INIT ;
+
+
+/* Set when every stage of the chain is sniffable, files with
+ * none of the chain's directives in them are then used as they
+ * are
+ */
+static int use_sniff = FALSE ;
+
+
+/* Set when WRAP_OPEN_TRACE asks for timings
+ */
+static int use_trace = FALSE ;
+
+static void prefetch_fetch( char *path ) ;
+
+
+static open_fn_t old_open = NULL ;
+
+static close_fn_t old_close = NULL ;
+
+static chdir_fn_t old_chdir = NULL ;
+
+static fchdir_fn_t old_fchdir = NULL ;
+
+static dup_fn_t old_dup = NULL ;
 
+static dup2_fn_t old_dup2 = NULL ;
 
-static __thread char maintempfilename[PATH_MAX] ;
+static dup3_fn_t old_dup3 = NULL ;
 
+static fcntl_fn_t old_fcntl = NULL ;
 
-static __thread open_fn_t old_open = NULL ;
+static fcntl_fn_t old_fcntl64 = NULL ;
 
-static __thread close_fn_t old_close = NULL ;
 
+/* Bumped by every successful chdir() so that memoised relative
+ * pathnames are not trusted once the cwd may have changed
+ */
+static uint32_t cwd_generation = 1 ;
+
+
+/* Everything above is shared by every thread in the process
+ * and is set up once by init_redirection().  Redirection only
+ * happens once that has succeeded.
+ */
+static int redirection_enabled = FALSE ;
 
+static pthread_once_t redirection_once = PTHREAD_ONCE_INIT ;
+
+
+/* Per thread, so that opens made by the library itself are
+ * never redirected
+ */
 static __thread int supress_redirection = FALSE ;
 
 
@@ -121,12 +251,26 @@ static __thread int supress_redirection = FALSE ;
 static __thread uint64_t rndseed = 0 ;
 
 
+/* name node states
+ *
+ * NAME_STALE is a node left busy by a thread which no longer
+ * exists after a fork(), the next thread to want it redoes it.
+ */
+#define NAME_BUSY       0
+#define NAME_READY      1
+#define NAME_FAILED     2
+#define NAME_STALE      3
+
+
 DEF_LISTNODE(   name,
-                uint32_t             hash ;
+                uint64_t             hash ;
+                int                  state ;
                 char                *realpath ;
                 int                  realpathlen ;
-                char                *tempfilename ;
-                int                  fd ;
+                int                  memfd ;
+                int                  nfds ;
+                int                  prefetched ;
+                int                  opened ;
             )
 
 
@@ -134,61 +278,94 @@ DEF_LISTNODE(   name,
                             { \
                                 (np)->next = NULL ; \
                                 (np)->hash = 0 ; \
+                                (np)->state = NAME_BUSY ; \
                                 (np)->realpath = NULL ; \
                                 (np)->realpathlen = 0 ; \
-                                (np)->tempfilename = NULL ; \
+                                (np)->memfd = -1 ; \
+                                (np)->nfds = 0 ; \
+                                (np)->prefetched = FALSE ; \
+                                (np)->opened = FALSE ; \
                             }
 
 /**********************************************************************
  */
 
+/* All the per-file bookkeeping comes from a pair of bump arenas
+ * which are only ever released all at once by my_fini().
+ *
+ * Nodes and path strings are kept in separate arenas so that
+ * the nodes stay packed together and aligned, while strings
+ * waste no space on alignment.
+ *
+ * Each block is twice the size of the one before, up to
+ * MEMBLOCK_MAXSIZE, so a process needs only a handful of
+ * mallocs however many files it opens.
+ */
+
 DEF_LISTNODE(   memblock,
                 char        *baseptr ;
-                uint32_t     capacity ;
-                uint32_t     used ;
+                size_t       capacity ;
+                size_t       used ;
             )
 
-#define MEMBLOCK_SIZE   4096
+#define MEMBLOCK_SIZE       4096
 
-#define INIT_MEMBLOCK( mb )     if( (mb) != NULL ) \
-                                { \
-                                    (mb)->baseptr = NULL ; \
-                                    (mb)->capacity = MEMBLOCK_SIZE ; \
-                                    (mb)->used = 0 ; \
-                                }
+#define MEMBLOCK_MAXSIZE    ( 1024 * 1024 )
+
+/* size classes
+ */
+#define MEMBLOCK_NODES      0
+#define MEMBLOCK_STRINGS    1
+
+#define MEMBLOCK_NCLASSES   2
+
+#define MEMBLOCK_ALIGN      16
 
-static __thread memblock_t  *memblockp = NULL ;
+
+static memblock_t  *memblocks[MEMBLOCK_NCLASSES] ;
+
+static pthread_mutex_t arenalock = PTHREAD_MUTEX_INITIALIZER ;
 
 
 
 /**********************************************************************
  */
 
-static memblock_t *new_memblock()
+/* The block header and its memory come from a single malloc
+ */
+static memblock_t *new_memblock( int cls, size_t minsize )
 {
     memblock_t *mb = NULL ;
     
-    mb = (memblock_t *)malloc( sizeof(memblock_t) ) ;
+    size_t capacity = MEMBLOCK_SIZE ;
     
-    if( mb == NULL )
-        return NULL ;
+    if( memblocks[cls] != NULL )
+    {
+        capacity = memblocks[cls]->capacity * 2 ;
         
-    INIT_MEMBLOCK( mb ) ;
-    
-    mb->baseptr = (char *)malloc( MEMBLOCK_SIZE ) ;
+        if( capacity > MEMBLOCK_MAXSIZE )
+        {
+            capacity = MEMBLOCK_MAXSIZE ;
+        }
+    }
     
-    if( mb->baseptr == NULL )
+    while( capacity < minsize )
     {
-        free( mb ) ;
-        
+        capacity *= 2 ;
+    } ;
+    
+    mb = (memblock_t *)malloc( sizeof( memblock_t ) + MEMBLOCK_ALIGN + capacity ) ;
+    
+    if( mb == NULL )
         return NULL ;
-    }
     
-    mb->capacity = MEMBLOCK_SIZE ;
+    mb->baseptr = (char *)( ( (uintptr_t)( mb + 1 ) + MEMBLOCK_ALIGN - 1 ) & ~(uintptr_t)( MEMBLOCK_ALIGN - 1 ) ) ;
+    
+    mb->capacity = capacity ;
     mb->used = 0 ;
     
-    mb->next = memblockp ;
-    memblockp = mb ;
+    mb->next = memblocks[cls] ;
+    memblocks[cls] = mb ;
     
     return mb ;
 }
@@ -197,167 +374,536 @@ static memblock_t *new_memblock()
 /**********************************************************************
  */
 
-static char *memblock_alloc( size_t sz )
+static void *memblock_alloc_class( int cls, size_t sz )
 {
     char *retp = NULL ;
     
-    if( sz > MEMBLOCK_SIZE )
-        return NULL ;
+    memblock_t *mb = NULL ;
+    
+    if( cls == MEMBLOCK_NODES )
+    {
+        sz = ( sz + MEMBLOCK_ALIGN - 1 ) & ~(size_t)( MEMBLOCK_ALIGN - 1 ) ;
+    }
+    
+    pthread_mutex_lock( &arenalock ) ;
+    
+    mb = memblocks[cls] ;
     
-    if( sz < ( memblockp->capacity-memblockp->used ) )
+    if( ( mb == NULL ) || ( sz > ( mb->capacity - mb->used ) ) )
     {
         /* get a new block of memory from malloc
          */
         
-        memblock_t *mb = NULL ;
-        
-        mb = new_memblock() ;
+        mb = new_memblock( cls, sz ) ;
+    }
+    
+    if( mb != NULL )
+    {
+        retp = mb->baseptr + mb->used ;
         
-        if( mb == NULL )
-            return NULL ;
+        mb->used += sz ;
     }
     
-    retp = memblockp->baseptr + memblockp->used ;
-
-    memblockp->used += sz ;
+    pthread_mutex_unlock( &arenalock ) ;
     
     return retp ;
 }
 
 
+#define memblock_alloc( sz )    ( (char *)memblock_alloc_class( MEMBLOCK_STRINGS, (sz) ) )
+
+#define memblock_node( type )   ( (type *)memblock_alloc_class( MEMBLOCK_NODES, sizeof( type ) ) )
+
+
 /**********************************************************************
  */
 
-static void memblock_freeall()
+static char *memblock_strdup( const char *s, size_t len )
 {
-    if( memblockp == NULL )
+    char *retp = memblock_alloc( len + 1 ) ;
+    
+    if( retp != NULL )
     {
-        return ;
+        memcpy( retp, s, len + 1 ) ;
     }
     
+    return retp ;
+}
+
+
+/**********************************************************************
+ */
+
+static void memblock_freeall()
+{
     memblock_t *mb = NULL ;
     memblock_t *curr = NULL ;
-
-    LIST_WALK(  memblockp,
-                curr,
-                mb,
-                
-                if( curr->baseptr != NULL )
-                {
-                    free( curr->baseptr ) ;
-                }
-                
-                free( curr ) ;
-             )
+    
+    int cls = 0 ;
+    
+    for( cls = 0 ; cls < MEMBLOCK_NCLASSES ; cls++ )
+    {
+        LIST_WALK(  memblocks[cls],
+                    curr,
+                    mb,
+                    
+                    free( curr ) ;
+                 )
+        
+        memblocks[cls] = NULL ;
+    }
 }
 
 /**********************************************************************
  */
 
-#define HTABLOG     8
+/* The tables below hold pointers in a wraphash_t, keyed by
+ * the full 64 bit path hash so that most mismatches never
+ * touch the path itself.  Lookups take no lock.
+ */
 
-#define HTABSIZE    ( 1 << HTABLOG )
+struct ptab_ent_s ;
 
-#define HTABMOD     ( HTABSIZE -1 )
+struct ptab_ent_s {
+    uint64_t         hash ;
+    void            *ptr ;
+    } ;
 
+typedef struct ptab_ent_s ptab_ent_t ;
 
-struct htab_s ;
 
-struct htab_s {
-    name_t          *namep ;
-    } ;
+/* Walk every pointer stored with hash _h.  _code decides
+ * whether _v is the one it wants.
+ */
+#define PTAB_WALK( _tab, _h, _v, _code )  \
+                        { \
+                            ptab_ent_t *_pe = NULL ; \
+                            \
+                            WRAPHASH_WALK( _tab, _h, ptab_ent_t, _pe, (_v) = _pe->ptr ; _code ) \
+                        }
 
-typedef struct htab_s htab_t ;
-    
 
-static __thread htab_t hashtab[HTABSIZE] ;
+/* Guards inserts into the tables and the state of name nodes
+ */
+static pthread_mutex_t tablock = PTHREAD_MUTEX_INITIALIZER ;
 
+/* Signalled whenever a name node stops being NAME_BUSY
+ */
+static pthread_cond_t tabcond = PTHREAD_COND_INITIALIZER ;
 
-/**********************************************************************
+
+/* Every file we have processed, by canonical path
+ */
+static wraphash_t nametab = WRAPHASH_INIT( ptab_ent_t ) ;
+
+
+/* Stands in for every file the rules exclude, so that they can
+ * be memoised too
+ */
+static name_t excluded_name ;
+
+
+/* Pathnames exactly as the compiler passed them to open(),
+ * mapped to the node for the file they resolve to.  This lets
+ * repeated opens skip realpath() altogether.
+ *
+ * Absolute pathnames are stored with a cwd generation of 0
+ * which matches whatever the cwd is.
+ *
+ * Only nodes in the NAME_READY state, and excluded_name, are
+ * ever memoised.
+ */
+DEF_LISTNODE(   memo,
+                uint64_t         hash ;
+                int              len ;
+                uint32_t         cwdgen ;
+                name_t          *np ;
+                char            *rawpath ;
+            )
+
+
+static wraphash_t memotab = WRAPHASH_INIT( ptab_ent_t ) ;
+
+
+/* Which node, if any, each open descriptor refers to.
+ *
+ * Chunks are allocated on first use and never move, so the
+ * slots can be updated with atomic exchanges alone.
  */
 
+#define FDCHUNKLOG      10
 
-static uint32_t djb_hash( char *p )
+#define FDCHUNKSIZE     ( 1 << FDCHUNKLOG )
+
+#define FDCHUNKS        1024
+
+static name_t **fdchunks[FDCHUNKS] ;
+
+
+/**********************************************************************
+ */
+
+/* must be called with tablock held
+ */
+static int ptab_insert( wraphash_t *tab, uint64_t h, void *ptr )
 {
-    uint32_t h = 0 ;
+    ptab_ent_t ent ;
     
-    while( *p != 0 )
-    {
-        h = 33 * h ^ (uint32_t)(*p) ;
-        p++ ;
-    };
+    ent.hash = h ;
+    ent.ptr = ptr ;
     
-    return h;
+    return wraphash_add( tab, &ent ) ;
 }
 
 
 /**********************************************************************
  */
 
-static void seed_random_number()
+static name_t **fdname_slot( int fd, int create )
 {
-    SAVE_REDIRECTION_STATE
+    name_t **chunk = NULL ;
+    name_t **newchunk = NULL ;
     
-    /* seed the random number generator
-     *
-     * first try using /dev/urandom
-     *
-     * if that fails for any reason we fall back
-     * on a combination of thread id and time.
-     */
+    if( ( fd < 0 ) || ( fd >= FDCHUNKS * FDCHUNKSIZE ) )
+    {
+        return NULL ;
+    }
     
-    int retv = sizeof( rndseed ) ; ;
+    chunk = __atomic_load_n( &fdchunks[ fd >> FDCHUNKLOG ], __ATOMIC_ACQUIRE ) ;
     
-    FILE *fp = NULL ;
+    if( ( chunk == NULL ) && create )
+    {
+        newchunk = (name_t **)calloc( FDCHUNKSIZE, sizeof( name_t * ) ) ;
+        
+        if( newchunk == NULL )
+        {
+            return NULL ;
+        }
+        
+        if( __atomic_compare_exchange_n( &fdchunks[ fd >> FDCHUNKLOG ], &chunk, newchunk,
+                                         FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+        {
+            chunk = newchunk ;
+        }
+        else
+        {
+            /* another thread got there first
+             */
+            
+            free( newchunk ) ;
+        }
+    }
     
-    fp = fopen( "/dev/urandom", "r" ) ;
+    if( chunk == NULL )
+    {
+        return NULL ;
+    }
     
-    if( fp != NULL )
+    return chunk + ( fd & ( FDCHUNKSIZE - 1 ) ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* A node's output stays until the last descriptor open on it is
+ * closed.  Then its unnamed output file is closed and
+ * the node goes back to NAME_STALE, so opening the file again
+ * makes the output again.  Cache entries and files used as they
+ * are have nothing to release.
+ *
+ * nfds counts descriptors plus opens in progress.  name_get()
+ * raises it before checking the state and name_release() sets
+ * the state before checking it, so one of the two always sees
+ * the other.
+ *
+ * Output made by the prefetch has had no descriptor yet, so it
+ * is kept until the compiler has opened it at least once.
+ */
+static void name_release( name_t *np )
+{
+    int memfd = -1 ;
+    
+    pthread_mutex_lock( &tablock ) ;
+    
+    if(    ( np->state != NAME_READY )
+        || ( np->memfd == -1 )
+        || (    __atomic_load_n( &( np->prefetched ), __ATOMIC_ACQUIRE )
+             && ! __atomic_load_n( &( np->opened ), __ATOMIC_ACQUIRE )
+           )
+      )
     {
-        retv = fread( &rndseed, sizeof( rndseed ), 1, fp ) ;
+        pthread_mutex_unlock( &tablock ) ;
         
-        fclose( fp ) ;
+        return ;
     }
     
-    if( ( fp == NULL ) || ( retv != sizeof( rndseed ) ) )
+    __atomic_store_n( &( np->state ), NAME_STALE, __ATOMIC_SEQ_CST ) ;
+    
+    if( __atomic_load_n( &( np->nfds ), __ATOMIC_SEQ_CST ) != 0 )
     {
-        /* fallback on time and tid as seed
-         *
-         * The size of these is not guaranteed
-         * but we can reasonably assume 32-bits will
-         * be available for both.
-         */
-        
-        time_t t ;
-        
-        time( &t ) ;
-        
-        rndseed = ( (uint64_t)t ) << 32 ;
-        
-        /* Next group of 4 bytes from a thread id
+        /* opened again meanwhile
          */
         
-        pid_t tid ;
+        __atomic_store_n( &( np->state ), NAME_READY, __ATOMIC_RELEASE ) ;
         
-        tid = syscall( SYS_gettid ) ;
+        pthread_mutex_unlock( &tablock ) ;
         
-        rndseed = rndseed | ( ( (uint64_t)tid  ) & 0x0ffff ) ;
+        return ;
     }
     
-    RESTORE_REDIRECTION_STATE
+    memfd = np->memfd ;
+    
+    np->memfd = -1 ;
+    
+    /* made again it starts afresh
+     */
+    
+    np->prefetched = FALSE ;
+    np->opened = FALSE ;
+    
+    pthread_mutex_unlock( &tablock ) ;
+    
+    SJGF( "Releasing the output of %s", np->realpath ) ;
+    
+    old_close( memfd ) ;
 }
 
-/**********************************************************************
+
+/* returns FALSE if the node's output has been released
  */
-static uint64_t get_random_number()
+static int name_get( name_t *np )
 {
-    SAVE_REDIRECTION_STATE ;
+    __atomic_add_fetch( &( np->nfds ), 1, __ATOMIC_SEQ_CST ) ;
     
-    /* This is a 64-bit hash algorithm that reportedly has
-     * a VERY long period and whould suffice for random numbers.
-     */
-
-	rndseed ^= rndseed >> 12 ; // a
+    if( __atomic_load_n( &( np->state ), __ATOMIC_SEQ_CST ) == NAME_READY )
+    {
+        return TRUE ;
+    }
+    
+    __atomic_sub_fetch( &( np->nfds ), 1, __ATOMIC_SEQ_CST ) ;
+    
+    return FALSE ;
+}
+
+
+static void name_put( name_t *np )
+{
+    if( __atomic_sub_fetch( &( np->nfds ), 1, __ATOMIC_SEQ_CST ) == 0 )
+    {
+        name_release( np ) ;
+    }
+}
+
+
+/**********************************************************************
+ */
+
+static void fdname_clear( int fd )
+{
+    name_t **slot = fdname_slot( fd, FALSE ) ;
+    
+    name_t *np = NULL ;
+    
+    if( slot == NULL )
+    {
+        return ;
+    }
+    
+    np = __atomic_exchange_n( slot, NULL, __ATOMIC_ACQ_REL ) ;
+    
+    if( np != NULL )
+    {
+        SJGF( "Closing %s", np->realpath ) ;
+        
+        name_put( np ) ;
+    }
+}
+
+
+/**********************************************************************
+ */
+
+static void fdname_set( int fd, name_t *np )
+{
+    name_t **slot = fdname_slot( fd, TRUE ) ;
+    
+    name_t *old = NULL ;
+    
+    if( slot == NULL )
+    {
+        return ;
+    }
+    
+    __atomic_add_fetch( &( np->nfds ), 1, __ATOMIC_SEQ_CST ) ;
+    
+    __atomic_store_n( &( np->opened ), TRUE, __ATOMIC_RELEASE ) ;
+    
+    /* a descriptor closed behind our back
+     */
+    
+    old = __atomic_exchange_n( slot, np, __ATOMIC_ACQ_REL ) ;
+    
+    if( old != NULL )
+    {
+        name_put( old ) ;
+    }
+}
+
+
+/**********************************************************************
+ */
+
+/* newfd is now a duplicate of oldfd
+ */
+static void fdname_dup( int oldfd, int newfd )
+{
+    name_t **slot = fdname_slot( oldfd, FALSE ) ;
+    
+    name_t *np = NULL ;
+    
+    if( slot != NULL )
+    {
+        np = __atomic_load_n( slot, __ATOMIC_ACQUIRE ) ;
+    }
+    
+    if( np != NULL )
+    {
+        fdname_set( newfd, np ) ;
+    }
+    else
+    {
+        fdname_clear( newfd ) ;
+    }
+}
+
+
+/**********************************************************************
+ */
+
+/* MurmurHash64A, 8 bytes at a time
+ */
+static uint64_t path_hash( const char *p, size_t len )
+{
+    const uint64_t m = UINT64_C(0xc6a4a7935bd1e995) ;
+    
+    const int r = 47 ;
+    
+    uint64_t h = UINT64_C(0x5bd1e9955bd1e995) ^ ( len * m ) ;
+    
+    uint64_t k = 0 ;
+    
+    while( len >= 8 )
+    {
+        memcpy( &k, p, 8 ) ;
+        
+        k *= m ;
+        k ^= k >> r ;
+        k *= m ;
+        
+        h ^= k ;
+        h *= m ;
+        
+        p += 8 ;
+        len -= 8 ;
+    } ;
+    
+    if( len > 0 )
+    {
+        k = 0 ;
+        
+        memcpy( &k, p, len ) ;
+        
+        h ^= k ;
+        h *= m ;
+    }
+    
+    h ^= h >> r ;
+    h *= m ;
+    h ^= h >> r ;
+    
+    /* zero marks an empty slot in the tables
+     */
+    
+    return WRAPHASH_KEY( h ) ;
+}
+
+
+/**********************************************************************
+ */
+
+static void seed_random_number()
+{
+    SAVE_REDIRECTION_STATE
+    
+    /* seed the random number generator
+     *
+     * first try using /dev/urandom
+     *
+     * if that fails for any reason we fall back
+     * on a combination of thread id and time.
+     */
+    
+    int retv = sizeof( rndseed ) ; ;
+    
+    FILE *fp = NULL ;
+    
+    fp = fopen( "/dev/urandom", "r" ) ;
+    
+    if( fp != NULL )
+    {
+        retv = fread( &rndseed, sizeof( rndseed ), 1, fp ) ;
+        
+        fclose( fp ) ;
+    }
+    
+    if( ( fp == NULL ) || ( retv != sizeof( rndseed ) ) )
+    {
+        /* fallback on time and tid as seed
+         *
+         * The size of these is not guaranteed
+         * but we can reasonably assume 32-bits will
+         * be available for both.
+         */
+        
+        time_t t ;
+        
+        time( &t ) ;
+        
+        rndseed = ( (uint64_t)t ) << 32 ;
+        
+        /* Next group of 4 bytes from a thread id
+         */
+        
+        pid_t tid ;
+        
+        tid = syscall( SYS_gettid ) ;
+        
+        rndseed = rndseed | ( ( (uint64_t)tid  ) & 0x0ffff ) ;
+    }
+    
+    RESTORE_REDIRECTION_STATE
+}
+
+/**********************************************************************
+ */
+static uint64_t get_random_number()
+{
+    /* each thread has its own generator
+     */
+    
+    if( rndseed == 0 )
+    {
+        seed_random_number() ;
+    }
+    
+    SAVE_REDIRECTION_STATE ;
+    
+    /* This is a 64-bit hash algorithm that reportedly has
+     * a VERY long period and whould suffice for random numbers.
+     */
+
+	rndseed ^= rndseed >> 12 ; // a
 	rndseed ^= rndseed << 25 ; // b
 	rndseed ^= rndseed >> 27 ; // c
 	
@@ -439,202 +985,556 @@ static void fill_random_name( char *newname )
 /**********************************************************************
  */
 
-static char *make_temp_file( char *source )
+/* Create an empty file for a processed version of a source
+ *
+ * The output goes into an anonymous memory file if we can have
+ * one.  Otherwise it is an unnamed file in tempdir, made with
+ * O_TMPFILE or, where the file system cannot do that, created
+ * with O_EXCL and unlinked at once.  Either way there is never
+ * a name left behind to clean up, even if the compiler crashes.
+ *
+ * returns a read/write descriptor or -1
+ */
+static int new_output_file()
 {
-    char *newname = NULL ;
+    char newname[PATH_MAX] ;
     
-    SAVE_REDIRECTION_STATE
+    int fd = -1 ;
     
-    SJGF( "making temp file from %s", source ) ;
-
-    int retv = 0 ;
-
-    /* default return is to NULL
-     * which flags any error to the caller.
-     */
+    int len = 0 ;
     
-    /* can we even open the source for reading ?
-     */
+    int i = 0 ;
     
-    if( access( source, R_OK ) != 0 )
+    if( use_memfd )
     {
-        SJGF( "Could not read %s", source ) ;
+        fd = memfd_create( "wrapo", MFD_CLOEXEC ) ;
         
-        goto err_exit ;
+        if( fd != -1 )
+        {
+            return fd ;
+        }
     }
     
-    /* get a temp name
-     */
-    
-    char *p = NULL ;
-    
-    newname = memblock_alloc( 13 + 11 ) ;
-    
-    if( newname == NULL )
+#ifdef O_TMPFILE
+    if( use_tmpfile )
     {
-        SJG() ;
-    
-        goto err_exit ;
+        fd = open( tempdir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600 ) ;
+        
+        if( fd != -1 )
+        {
+            return fd ;
+        }
+        
+        if( ( errno == EISDIR ) || ( errno == EOPNOTSUPP ) || ( errno == EINVAL ) )
+        {
+            /* not supported here, don't ask again
+             */
+            
+            use_tmpfile = FALSE ;
+        }
     }
+#endif
     
-    strcpy( newname, "/tmp/wrapo-" ) ;
+    len = snprintf( newname, sizeof( newname ), "%s/wrapo-", tempdir ) ;
     
-    int i = 0 ;
+    if( len + 13 > (int)sizeof( newname ) )
+    {
+        return -1 ;
+    }
     
-    fill_random_name( newname + 11 ) ;
+    /* O_EXCL tells us if the name is taken, so there is no
+     * need to look first
+     */
     
-    while( ( i < 16 ) && ( access( newname, F_OK ) == 0 ) )
+    for( i = 0 ; i < 16 ; i++ )
     {
-        fill_random_name( newname+11 ) ;
+        fill_random_name( newname + len ) ;
         
-        i++ ;
+        fd = open( newname, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600 ) ;
+        
+        if( fd != -1 )
+        {
+            unlink( newname ) ;
+            
+            return fd ;
+        }
+        
+        if( errno != EEXIST )
+        {
+            break ;
+        }
     }
+    
+    SJGF( "Could not create a file in %s", tempdir ) ;
+    
+    return -1 ;
+}
 
-#ifdef DEBUGME    
-    if( i > 0 )
-    {
-        SJGF( "%d calls to fill_random_name()", i ) ;
-    }
-#endif
+/**********************************************************************
+ */
+
+/* Write a processed file held in memory to fd
+ */
+static int write_all( int fd, char *data, size_t len )
+{
+    ssize_t n = 0 ;
     
-    if( i == 16 )
+    while( len > 0 )
     {
-        /* we consider trying to make a tempfile name
-         * 16 times a fail !
-         */
+        n = write( fd, data, len ) ;
         
-        SJG() ;
-        
-        newname[0] = 0 ;
+        if( n <= 0 )
+        {
+            return -1 ;
+        }
         
-        goto err_exit ;
-    }
+        data += n ;
+        len -= n ;
+    };
     
-    SJGF( "Offered new temp name : %s", newname ) ;
+    return 0 ;
+}
+
+/**********************************************************************
+ */
+
+/* Produce the processed version of source and record where it
+ * ended up in ns.  That is one of :
+ *
+ *   a descriptor ( ns->memfd ) for an unnamed file which needs
+ *     no cleanup, or for a cache entry held open so that a trim
+ *     by another process cannot take it away
+ *   nowhere, when the chain would not change the file and the
+ *     source itself is used
+ *
+ * Files which need no processing are weeded out first.  Then
+ * the build session is asked, then gccwrap-server if
+ * there is one, then the persistent cache and only then is the
+ * command chain run.
+ *
+ * returns 0 on success
+ */
+static int make_temp_file( char *source, name_t *ns )
+{
+    int retv = -1 ;
     
-    /* Have a new name so now invoke "Cap"
-     */
+    SAVE_REDIRECTION_STATE
+    
+    SJGF( "making temp file from %s", source ) ;
+
+    int fd = -1 ;
     
-    char cmd[3*PATH_MAX] ;
+    int status = 0 ;
     
-    /* LD_PRELOAD needs to be saved and cleared before
-     * calling system() or system will start it's own
-     * copy of this library, which would become a race.
-     */
+    int havekey = FALSE ;
     
-    char preload[PATH_MAX] ;
+    wrapcache_key_t key ;
     
-    preload[0] = 0 ;
+    struct stat st ;
     
-    p = getenv( "LD_PRELOAD" ) ;
+    int session = WRAPSESSION_NONE ;
     
-    strncpy( preload, p, PATH_MAX ) ;
+    wrapsession_slot_t *slot = NULL ;
     
-    unsetenv( "LD_PRELOAD" ) ;
+    uint64_t t0 = 0 ;
+    uint64_t t1 = 0 ;
     
-    /* Now pass through all the commands in the command list
+    char *how = "failed" ;
+    
+    if( use_trace )
+    {
+        t0 = wraptrace_now() ;
+    }
+    
+    /* can we even open the source for reading ?
      */
     
-    p = commandlist ;
+    if( ( access( source, R_OK ) != 0 ) || ( stat( source, &st ) != 0 ) )
+    {
+        SJGF( "Could not read %s", source ) ;
+        
+        goto err_exit ;
+    }
     
-    char *src = source ;
-    char *dest = newname ;
+    if( use_sniff && ! wrapsniff_needed( source, &st ) )
+    {
+        SJGF( "Using %s as it is", source ) ;
+        
+        how = "unchanged" ;
+        
+        retv = 0 ;
+        
+        goto err_exit ;
+    }
     
-    do
+    /* Has another compiler in this build session already
+     * processed the file ?  If not we become responsible
+     * for publishing it.
+     */
+    
+    session = wrapsession_claim( source, &st, &slot ) ;
+    
+    if( session == WRAPSESSION_HIT )
     {
-        snprintf( cmd, 3*PATH_MAX, "%s -o %s %s\n", p, dest, src ) ;
+        char *data = NULL ;
+        
+        size_t len = 0 ;
         
-        SJGF( "CMD = %s", cmd ) ;
+        if( wrapsession_data( slot, &data, &len ) == 0 )
+        {
+            fd = new_output_file() ;
+            
+            if( fd != -1 )
+            {
+                if( write_all( fd, data, len ) == 0 )
+                {
+                    how = "session" ;
+                    
+                    goto have_output ;
+                }
+                
+                close( fd ) ;
+                
+                fd = -1 ;
+            }
+        }
+    }
+    
+    /* Let the server do the work if there is one, it hands
+     * back a memfd
+     */
+    
+    if( use_server )
+    {
+        fd = wrapserver_request( serverpath, commandstr, source ) ;
         
-        retv = system( cmd ) ;
+        if( fd == WRAPSERVER_DOWN )
+        {
+            use_server = FALSE ;
+        }
         
-        if( retv == -1 )
+        if( fd >= 0 )
         {
-            SJGF( "CMD FAILED :: %s", cmd ) ;
+            if( session == WRAPSESSION_OWNER )
+            {
+                wrapsession_publish( slot, fd ) ;
+            }
             
-            newname[0] = 0 ;
+            how = "server" ;
             
-            break ;
+            goto have_output ;
         }
         
-        /* read PAST the current command
+        fd = -1 ;
+    }
+    
+    /* Has any process already processed the same contents
+     * with the same command chain ?
+     */
+    
+    if( use_trace )
+    {
+        t1 = wraptrace_now() ;
+    }
+    
+    if( wrapcache_key( source, &key ) == 0 )
+    {
+        havekey = TRUE ;
+        
+        char cachename[ wrapcache_pathlen() ] ;
+        
+        /* the entry is held open from here on, if it has gone
+         * already the chain is run as for a miss
          */
         
-        while( *p != 0 )
+        if( wrapcache_lookup( &key, cachename ) == 0 )
         {
-            p++ ;
-        };
-        
-        p++ ;
+            fd = open( cachename, O_RDONLY | O_CLOEXEC ) ;
+        }
         
-        if( *p != 0 )
+        if( fd != -1 )
         {
-            /* switch src and dest file names around
-             */
+            how = "cache" ;
             
-            src = dest ;
-            
-            if( dest == newname )
+            if( use_trace )
             {
-                dest = maintempfilename ;
+                wraptrace_span( WRAPTRACE_CACHE, "hit", source, t1, wraptrace_now() ) ;
             }
-            else
+            
+            if( session == WRAPSESSION_OWNER )
             {
-                dest = newname ;
+                wrapsession_publish( slot, fd ) ;
             }
+            
+            goto have_output ;
         }
+    }
+    
+    if( use_trace && havekey )
+    {
+        wraptrace_span( WRAPTRACE_CACHE, "miss", source, t1, wraptrace_now() ) ;
+    }
+    
+    fd = new_output_file() ;
+    
+    if( fd == -1 )
+    {
+        goto err_exit ;
+    }
+    
+    how = "chain" ;
+    
+    /* Now run the command chain with its output going
+     * straight into the new file
+     */
+    
+    status = wrapchain_run( chain, source, fd ) ;
+    
+    if( status == -1 )
+    {
+        SJGF( "Chain FAILED for %s", source ) ;
+        
+        close( fd ) ;
         
-    } while( *p != 0 ) ;
+        goto err_exit ;
+    }
     
-    /* Now may need to rename dest file
-     * unless an error already occured
+    /* only a complete output can be shared
      */
     
-    if( ( retv != -1 ) && ( dest == maintempfilename ) )
+    if( status == 0 )
     {
-        /* rename() should overwrite any existing file !
-         * unless it's in use, which should not be the case.
+        if( havekey )
+        {
+            wrapcache_store( &key, fd ) ;
+        }
+        
+        if( session == WRAPSESSION_OWNER )
+        {
+            wrapsession_publish( slot, fd ) ;
+        }
+    }
+    
+have_output:
+    
+    ns->memfd = fd ;
+    
+    SJGF( "Created fd %d ( for %s )", fd, source ) ;
+    
+    retv = 0 ;
+    
+err_exit:
+    
+    if( session == WRAPSESSION_OWNER )
+    {
+        /* does nothing if the slot was published, otherwise
+         * it lets other processes stop waiting for us
          */
+        
+        wrapsession_fail( slot ) ;
+    }
+    
+    if( use_trace )
+    {
+        wraptrace_span( WRAPTRACE_PROCESS, how, source, t0, wraptrace_now() ) ;
+    }
+    
+    RESTORE_REDIRECTION_STATE
+    
+    return retv ;
+}
+
+/**********************************************************************
+ */
+
+/* Called by wrapchain_run() for each stage it ran
+ */
+static void trace_stage( wrapchain_stage_t *st, char *source, struct timespec *start, struct timespec *end )
+{
+    wraptrace_span( WRAPTRACE_STAGE, st->command, source,
+                    (uint64_t)start->tv_sec * 1000000 + start->tv_nsec / 1000,
+                    (uint64_t)end->tv_sec * 1000000 + end->tv_nsec / 1000 ) ;
+}
+
+/**********************************************************************
+ */
+
+/* Pick the directory for processed files when there are no
+ * memfds
+ */
+static void init_tempdir()
+{
+    struct stat st ;
+    
+    char *p = getenv( "WRAP_OPEN_TMPDIR" ) ;
+    
+    if( ( p == NULL ) || ( *p == 0 ) )
+    {
+        p = getenv( "XDG_RUNTIME_DIR" ) ;
+    }
+    
+    if( ( p == NULL ) || ( *p == 0 ) || ( access( p, W_OK ) != 0 ) )
+    {
+        p = "/dev/shm" ;
+        
+        if( ( stat( p, &st ) != 0 ) || ! S_ISDIR( st.st_mode ) || ( access( p, W_OK ) != 0 ) )
+        {
+            p = "/tmp" ;
+        }
+    }
     
-        retv = rename( maintempfilename, newname ) ;
+    tempdir = p ;
+}
+
+/**********************************************************************
+ */
+
+/* The descriptor duplicating calls may be used before my_init()
+ */
+static void init_dup_fns()
+{
+    if( old_dup == NULL )
+    {
+        old_dup = ( dup_fn_t )dlsym( RTLD_NEXT, "dup" ) ;
+    }
+    
+    if( old_dup2 == NULL )
+    {
+        old_dup2 = ( dup2_fn_t )dlsym( RTLD_NEXT, "dup2" ) ;
+    }
+    
+    if( old_dup3 == NULL )
+    {
+        old_dup3 = ( dup3_fn_t )dlsym( RTLD_NEXT, "dup3" ) ;
     }
     
-    if( retv == -1 )
+    if( old_fcntl == NULL )
     {
-        /* signal an error
+        old_fcntl = ( fcntl_fn_t )dlsym( RTLD_NEXT, "fcntl" ) ;
+    }
+    
+    if( old_fcntl64 == NULL )
+    {
+        /* only in newer C libraries
          */
         
-        newname[0] = 0 ;
+        old_fcntl64 = ( fcntl_fn_t )dlsym( RTLD_NEXT, "fcntl64" ) ;
+        
+        if( old_fcntl64 == NULL )
+        {
+            old_fcntl64 = old_fcntl ;
+        }
     }
+}
+
+/**********************************************************************
+ */
+
+/* Only bother with the server if its socket is there and is ours
+ */
+static void init_server()
+{
+    struct stat st ;
     
-    /* finally restore the LD_PRELOAD var
-     */
+    char *p = getenv( "WRAP_OPEN_COMMAND" ) ;
     
-    setenv( "LD_PRELOAD", preload, 1 ) ;
+    serverpath = (char *)malloc( PATH_MAX ) ;
     
-    SJGF( "Created %s ( for %s )", newname, source ) ;
+    if( ( serverpath == NULL ) || ( p == NULL ) )
+    {
+        return ;
+    }
     
-err_exit:
+    if( wrapserver_path( serverpath, PATH_MAX ) != 0 )
+    {
+        return ;
+    }
     
-    RESTORE_REDIRECTION_STATE
+    if(    ( lstat( serverpath, &st ) != 0 )
+        || ( ! S_ISSOCK( st.st_mode ) )
+        || ( st.st_uid != getuid() ) )
+    {
+        return ;
+    }
+    
+    commandstr = strdup( p ) ;
+    
+    if( commandstr != NULL )
+    {
+        use_server = TRUE ;
+    }
+}
+
+/**********************************************************************
+ */
+
+/* fork() must not happen with either lock held by a thread
+ * which will not exist in the child
+ */
+static void prefork()
+{
+    pthread_mutex_lock( &tablock ) ;
+    
+    pthread_mutex_lock( &arenalock ) ;
+}
+
+
+static void postfork_parent()
+{
+    pthread_mutex_unlock( &arenalock ) ;
+    
+    pthread_mutex_unlock( &tablock ) ;
+}
+
+
+static void postfork_child()
+{
+    uint32_t i = 0 ;
+    
+    ptab_ent_t *pe = NULL ;
+    
+    name_t *np = NULL ;
+    
+    /* files being processed by other threads of the parent
+     * would never be finished in the child
+     */
+    
+    for( i = 0 ; ( nametab.arr != NULL ) && ( i < nametab.arr->size ) ; i++ )
+    {
+        pe = (ptab_ent_t *)WRAPHASH_SLOT( nametab.arr, nametab.entsize, i ) ;
+        
+        np = ( pe->hash != 0 ) ? (name_t *)pe->ptr : NULL ;
+        
+        if( ( np != NULL ) && ( np->state == NAME_BUSY ) )
+        {
+            np->state = NAME_STALE ;
+        }
+    }
     
-    return newname ;
+    pthread_cond_init( &tabcond, NULL ) ;
+    
+    pthread_mutex_unlock( &arenalock ) ;
+    
+    pthread_mutex_unlock( &tablock ) ;
 }
 
 /**********************************************************************
  */
 
 
+/* Every process the compiler driver starts, as and ld as well as
+ * cc1, loads us.  So my_init() only finds the functions we wrap
+ * and everything else waits for the first open() of a source
+ * file, see init_redirection().
+ */
 void __attribute__ ((constructor)) my_init()
 {
-    supress_redirection = TRUE ;
+    char *p = NULL ;
     
     SJGF( "In my_init()" ) ;
     
     INIT_DEBUGME() ;
     
-    char *p = NULL ;
-    
     if( old_open == NULL )
     {
         old_open = ( open_fn_t )dlsym( RTLD_NEXT, "open" ) ;
@@ -645,62 +1545,80 @@ void __attribute__ ((constructor)) my_init()
         old_close = ( close_fn_t )dlsym( RTLD_NEXT, "close" ) ;
     }
     
-    if( ( old_open == NULL ) || ( old_close == NULL ) )
+    if( old_chdir == NULL )
     {
-        return ;
+        old_chdir = ( chdir_fn_t )dlsym( RTLD_NEXT, "chdir" ) ;
+    }
+
+    if( old_fchdir == NULL )
+    {
+        old_fchdir = ( fchdir_fn_t )dlsym( RTLD_NEXT, "fchdir" ) ;
     }
     
-    seed_random_number() ;
-    
-    /* back to business
-     */
+    init_dup_fns() ;
     
-    supress_redirection = FALSE ;
+    wrapexec_init() ;
     
-    int i = 0 ;
+    p = getenv( "WRAP_OPEN_FSYNC" ) ;
     
-    for( i = 0 ; i < HTABSIZE ; i++ )
+    if( ( p != NULL ) && ( strcmp( p, "1" ) == 0 ) )
     {
-        hashtab[i].namep = NULL ;
+        use_fsync = TRUE ;
     }
     
-    /* we "grab" one temp filename for use in
-     * executing commands ( rather than having
-     * mutiple temp filenames for every single
-     * command sequence
-     */
-     
-    maintempfilename[0] = 0 ;
+    p = getenv( WRAPRULES_ENV ) ;
     
-    /* get a temp name
-     */
+    rules_wanted = ( ( p != NULL ) && ( *p != 0 ) ) || ( getenv( WRAPRULES_FD_ENV ) != NULL ) ;
+}
+
+/**********************************************************************
+ */
+
+/* ext rules decide what is a source file, so they are needed
+ * before anything else
+ */
+static void init_rules()
+{
+    int saved = supress_redirection ;
     
-    strcpy( maintempfilename, "/tmp/wrapo-" ) ;
+    supress_redirection = TRUE ;
     
-    fill_random_name( maintempfilename + 11 ) ;
+    use_rules = ( wraprules_attach( TRUE ) == 0 ) ;
     
-    i = 0 ;
+    supress_redirection = saved ;
+}
+
+/**********************************************************************
+ */
+
+/* stands in for init_redirection() once we are exiting
+ */
+static void init_nothing()
+{
+}
+
+/**********************************************************************
+ */
+
+/* Run once, by the first open() of a source file
+ */
+static void init_redirection()
+{
+    char *p = NULL ;
     
-    while( ( i < 16 ) && ( access( maintempfilename, F_OK ) == 0 ) )
-    {
-        fill_random_name( maintempfilename+11 ) ;
-        
-        i++ ;
-    }
+    int i = 0 ;
     
-    if( i == 16 )
+    if( ( old_open == NULL ) || ( old_close == NULL ) )
     {
-        /* we consider trying to make a tempfile name
-         * 16 times a fail !
-         */
-        
-        SJG() ;
-        
-        supress_redirection = TRUE ;
-        
         return ;
     }
     
+    supress_redirection = TRUE ;
+    
+    init_tempdir() ;
+    
+    supress_redirection = FALSE ;
+    
     /* We need to check for a command list in the
      * environment variable WRAP_OPEN_COMMAND
      *
@@ -709,11 +1627,12 @@ void __attribute__ ((constructor)) my_init()
      * This will be used to build command lines
      * with this form :
      *
-     *   <command> -o <tempfile> <inputfile>
+     *   <command> -o /dev/stdout <inputfile>
      *
-     * <tempfile> is supplied by the shared library
-     * and <inputfile> is the file supplied by the
-     * OS to the open() command.
+     * <inputfile> is the file supplied by the OS to
+     * the open() command for the first command and
+     * /dev/stdin for the rest, which read the output
+     * of the previous command through a pipe.
      */
     
     commandlist == NULL ;
@@ -784,220 +1703,444 @@ void __attribute__ ((constructor)) my_init()
         supress_redirection = TRUE ;
     }
     
-    memblockp = new_memblock() ;
+    p = getenv( "WRAP_OPEN_MEMFD" ) ;
     
-    if( memblockp == NULL )
+    if( ( p != NULL ) && ( strcmp( p, "0" ) == 0 ) )
+    {
+        use_memfd = FALSE ;
+    }
+    
+    if( supress_redirection == FALSE )
     {
         supress_redirection = TRUE ;
+        
+        /* find the commands now rather than on every file
+         */
+        
+        chain = wrapchain_new( commandlist ) ;
+        
+        if( chain != NULL )
+        {
+            wrapcache_init( chain ) ;
+            
+            wrapsession_attach( getenv( "WRAP_OPEN_COMMAND" ) ) ;
+            
+            init_server() ;
+            
+            use_prefetch = ( wrapprefetch_init( prefetch_fetch ) == 0 ) ;
+            
+            use_sniff = ( wrapsniff_init( chain ) == 0 ) ;
+            
+            use_trace = ( wraptrace_init() == 0 ) ;
+            
+            if( use_trace )
+            {
+                chain->trace = trace_stage ;
+            }
+            
+            pthread_atfork( prefork, postfork_parent, postfork_child ) ;
+            
+            __atomic_store_n( &redirection_enabled, TRUE, __ATOMIC_RELEASE ) ;
+        }
     }
+    
+    /* the open() which called us carries on with redirection
+     * supressed
+     */
+    
+    supress_redirection = TRUE ;
 }
 
 /**********************************************************************
  */
 
-#ifndef DEBUGME
-#  define dumpfile(fn)
-#else
 
-static void dumpfile( char *fn )
+void __attribute__ ((destructor)) my_fini()
 {
-    if( supress_redirection == FALSE )
-        return ;
-
-    FILE *fin = NULL ;
+    SJGF( "In my_fini()" ) ;
     
-    fin = fopen( fn, "r" ) ;
+    supress_redirection = TRUE ;
     
-    if( fn == NULL )
-        return ;
+    /* a source opened by another thread from here on must not
+     * start anything up
+     */
+    
+    pthread_once( &redirection_once, init_nothing ) ;
+    
+    redirection_enabled = FALSE ;
+    
+    /* the workers may be using the tables
+     */
+    
+    wrapprefetch_stop() ;
+    
+    wraptrace_flush() ;
+    
+    uint32_t i = 0 ;
     
-    SJGF( "\nFILEDUMP :: %s\n", fn ) ;
+    /* processed files have no names, so there is nothing to
+     * remove
+     */
+    
+    /* the nodes themselves go with the arenas
+     */
     
-    int c = 0;
+    wraphash_free( &nametab ) ;
     
-    c = fgetc( fin ) ;
+    wraphash_free( &memotab ) ;
     
-    while( ( c != -1 ) && !feof(fin) )
+    for( i = 0 ; i < FDCHUNKS ; i++ )
     {
-        fputc( c, stderr ) ;
+        free( __atomic_exchange_n( &fdchunks[i], NULL, __ATOMIC_ACQ_REL ) ) ;
+    }
     
-        c = fgetc( fin ) ;
-    };
+    wrapchain_free( chain ) ;
+    
+    free( commandlist ) ;
+    
+    free( commandstr ) ;
     
-    fclose( fin ) ;
+    free( serverpath ) ;
     
-    SJGF( "\nFILEDUMP-ENDS\n" ) ;
+    memblock_freeall() ;
+    
+    OUTPUT_HASHTAB_HITS() ;
+}
+
+/**********************************************************************
+ */
+
+/* Look up a pathname exactly as it was passed to open()
+ */
+static name_t *memo_find( const char *pathname, int len, uint64_t h )
+{
+    memo_t *mp = NULL ;
+    
+    uint32_t gen = ( pathname[0] == '/' ) ? 0 : __atomic_load_n( &cwd_generation, __ATOMIC_ACQUIRE ) ;
+    
+    PTAB_WALK(  memotab,
+                h,
+                mp,
+                
+                if(    ( mp->len == len ) && ( mp->cwdgen == gen )
+                    && ( memcmp( mp->rawpath, pathname, len ) == 0 )
+                  )
+                {
+                    INC_HASHTAB_HITS() ;
+                    
+                    return mp->np ;
+                }
+             )
+    
+    return NULL ;
 }
 
-#endif
 
 /**********************************************************************
  */
 
+static void memo_add( const char *pathname, int len, uint64_t h, name_t *np )
+{
+    memo_t *mp = NULL ;
+    
+    pthread_mutex_lock( &tablock ) ;
+    
+    /* another thread may have beaten us to it
+     */
+    
+    if( memo_find( pathname, len, h ) == NULL )
+    {
+        mp = memblock_node( memo_t ) ;
+        
+        if( mp != NULL )
+        {
+            mp->rawpath = memblock_strdup( pathname, len ) ;
+        }
+        
+        if( ( mp != NULL ) && ( mp->rawpath != NULL ) )
+        {
+            mp->hash = h ;
+            mp->len = len ;
+            mp->cwdgen = ( pathname[0] == '/' ) ? 0 : __atomic_load_n( &cwd_generation, __ATOMIC_ACQUIRE ) ;
+            mp->np = np ;
+            
+            ptab_insert( &memotab, h, mp ) ;
+        }
+    }
+    
+    pthread_mutex_unlock( &tablock ) ;
+}
 
-void __attribute__ ((destructor)) my_fini()
+
+/**********************************************************************
+ */
+
+/* Queue up the headers a newly processed file includes
+ */
+static void prefetch_from( name_t *np )
 {
-    SJGF( "In my_fini()" ) ;
+    int fd = -1 ;
     
-    supress_redirection = TRUE ;
+    /* the compiler may already have opened and closed it
+     */
     
-    name_t *np = NULL ;
-    name_t *curr = NULL ;
+    if( ! name_get( np ) )
+    {
+        return ;
+    }
+    
+    fd = np->memfd ;
+    
+    if( fd == -1 )
+    {
+        fd = open( np->realpath, O_RDONLY | O_CLOEXEC ) ;
+    }
+    
+    if( fd != -1 )
+    {
+        wrapprefetch_scan( np->realpath, fd ) ;
+        
+        if( fd != np->memfd )
+        {
+            close( fd ) ;
+        }
+    }
+    
+    name_put( np ) ;
+}
 
-    int retv = 0 ;
+
+/**********************************************************************
+ */
+
+/* Find the node for the file a pathname resolves to, making
+ * the processed version of the file if this is the first time
+ * we have seen it.
+ *
+ * A new node goes into the table as NAME_BUSY before its file
+ * is processed, without tablock held, so other threads wanting
+ * the same file wait for it while threads wanting other files
+ * carry on.
+ *
+ * A node returned holds a reference on its output, dropped by
+ * name_put() once the caller has opened it.
+ *
+ * returns NULL if the file should be opened as it is
+ */
+static name_t *find_name( const char *pathname )
+{
+    char rp[PATH_MAX] ;
+    
+    name_t *np = NULL ;
+    
+    uint64_t h = 0 ;
+    
+    int len = 0 ;
+    
+    int state = NAME_BUSY ;
+    
+    /* one cheap syscall weeds out the include search
+     * candidates which do not exist
+     */
+    
+    if( access( pathname, R_OK ) != 0 )
+    {
+        return NULL ;
+    }
+    
+    if( realpath( pathname, rp ) == NULL )
+    {
+        return NULL ;
+    }
+    
+    len = strlen( rp ) ;
+    
+    if( use_rules )
+    {
+        /* the rules are matched against the canonical path, and
+         * without a matching rule /usr is still left alone
+         */
+        
+        state = wraprules_location( rp, len ) ;
+        
+        if( state == WRAPRULES_NOMATCH )
+        {
+            state = ( strncmp( rp, "/usr/", 5 ) == 0 ) ? WRAPRULES_EXCLUDE : WRAPRULES_INCLUDE ;
+        }
+        
+        if( state == WRAPRULES_EXCLUDE )
+        {
+            SJGF( "%s excluded by rules", rp ) ;
+            
+            return &excluded_name ;
+        }
+        
+        state = NAME_BUSY ;
+    }
+    
+    h = path_hash( rp, len ) ;
+    
+    SJGF( "hash = %" PRIx64 " :: len = %d", h, len ) ;
+    
+    /* the common case needs no lock
+     */
+    
+    PTAB_WALK(  nametab,
+                h,
+                np,
+                
+                if(    ( np->realpathlen == len )
+                    && ( memcmp( rp, np->realpath, len ) == 0 )
+                  )
+                {
+                    if( ( __atomic_load_n( &( np->state ), __ATOMIC_ACQUIRE ) == NAME_READY ) && name_get( np ) )
+                    {
+                        return np ;
+                    }
+                    
+                    break ;
+                }
+             )
+    
+    pthread_mutex_lock( &tablock ) ;
+    
+    while( TRUE )
+    {
+        np = NULL ;
+        
+        PTAB_WALK(  nametab,
+                    h,
+                    np,
+                    
+                    if(    ( np->realpathlen == len )
+                        && ( memcmp( rp, np->realpath, len ) == 0 )
+                      )
+                    {
+                        break ;
+                    }
+                    
+                    np = NULL ;
+                 )
+        
+        if( np == NULL )
+        {
+            /* A file we have not processed yet
+             */
+            
+            np = memblock_node( name_t ) ;
+            
+            if( np != NULL )
+            {
+                INIT_NAME( np ) ;
+                
+                np->realpath = memblock_strdup( rp, len ) ;
+                np->hash = h ;
+                np->realpathlen = len ;
+            }
+            
+            if( ( np == NULL ) || ( np->realpath == NULL ) || ( ptab_insert( &nametab, h, np ) != 0 ) )
+            {
+                /* the arena space is simply not reused
+                 */
+                
+                pthread_mutex_unlock( &tablock ) ;
+                
+                return NULL ;
+            }
+            
+            break ;
+        }
+        
+        state = np->state ;
+        
+        if( state == NAME_BUSY )
+        {
+            pthread_cond_wait( &tabcond, &tablock ) ;
+            
+            continue ;
+        }
+        
+        if( state == NAME_STALE )
+        {
+            np->state = NAME_BUSY ;
+            
+            break ;
+        }
+        
+        /* nothing is released while we hold tablock
+         */
+        
+        if( state == NAME_READY )
+        {
+            __atomic_add_fetch( &( np->nfds ), 1, __ATOMIC_SEQ_CST ) ;
+        }
+        
+        pthread_mutex_unlock( &tablock ) ;
+        
+        return ( state == NAME_READY ) ? np : NULL ;
+    } ;
+    
+    /* We own a NAME_BUSY node
+     */
+    
+    pthread_mutex_unlock( &tablock ) ;
+    
+    state = ( make_temp_file( np->realpath, np ) == 0 ) ? NAME_READY : NAME_FAILED ;
     
-    int i = 0 ;
+    SJGF( "%s is %s", np->realpath, ( state == NAME_READY ) ? "ready" : "failed" ) ;
+    
+    pthread_mutex_lock( &tablock ) ;
     
-    for( i = 0 ; i < HTABSIZE ; i++ )
+    if( state == NAME_READY )
     {
-        LIST_WALK(  hashtab[i].namep,
-                    curr,
-                    np,
-
-                    /* delete the temp file
-                     */
-                    
-                    if( curr->tempfilename[0] != 0 )
-                    {
-                        dumpfile( curr->tempfilename ) ;
-                        
-                        retv = remove( curr->tempfilename ) ;
-                        
-                        SJGF( "remove( %s ) = %s", curr->tempfilename ,curr->realpath ) ;
-                    }
-                    
-                    /* malloc'd by the realpath() function
-                     */
-                    free( curr->realpath ) ;
-                    
-                    free( curr ) ;
-                 )
+        __atomic_add_fetch( &( np->nfds ), 1, __ATOMIC_SEQ_CST ) ;
     }
     
-    remove( maintempfilename ) ;
+    __atomic_store_n( &( np->state ), state, __ATOMIC_RELEASE ) ;
     
-    free( commandlist ) ;
+    pthread_cond_broadcast( &tabcond ) ;
     
-    memblock_freeall() ;
+    pthread_mutex_unlock( &tablock ) ;
     
-    OUTPUT_HASHTAB_HITS() ;
+    if( ( state == NAME_READY ) && use_prefetch )
+    {
+        prefetch_from( np ) ;
+    }
+    
+    return ( state == NAME_READY ) ? np : NULL ;
 }
 
+
 /**********************************************************************
  */
 
-/* These macros just make the code easier to manage
+/* Called by the prefetch workers, runs as though the compiler
+ * had opened path
  */
-
-#define cmp2(a,b)       ( ( fn[len-3] == (a) ) && ( fn[len-2] == (b) ) )
-
-#define cmp3(a,b,c)     ( ( fn[len-3] == (a) ) && ( fn[len-2] == (b) ) && ( fn[len-1] == (c) ) )
-
-
-static int is_source_file( const char *fn )
+static void prefetch_fetch( char *path )
 {
-    int retb = FALSE ;
-    
-    int len = 0 ;
+    name_t *np = NULL ;
     
-    len = strlen( fn ) ;
+    int len = strlen( path ) ;
     
-    if( len < 3 )
-        return FALSE ;
+    supress_redirection = TRUE ;
     
-    if(    ( fn[len-2] == '.' )
-        && (
-                ( fn[len-1] == 'c' )
-            ||  ( fn[len-1] == 'h' )
-            ||  ( fn[len-1] == 'm' )
-            ||  ( fn[len-1] == 'M' )
-            ||  ( fn[len-1] == 'C' )
-            ||  ( fn[len-1] == 'H' )
-           )
-       )
+    if( ( use_rules || ( strncmp( path, "/usr/", 5 ) != 0 ) ) && wraprules_source( path, len, use_rules ) )
     {
-        /* One of the standard single character extensions
-         * for C-like source files
-         *
-         *  .c
-         *  .h
-         *  .m
-         *  .M
-         *  .C
-         *  .H
-         */
-        
-        return TRUE ;
+        np = find_name( path ) ;
     }
     
-    if( len < 4 )
-        return FALSE ;
-    
-    if(    ( fn[len-3] == '.' )
-        && (
-                cmp2( 'm', 'm' )
-             || cmp2( 'c', 'c' )
-             || cmp2( 'h', 'h' )
-             || cmp2( 'h', 'p' )
-           )
-       )
+    if( ( np != NULL ) && ( np != &excluded_name ) )
     {
-        /* One of the standard two character extensions
-         * for C-like source files
-         *
-         *  .mm
-         *  ,cc
-         *  .hh
-         *  .hp
+        /* nothing has it open yet, keep it for the compiler
          */
         
-        return TRUE ;
-    }
-    
-    if( len < 5 )
-        return FALSE ;
-    
-    if(    ( fn[len-4] == '.' )
-        && (
-                cmp3( 'c', 'x', 'x' )
-             || cmp3( 'c', 'p', 'p' )
-             || cmp3( 'C', 'P', 'P' )
-             || cmp3( 'c', '+', '+' )
-             || cmp3( 'h', 'x', 'x' )
-             || cmp3( 'h', 'p', 'p' )
-             || cmp3( 'H', 'P', 'P' )
-             || cmp3( 'h', '+', '+' )
-             || cmp3( 't', 'c', 'c' )
-             || cmp3( 'i', 'n', 'c' )
-           )
-       )
-    {
-        /* One of the standard three character extensions
-         * for C-like source files
-         *
-         *  .cxx
-         *  .cpp
-         *  .CPP
-         *  .c++
-         *  .hxx
-         *  .hpp
-         *  .HPP
-         *  .h++
-         *  .tcc
-         *  .inc
-         *
-         * Note : ".inc" is used by some programmers for files which
-         * are included as pseudo-templates.
-         */
+        __atomic_store_n( &( np->prefetched ), TRUE, __ATOMIC_RELEASE ) ;
         
-        return TRUE ;
+        name_put( np ) ;
     }
-    
-    // SJGF( "%s NOT recognised as source file", fn ) ;
-    
-    return retb ;
 }
-    
+
 /**********************************************************************
  */
 
@@ -1010,11 +2153,15 @@ int open( const char *pathname, int flags, ... )
     
     const char *pathtoopen = pathname ;
     
+    char fdpath[32] ;
+    
     name_t *np = NULL ;
     
     int fd = -1 ;
     
     int len = 0 ;
+    
+    uint64_t t0 = 0 ;
 
     SJGF( "open( %s )", pathname ) ;
     
@@ -1056,148 +2203,100 @@ int open( const char *pathname, int flags, ... )
         goto invoke_original_open ;
     }
     
+    if( rules_wanted )
+    {
+        pthread_once( &rules_once, init_rules ) ;
+    }
+    
     /* Any source file in /usr is also not worth
-     * pursuing
+     * pursuing, unless the rules say otherwise
      */
     
-    if( strncmp( pathname, "/usr/", 5 ) == 0 )
+    if( ( ! use_rules ) && ( strncmp( pathname, "/usr/", 5 ) == 0 ) )
     {
         SJG() ;
         
         goto invoke_original_open ;
     }
     
-    // SJG() ;
-    
-    supress_redirection = TRUE ;
-    
     /* What type of file is it ?
+     *
+     * Nothing up to here allocates or makes a syscall.
      */
     
-    if( ! is_source_file( pathname ) )
-    {
-        // SJG() ;
+    len = strlen( pathname ) ;
     
-        goto stop_supression ;
+    if( ! wraprules_source( pathname, len, use_rules ) )
+    {
+        goto invoke_original_open ;
     }
     
-    /* process with cap
-     */
-    
-    // SJGF( "%s", pathname ) ;
-    
-    struct name_s *ns = NULL ;
-    
-    ns = (struct name_s *)malloc( sizeof( struct name_s ) ) ;
-    
-    if( ns == NULL )
-        goto stop_supression ;
-    
-    INIT_NAME( ns ) ;
+    supress_redirection = TRUE ;
     
-    ns->realpath = realpath( pathname, NULL ) ;
+    pthread_once( &redirection_once, init_redirection ) ;
     
-    if( ns->realpath == NULL )
+    if( ! __atomic_load_n( &redirection_enabled, __ATOMIC_ACQUIRE ) )
     {
-        free( ns ) ;
-    
         goto stop_supression ;
     }
     
-    len = strlen( ns->realpath ) ;
-    
-    uint32_t h ;
-    
-    h = djb_hash( ns->realpath ) ;
-    
-    SJGF( "hash = %x :: len = %d", h, len ) ;
-    
-    ns->hash = h ;
-    ns->realpathlen = len ;
+    if( use_trace )
+    {
+        t0 = wraptrace_now() ;
+    }
     
-    /* try and find the filename in the hash table
+    /* process with cap
      */
     
-    int k = ( h & HTABMOD ) ;
+    uint64_t h ;
     
-    name_t *np2 = NULL ;
+    h = path_hash( pathname, len ) ;
     
-    LIST_WALK(  hashtab[k].namep,
-                np,
-                np2,
-                
-                if( ( np->hash == h ) && ( np->realpathlen == len ) )
-                {
-                    if( memcmp( ns->realpath, np->realpath, len ) == 0 )
-                    {
-                        // SJG() ;
-                        
-                        INC_HASHTAB_HITS() ;
-                    
-                        break ;
-                    }
-                }
-             )
-
-    // SJG() ;
-    
-    /* need to add entry to list and create a new temp file
-     * which is the processed version of the source file
-     */
+    np = memo_find( pathname, len, h ) ;
     
     if( np == NULL )
     {
-        SJG() ;
-        
-        /* allocates using memblock_alloc()
-         */
-        ns->tempfilename = make_temp_file( ns->realpath ) ;
+        np = find_name( pathname ) ;
         
-        if( ( ns->tempfilename == NULL ) || ( (ns->tempfilename)[0] == 0 ) )
+        if( np == NULL )
         {
-            /* did not work so release that memory
-             */
-            
-            SJG() ;
-            
-            free( ns ) ;
-            
             goto stop_supression ;
         }
+        
+        memo_add( pathname, len, h, np ) ;
     }
-    else
+    else if( ( np != &excluded_name ) && ! name_get( np ) )
     {
-        // SJG() ;
-        
-        /* duplicate the tempfilename
+        /* its output was released since it was memoised so
+         * find_name() makes it again
          */
         
-        int tnlen = strlen( np->tempfilename ) ;
+        np = find_name( pathname ) ;
         
-        ns->tempfilename = memblock_alloc( tnlen+1 ) ;
-        
-        if( ns->tempfilename != NULL )
-        {
-            strcpy( ns->tempfilename, np->tempfilename ) ;
-        }
-        else
+        if( np == NULL )
         {
-            free( ns ) ;
-        
             goto stop_supression ;
         }
     }
     
-    /* Add new node to hashtable
-     */
-    
-    ns->next = hashtab[k].namep ;
-    
-    hashtab[k].namep = ns ;
-    
-    np = ns ;
+    if( np == &excluded_name )
+    {
+        np = NULL ;
+        
+        goto stop_supression ;
+    }
     
-    pathtoopen = np->tempfilename ;
+    if( np->memfd != -1 )
+    {
+        /* Opening the memfd, or cache entry, through /proc gives
+         * the caller its own file offset, which a plain dup()
+         * would not
+         */
+        
+        snprintf( fdpath, sizeof( fdpath ), "/proc/self/fd/%d", np->memfd ) ;
+        
+        pathtoopen = fdpath ;
+    }
     
     /* Now make our wrapping calls and create temp files
      * to deal with the request for that file.
@@ -1230,11 +2329,34 @@ invoke_original_open:
         fd = old_open( pathtoopen, flags ) ;
     }
     
+    if( ( fd == -1 ) && ( np != NULL ) && ( np->memfd != -1 ) )
+    {
+        /* no /proc so fall back on a duplicate of the memfd
+         */
+        
+        fd = fcntl( np->memfd, ( flags & O_CLOEXEC ) ? F_DUPFD_CLOEXEC : F_DUPFD, 0 ) ;
+        
+        if( fd != -1 )
+        {
+            lseek( fd, 0, SEEK_SET ) ;
+        }
+    }
+    
     SJGF( "Opened %s as %d", pathtoopen, fd ) ;
     
     if( np != NULL )
     {
-        np->fd = fd ;
+        if( fd != -1 )
+        {
+            fdname_set( fd, np ) ;
+        }
+        
+        name_put( np ) ;
+    }
+    
+    if( t0 != 0 )
+    {
+        wraptrace_span( WRAPTRACE_OPEN, pathname, NULL, t0, wraptrace_now() ) ;
     }
     
     return fd ;
@@ -1250,47 +2372,197 @@ int close( int fd )
     SAVE_REDIRECTION_STATE
     
     SJGF( "close( %d )", fd ) ;
+    
+    if( use_fsync && ( ( fcntl( fd, F_GETFL ) & O_ACCMODE ) != O_RDONLY ) )
+    {
+        fsync( fd ) ;
+    }
+    
+    fdname_clear( fd ) ;
+    
+    retv = old_close( fd ) ;
+    
+    RESTORE_REDIRECTION_STATE
+    
+    return retv ;
+}
+
+/**********************************************************************
+ */
+
+/* A duplicate of a descriptor on a processed file keeps the
+ * file's output alive just as the original does
+ */
 
-    fsync( fd ) ;
+int dup( int oldfd )
+{
+    int retv = -1 ;
     
-#ifdef FULL_CLOSE
-    int i = 0 ;
+    init_dup_fns() ;
     
-    name_t *np = NULL ;
-    name_t *np2 = NULL ;
+    retv = old_dup( oldfd ) ;
     
-    for( i = 0 ; i < HTABSIZE ; i++ )
+    if( retv != -1 )
     {
-        LIST_WALK( hashtab[i].namep,
-                    np,
-                    np2,
+        fdname_dup( oldfd, retv ) ;
+    }
     
-                    if( np->fd == fd )
-                    {
-                        break ;
-                    }
-                 )
+    return retv ;
+}
+
+
+int dup2( int oldfd, int newfd )
+{
+    int retv = -1 ;
+    
+    init_dup_fns() ;
+    
+    retv = old_dup2( oldfd, newfd ) ;
+    
+    if( ( retv != -1 ) && ( oldfd != newfd ) )
+    {
+        fdname_dup( oldfd, newfd ) ;
+    }
+    
+    return retv ;
+}
+
+
+int dup3( int oldfd, int newfd, int flags )
+{
+    int retv = -1 ;
+    
+    init_dup_fns() ;
+    
+    retv = old_dup3( oldfd, newfd, flags ) ;
+    
+    if( retv != -1 )
+    {
+        fdname_dup( oldfd, newfd ) ;
+    }
+    
+    return retv ;
+}
+
+
+/* Every fcntl() argument fits in a pointer, which is how the
+ * C library passes it on too
+ */
+
+int fcntl( int fd, int cmd, ... )
+{
+    int retv = -1 ;
+    
+    void *arg = NULL ;
+    
+    va_list ap ;
+    
+    va_start( ap, cmd ) ;
+    
+    arg = va_arg( ap, void * ) ;
+    
+    va_end( ap ) ;
+    
+    init_dup_fns() ;
+    
+    retv = old_fcntl( fd, cmd, arg ) ;
+    
+    if( ( retv != -1 ) && ( ( cmd == F_DUPFD ) || ( cmd == F_DUPFD_CLOEXEC ) ) )
+    {
+        fdname_dup( fd, retv ) ;
+    }
+    
+    return retv ;
+}
+
+
+int fcntl64( int fd, int cmd, ... )
+{
+    int retv = -1 ;
+    
+    void *arg = NULL ;
+    
+    va_list ap ;
+    
+    va_start( ap, cmd ) ;
+    
+    arg = va_arg( ap, void * ) ;
+    
+    va_end( ap ) ;
+    
+    init_dup_fns() ;
+    
+    retv = old_fcntl64( fd, cmd, arg ) ;
+    
+    if( ( retv != -1 ) && ( ( cmd == F_DUPFD ) || ( cmd == F_DUPFD_CLOEXEC ) ) )
+    {
+        fdname_dup( fd, retv ) ;
+    }
+    
+    return retv ;
+}
+
+
+
+
+/**********************************************************************
+ */
+
+/* chdir() and fchdir() are wrapped only to notice that relative
+ * pathnames may now refer to different files
+ */
+
+int chdir( const char *path )
+{
+    int retv = -1 ;
+    
+    if( old_chdir == NULL )
+    {
+        old_chdir = ( chdir_fn_t )dlsym( RTLD_NEXT, "chdir" ) ;
         
-        if( np != NULL )
+        if( old_chdir == NULL )
         {
-            break ;
+            return -1 ;
         }
     }
     
-    if( np != NULL )
+    retv = old_chdir( path ) ;
+    
+    if( retv == 0 )
+    {
+        __atomic_add_fetch( &cwd_generation, 1, __ATOMIC_RELEASE ) ;
+    }
+    
+    return retv ;
+}
+
+/**********************************************************************
+ */
+
+int fchdir( int fd )
+{
+    int retv = -1 ;
+    
+    if( old_fchdir == NULL )
     {
-        np->fd = -1 ;
+        old_fchdir = ( fchdir_fn_t )dlsym( RTLD_NEXT, "fchdir" ) ;
         
-        SJGF( "Closing %s", np->realpath ) ;
+        if( old_fchdir == NULL )
+        {
+            return -1 ;
+        }
     }
-#endif
     
-    retv = old_close( fd ) ;
+    retv = old_fchdir( fd ) ;
     
-    RESTORE_REDIRECTION_STATE
+    if( retv == 0 )
+    {
+        __atomic_add_fetch( &cwd_generation, 1, __ATOMIC_RELEASE ) ;
+    }
     
     return retv ;
 }
 
-
+/**********************************************************************
+ */
 
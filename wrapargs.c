@@ -0,0 +1,578 @@
+/*
+ * wrapargs.c
+ *
+ * Read a gcc or clang command line the way the driver will, to
+ * find out which inputs it is going to run the preprocessor on
+ * and what it stops after.
+ *
+ * @file arguments are replaced by the words in the file, with
+ * the same quoting as the driver uses, and -x is followed so an
+ * input's language is known even without a usual extension.
+ * Options which take their value as the next argument are
+ * listed so the value is not taken for an input.  An option we
+ * do not know about is assumed to be all in one argument.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapargs.h"
+
+
+/**********************************************************************
+ */
+
+/* Options given their value in the next argument
+ */
+static char *optargs[] = {
+    "-o",
+    "-x",
+    "-I",
+    "-D",
+    "-U",
+    "-A",
+    "-B",
+    "-L",
+    "-l",
+    "-T",
+    "-e",
+    "-u",
+    "-z",
+    "-include",
+    "-imacros",
+    "-isystem",
+    "-iquote",
+    "-idirafter",
+    "-iprefix",
+    "-iwithprefix",
+    "-iwithprefixbefore",
+    "-isysroot",
+    "--sysroot",
+    "-imultilib",
+    "-MF",
+    "-MT",
+    "-MQ",
+    "-Xlinker",
+    "-Xassembler",
+    "-Xpreprocessor",
+    "-aux-info",
+    "-dumpdir",
+    "-dumpbase",
+    "-dumpbase-ext",
+    "--param",
+    "-Xclang",
+    "-target",
+    "-arch",
+    "-mllvm",
+    "-ivfsoverlay",
+    "-MJ",
+    NULL
+    } ;
+
+
+/* Options which start with -o but are not -o<path>
+ */
+static char *notoutput[] = {
+    "-objcmt-",
+    "-object",
+    NULL
+    } ;
+
+
+/* -x languages which are not run through the preprocessor
+ */
+static char *unprocessed[] = {
+    "assembler",
+    "cpp-output",
+    "c-cpp-output",
+    "c++-cpp-output",
+    "objective-c-cpp-output",
+    "objective-c++-cpp-output",
+    "ir",
+    "lto",
+    NULL
+    } ;
+
+
+/* Extensions the driver runs the preprocessor on without -x,
+ * which is what wrap_open.so intercepts plus the assembler
+ * sources that are preprocessed
+ */
+static char *processed[] = {
+    "c",
+    "h",
+    "m",
+    "M",
+    "C",
+    "H",
+    "S",
+    "mm",
+    "cc",
+    "cp",
+    "hh",
+    "hp",
+    "sx",
+    "cxx",
+    "cpp",
+    "CPP",
+    "c++",
+    "hxx",
+    "hpp",
+    "HPP",
+    "h++",
+    "tcc",
+    NULL
+    } ;
+
+
+/**********************************************************************
+ */
+
+static int in_list( char **list, const char *s )
+{
+    for( ; *list != NULL ; list++ )
+    {
+        if( strcmp( *list, s ) == 0 )
+        {
+            return TRUE ;
+        }
+    }
+
+    return FALSE ;
+}
+
+
+/**********************************************************************
+ */
+
+static int prefix_in_list( char **list, const char *s )
+{
+    for( ; *list != NULL ; list++ )
+    {
+        if( strncmp( *list, s, strlen( *list ) ) == 0 )
+        {
+            return TRUE ;
+        }
+    }
+
+    return FALSE ;
+}
+
+
+/**********************************************************************
+ */
+
+static int add_arg( wrapargs_t *wa, char *arg )
+{
+    char **argv = NULL ;
+
+    if( ( wa->argc % 64 ) == 0 )
+    {
+        argv = (char **)realloc( wa->argv, ( wa->argc + 65 ) * sizeof( char * ) ) ;
+
+        if( argv == NULL )
+        {
+            return -1 ;
+        }
+
+        wa->argv = argv ;
+    }
+
+    wa->argv[ wa->argc++ ] = arg ;
+
+    wa->argv[ wa->argc ] = NULL ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* returns the contents of path nul terminated, or NULL
+ */
+static char *read_file( char *path )
+{
+    struct stat st ;
+
+    char *buf = NULL ;
+
+    ssize_t n = 0 ;
+    size_t got = 0 ;
+
+    int fd = open( path, O_RDONLY | O_CLOEXEC ) ;
+
+    if( fd == -1 )
+    {
+        return NULL ;
+    }
+
+    if( ( fstat( fd, &st ) != 0 ) || ! S_ISREG( st.st_mode ) )
+    {
+        goto err_exit ;
+    }
+
+    buf = (char *)malloc( st.st_size + 1 ) ;
+
+    if( buf == NULL )
+    {
+        goto err_exit ;
+    }
+
+    while( got < (size_t)st.st_size )
+    {
+        n = read( fd, buf + got, st.st_size - got ) ;
+
+        if( n <= 0 )
+        {
+            break ;
+        }
+
+        got += n ;
+    } ;
+
+    buf[got] = 0 ;
+
+err_exit:
+
+    close( fd ) ;
+
+    return buf ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Split a response file into words in place, as libiberty's
+ * buildargv() does : white space separates words, quotes of
+ * either kind group them and a backslash takes the next
+ * character as it is.
+ *
+ * returns the number of words, each one nul terminated one
+ * after the other from the start of buf
+ */
+static int split_words( char *buf )
+{
+    char *in = buf ;
+    char *out = buf ;
+
+    int squote = FALSE ;
+    int dquote = FALSE ;
+    int inword = FALSE ;
+
+    int n = 0 ;
+
+    for( ; *in != 0 ; in++ )
+    {
+        if( ( *in == '\\' ) && ( in[1] != 0 ) )
+        {
+            *out++ = *++in ;
+
+            inword = TRUE ;
+        }
+        else if( squote )
+        {
+            if( *in == '\'' )
+                squote = FALSE ;
+            else
+                *out++ = *in ;
+        }
+        else if( dquote )
+        {
+            if( *in == '"' )
+                dquote = FALSE ;
+            else
+                *out++ = *in ;
+        }
+        else if( ( *in == ' ' ) || ( *in == '\t' ) || ( *in == '\n' ) || ( *in == '\r' ) || ( *in == '\f' ) || ( *in == '\v' ) )
+        {
+            if( inword )
+            {
+                *out++ = 0 ;
+
+                n++ ;
+
+                inword = FALSE ;
+            }
+        }
+        else
+        {
+            if( *in == '\'' )
+                squote = TRUE ;
+            else if( *in == '"' )
+                dquote = TRUE ;
+            else
+                *out++ = *in ;
+
+            inword = TRUE ;
+        }
+    }
+
+    if( inword )
+    {
+        *out++ = 0 ;
+
+        n++ ;
+    }
+
+    return n ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Append argv to wa->argv replacing @files with their words.
+ * An @file which cannot be read is left as it is, the driver
+ * does the same.
+ */
+static int expand( wrapargs_t *wa, int argc, char **argv, int depth )
+{
+    char **bufs = NULL ;
+    char **words = NULL ;
+
+    char *buf = NULL ;
+    char *p = NULL ;
+
+    int retv = 0 ;
+    int n = 0 ;
+    int i = 0 ;
+    int j = 0 ;
+
+    for( i = 0 ; i < argc ; i++ )
+    {
+        if( ( argv[i][0] != '@' ) || ( depth >= WRAPARGS_MAXDEPTH ) || ( ( buf = read_file( argv[i]+1 ) ) == NULL ) )
+        {
+            if( add_arg( wa, argv[i] ) != 0 )
+            {
+                return -1 ;
+            }
+
+            continue ;
+        }
+
+        SJGF( "expanding %s", argv[i] ) ;
+
+        bufs = (char **)realloc( wa->bufs, ( wa->nbufs+1 ) * sizeof( char * ) ) ;
+
+        if( bufs == NULL )
+        {
+            free( buf ) ;
+
+            return -1 ;
+        }
+
+        wa->bufs = bufs ;
+
+        wa->bufs[ wa->nbufs++ ] = buf ;
+
+        n = split_words( buf ) ;
+
+        words = (char **)malloc( ( n+1 ) * sizeof( char * ) ) ;
+
+        if( words == NULL )
+        {
+            return -1 ;
+        }
+
+        for( j = 0, p = buf ; j < n ; j++ )
+        {
+            words[j] = p ;
+
+            p += strlen( p ) + 1 ;
+        }
+
+        words[n] = NULL ;
+
+        retv = expand( wa, n, words, depth+1 ) ;
+
+        free( words ) ;
+
+        if( retv != 0 )
+        {
+            return -1 ;
+        }
+    }
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Does the driver run the preprocessor on name, going by its
+ * extension
+ */
+static int ext_processed( const char *name )
+{
+    const char *ext = strrchr( name, '.' ) ;
+
+    if( ( ext == NULL ) || ( strchr( ext, '/' ) != NULL ) )
+    {
+        return FALSE ;
+    }
+
+    return in_list( processed, ext+1 ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Parse the arguments the compiler is given, argv[0] being
+ * the first of them rather than the compiler's name
+ *
+ * returns 0 or -1 if out of memory
+ */
+int wrapargs_parse( wrapargs_t *wa, int argc, char **argv )
+{
+    char *lang = NULL ;
+    char *a = NULL ;
+
+    int kind = WRAPARGS_OPTION ;
+
+    int i = 0 ;
+
+    memset( wa, 0, sizeof( wrapargs_t ) ) ;
+
+    wa->output = -1 ;
+
+    if( ( expand( wa, argc, argv, 0 ) != 0 ) || ( add_arg( wa, NULL ) != 0 ) )
+    {
+        goto err_exit ;
+    }
+
+    /* the NULL was only to get argv allocated
+     */
+
+    wa->argc-- ;
+
+    wa->kinds = (char *)malloc( wa->argc + 1 ) ;
+
+    if( wa->kinds == NULL )
+    {
+        goto err_exit ;
+    }
+
+    for( i = 0 ; i < wa->argc ; i++ )
+    {
+        a = wa->argv[i] ;
+
+        if( ( a[0] != '-' ) || ( a[1] == 0 ) )
+        {
+            /* an input, "-" being stdin
+             */
+
+            if( lang != NULL )
+            {
+                kind = in_list( unprocessed, lang ) ? WRAPARGS_INPUT : WRAPARGS_SOURCE ;
+            }
+            else
+            {
+                kind = ext_processed( a ) ? WRAPARGS_SOURCE : WRAPARGS_INPUT ;
+            }
+
+            wa->kinds[i] = kind ;
+
+            wa->ninputs++ ;
+
+            if( kind == WRAPARGS_SOURCE )
+            {
+                wa->nsources++ ;
+            }
+
+            continue ;
+        }
+
+        wa->kinds[i] = WRAPARGS_OPTION ;
+
+        if( ( strcmp( a, "-c" ) == 0 ) && ( wa->mode < WRAPARGS_COMPILE ) )
+        {
+            wa->mode = WRAPARGS_COMPILE ;
+        }
+        else if( ( strcmp( a, "-S" ) == 0 ) && ( wa->mode < WRAPARGS_ASSEMBLE ) )
+        {
+            wa->mode = WRAPARGS_ASSEMBLE ;
+        }
+        else if( ( strcmp( a, "-E" ) == 0 ) || ( strcmp( a, "-M" ) == 0 ) || ( strcmp( a, "-MM" ) == 0 ) )
+        {
+            wa->mode = WRAPARGS_PREPROCESS ;
+        }
+        else if( ( strncmp( a, "-o", 2 ) == 0 ) && ! prefix_in_list( notoutput, a ) )
+        {
+            wa->output = i ;
+
+            wa->outname = ( a[2] != 0 ) ? a+2 : wa->argv[i+1] ;
+        }
+        else if( strncmp( a, "-x", 2 ) == 0 )
+        {
+            lang = ( a[2] != 0 ) ? a+2 : wa->argv[i+1] ;
+
+            if( ( lang != NULL ) && ( strcmp( lang, "none" ) == 0 ) )
+            {
+                lang = NULL ;
+            }
+        }
+
+        if( in_list( optargs, a ) && ( i+1 < wa->argc ) )
+        {
+            wa->kinds[++i] = WRAPARGS_OPTARG ;
+        }
+    }
+
+    SJGF( "%d inputs, %d sources, mode %d", wa->ninputs, wa->nsources, wa->mode ) ;
+
+    return 0 ;
+
+err_exit:
+
+    wrapargs_free( wa ) ;
+
+    return -1 ;
+}
+
+
+/**********************************************************************
+ */
+
+void wrapargs_free( wrapargs_t *wa )
+{
+    int i = 0 ;
+
+    for( i = 0 ; i < wa->nbufs ; i++ )
+    {
+        free( wa->bufs[i] ) ;
+    }
+
+    free( wa->bufs ) ;
+
+    free( wa->argv ) ;
+
+    free( wa->kinds ) ;
+
+    memset( wa, 0, sizeof( wrapargs_t ) ) ;
+
+    wa->output = -1 ;
+}
+
+
+/**********************************************************************
+ */
+
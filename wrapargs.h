@@ -0,0 +1,68 @@
+
+/*
+ * Include file wrapargs.h
+ *
+ * $Id$
+ *
+ * Works out from a compiler command line what the compiler is
+ * going to do with each of its inputs.
+ */
+
+
+#ifndef __WRAPARGS_H
+#  define __WRAPARGS_H
+
+/**********************************************************************
+ */
+
+/* what the compiler stops after, the last of -c, -S and -E
+ * given wins in that order
+ */
+#define WRAPARGS_LINK           0
+#define WRAPARGS_COMPILE        1
+#define WRAPARGS_ASSEMBLE       2
+#define WRAPARGS_PREPROCESS     3
+
+/* what each argument is
+ */
+#define WRAPARGS_OPTION         0
+#define WRAPARGS_OPTARG         1
+#define WRAPARGS_INPUT          2
+#define WRAPARGS_SOURCE         3
+
+/* how deep response files may include each other
+ */
+#define WRAPARGS_MAXDEPTH       16
+
+
+/**********************************************************************
+ */
+
+struct wrapargs_s ;
+
+struct wrapargs_s {
+    int          argc ;
+    char       **argv ;         /* with any @files expanded */
+    char        *kinds ;        /* WRAPARGS_OPTION etc. for each of argv */
+    int          mode ;
+    int          output ;       /* argv index of the -o option or -1 */
+    char        *outname ;
+    int          ninputs ;
+    int          nsources ;     /* inputs that go through the preprocessor */
+    char       **bufs ;         /* response file contents */
+    int          nbufs ;
+    } ;
+
+typedef struct wrapargs_s wrapargs_t ;
+
+
+/**********************************************************************
+ */
+
+extern int  wrapargs_parse( wrapargs_t *wa, int argc, char **argv ) ;
+
+extern void wrapargs_free( wrapargs_t *wa ) ;
+
+
+#endif /* __WRAPARGS_H */
+
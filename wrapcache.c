@@ -0,0 +1,933 @@
+
+/*
+ * wrapcache.c
+ *
+ * A persistent, content addressed cache of processed source
+ * files.
+ *
+ * Entries are keyed by a hash of the source contents, the
+ * command chain string and the identity of the command binaries
+ * so the same header processed by the same chain is only ever
+ * processed once, no matter how many compilers or builds ask
+ * for it.
+ *
+ * New entries are written to a private temp file in the cache
+ * and then published with rename(), which is atomic, so any
+ * number of concurrent compilers can share the cache safely.
+ *
+ * The cache is kept below a size cap by evicting the least
+ * recently used entries.  Lookups refresh an entry's mtime so
+ * the mtime doubles as the LRU timestamp.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/sendfile.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapchain.h"
+
+#include "wrapcache.h"
+
+
+/**********************************************************************
+ */
+
+/* Default size cap for the cache in bytes
+ */
+#define WRAPCACHE_DEFAULT_MAX       ( UINT64_C(256) << 20 )
+
+/* Trimming needs a scan of the whole cache so we only let it
+ * happen this often ( in seconds ).
+ */
+#define WRAPCACHE_TRIM_INTERVAL     60
+
+/* Lookups only refresh the LRU timestamp of an entry when it
+ * is older than this, to save a write on every hit.
+ */
+#define WRAPCACHE_TOUCH_INTERVAL    3600
+
+/* Temp files older than this are left over from a crashed
+ * process and can be removed when trimming.
+ */
+#define WRAPCACHE_STALE_TEMP        3600
+
+
+static char cachedir[PATH_MAX] ;
+
+static int cachedirlen = 0 ;
+
+static int cache_enabled = FALSE ;
+
+static uint64_t cache_max = WRAPCACHE_DEFAULT_MAX ;
+
+/* hash of the command chain and the identity of its binaries
+ */
+static uint64_t chainhash[2] = { 0, 0 } ;
+
+static unsigned int tempcounter = 0 ;
+
+
+/**********************************************************************
+ */
+
+/* MurmurHash3 x64 128-bit, by Austin Appleby ( public domain )
+ */
+
+#define ROTL64(x,r)     ( ( (x) << (r) ) | ( (x) >> ( 64 - (r) ) ) )
+
+static uint64_t fmix64( uint64_t k )
+{
+    k ^= k >> 33 ;
+    k *= UINT64_C(0xff51afd7ed558ccd) ;
+    k ^= k >> 33 ;
+    k *= UINT64_C(0xc4ceb9fe1a85ec53) ;
+    k ^= k >> 33 ;
+
+    return k ;
+}
+
+
+static void murmur3_128( const void *key, size_t len, uint32_t seed, uint64_t *out )
+{
+    const uint8_t *data = (const uint8_t *)key ;
+
+    const size_t nblocks = len / 16 ;
+
+    uint64_t h1 = seed ;
+    uint64_t h2 = seed ;
+
+    const uint64_t c1 = UINT64_C(0x87c37b91114253d5) ;
+    const uint64_t c2 = UINT64_C(0x4cf5ad432745937f) ;
+
+    uint64_t k1 = 0 ;
+    uint64_t k2 = 0 ;
+
+    size_t i = 0 ;
+
+    for( i = 0 ; i < nblocks ; i++ )
+    {
+        memcpy( &k1, data + i*16, 8 ) ;
+        memcpy( &k2, data + i*16 + 8, 8 ) ;
+
+        k1 *= c1 ; k1 = ROTL64( k1, 31 ) ; k1 *= c2 ; h1 ^= k1 ;
+
+        h1 = ROTL64( h1, 27 ) ; h1 += h2 ; h1 = h1*5 + 0x52dce729 ;
+
+        k2 *= c2 ; k2 = ROTL64( k2, 33 ) ; k2 *= c1 ; h2 ^= k2 ;
+
+        h2 = ROTL64( h2, 31 ) ; h2 += h1 ; h2 = h2*5 + 0x38495ab5 ;
+    }
+
+    const uint8_t *tail = data + nblocks*16 ;
+
+    k1 = 0 ;
+    k2 = 0 ;
+
+    switch( len & 15 )
+    {
+        case 15: k2 ^= ( (uint64_t)tail[14] ) << 48 ;   /* fallthrough */
+        case 14: k2 ^= ( (uint64_t)tail[13] ) << 40 ;   /* fallthrough */
+        case 13: k2 ^= ( (uint64_t)tail[12] ) << 32 ;   /* fallthrough */
+        case 12: k2 ^= ( (uint64_t)tail[11] ) << 24 ;   /* fallthrough */
+        case 11: k2 ^= ( (uint64_t)tail[10] ) << 16 ;   /* fallthrough */
+        case 10: k2 ^= ( (uint64_t)tail[ 9] ) << 8 ;    /* fallthrough */
+        case  9: k2 ^= ( (uint64_t)tail[ 8] ) << 0 ;
+                 k2 *= c2 ; k2 = ROTL64( k2, 33 ) ; k2 *= c1 ; h2 ^= k2 ;
+                 /* fallthrough */
+
+        case  8: k1 ^= ( (uint64_t)tail[ 7] ) << 56 ;   /* fallthrough */
+        case  7: k1 ^= ( (uint64_t)tail[ 6] ) << 48 ;   /* fallthrough */
+        case  6: k1 ^= ( (uint64_t)tail[ 5] ) << 40 ;   /* fallthrough */
+        case  5: k1 ^= ( (uint64_t)tail[ 4] ) << 32 ;   /* fallthrough */
+        case  4: k1 ^= ( (uint64_t)tail[ 3] ) << 24 ;   /* fallthrough */
+        case  3: k1 ^= ( (uint64_t)tail[ 2] ) << 16 ;   /* fallthrough */
+        case  2: k1 ^= ( (uint64_t)tail[ 1] ) << 8 ;    /* fallthrough */
+        case  1: k1 ^= ( (uint64_t)tail[ 0] ) << 0 ;
+                 k1 *= c1 ; k1 = ROTL64( k1, 31 ) ; k1 *= c2 ; h1 ^= k1 ;
+    } ;
+
+    h1 ^= (uint64_t)len ;
+    h2 ^= (uint64_t)len ;
+
+    h1 += h2 ;
+    h2 += h1 ;
+
+    h1 = fmix64( h1 ) ;
+    h2 = fmix64( h2 ) ;
+
+    h1 += h2 ;
+    h2 += h1 ;
+
+    out[0] = h1 ;
+    out[1] = h2 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Fold another chunk of data into a running 128-bit hash
+ */
+static void fold_hash( uint64_t *acc, const void *data, size_t len )
+{
+    uint64_t h[2] ;
+
+    murmur3_128( data, len, (uint32_t)( acc[0] ^ acc[1] ), h ) ;
+
+    acc[0] = ROTL64( acc[0], 23 ) ^ h[0] ;
+    acc[1] = ROTL64( acc[1], 41 ) ^ h[1] ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Parse a size with an optional K, M or G suffix
+ *
+ * returns 0 if p is not a size, or is too big
+ */
+static uint64_t parse_size( char *p )
+{
+    char *end = NULL ;
+
+    uint64_t sz = 0 ;
+
+    int shift = 0 ;
+
+    if( ( *p < '0' ) || ( *p > '9' ) )
+    {
+        return 0 ;
+    }
+
+    errno = 0 ;
+
+    sz = strtoull( p, &end, 10 ) ;
+
+    if( errno != 0 )
+    {
+        return 0 ;
+    }
+
+    switch( *end )
+    {
+        case 'k':
+        case 'K':
+            shift = 10 ;
+            end++ ;
+            break ;
+
+        case 'm':
+        case 'M':
+            shift = 20 ;
+            end++ ;
+            break ;
+
+        case 'g':
+        case 'G':
+            shift = 30 ;
+            end++ ;
+            break ;
+    } ;
+
+    if( ( *end != 0 ) || ( sz > ( UINT64_MAX >> shift ) ) )
+    {
+        return 0 ;
+    }
+
+    return sz << shift ;
+}
+
+
+/**********************************************************************
+ */
+
+/* mkdir -p
+ */
+static int make_dirs( char *path )
+{
+    char *p = path ;
+
+    int retv = 0 ;
+
+    while( TRUE )
+    {
+        p = strchr( p+1, '/' ) ;
+
+        if( p != NULL )
+        {
+            *p = 0 ;
+        }
+
+        retv = mkdir( path, 0755 ) ;
+
+        if( p == NULL )
+        {
+            break ;
+        }
+
+        *p = '/' ;
+    } ;
+
+    if( ( retv != 0 ) && ( errno != EEXIST ) )
+    {
+        return -1 ;
+    }
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Hash the identity of one stage of the chain into the chain
+ * hash
+ *
+ * A rebuilt or reinstalled preprocessor changes every key.
+ */
+static void hash_stage_identity( wrapchain_stage_t *st )
+{
+    struct stat st_bin ;
+
+    /* the whole command string, arguments included
+     */
+
+    fold_hash( chainhash, st->command, strlen( st->command ) + 1 ) ;
+
+    /* now the binary itself
+     */
+
+    if( stat( st->path, &st_bin ) == 0 )
+    {
+        uint64_t id[4] ;
+
+        id[0] = (uint64_t)st_bin.st_ino ;
+        id[1] = (uint64_t)st_bin.st_size ;
+        id[2] = (uint64_t)st_bin.st_mtim.tv_sec ;
+        id[3] = (uint64_t)st_bin.st_mtim.tv_nsec ;
+
+        fold_hash( chainhash, id, sizeof( id ) ) ;
+    }
+}
+
+
+/**********************************************************************
+ */
+
+/* returns 0 if the cache is usable
+ */
+int wrapcache_init( wrapchain_t *chain )
+{
+    char *p = NULL ;
+
+    int i = 0 ;
+
+    cache_enabled = FALSE ;
+
+    if( chain == NULL )
+    {
+        return -1 ;
+    }
+
+    p = getenv( "WRAP_OPEN_CACHE" ) ;
+
+    if( ( p != NULL ) && ( strcmp( p, "0" ) == 0 ) )
+    {
+        return -1 ;
+    }
+
+    /* where is the cache ?
+     */
+
+    p = getenv( "WRAP_OPEN_CACHE_DIR" ) ;
+
+    if( ( p != NULL ) && ( *p != 0 ) )
+    {
+        snprintf( cachedir, PATH_MAX, "%s", p ) ;
+    }
+    else if( ( ( p = getenv( "XDG_CACHE_HOME" ) ) != NULL ) && ( *p != 0 ) )
+    {
+        snprintf( cachedir, PATH_MAX, "%s/gccwrap", p ) ;
+    }
+    else if( ( ( p = getenv( "HOME" ) ) != NULL ) && ( *p != 0 ) )
+    {
+        snprintf( cachedir, PATH_MAX, "%s/.cache/gccwrap", p ) ;
+    }
+    else
+    {
+        return -1 ;
+    }
+
+    cachedirlen = strlen( cachedir ) ;
+
+    /* leave room for "/xx/<hex>" and a temp name suffix
+     */
+
+    if( cachedirlen > PATH_MAX - 64 )
+    {
+        return -1 ;
+    }
+
+    if( make_dirs( cachedir ) != 0 )
+    {
+        SJGF( "Cannot create cache dir %s", cachedir ) ;
+
+        return -1 ;
+    }
+
+    p = getenv( "WRAP_OPEN_CACHE_MAX" ) ;
+
+    if( ( p != NULL ) && ( *p != 0 ) )
+    {
+        /* a cap of 0 would trim everything, so it is as bad as
+         * a value which is not a size at all
+         */
+
+        uint64_t sz = parse_size( p ) ;
+
+        if( sz == 0 )
+        {
+            errorf( "WRAP_OPEN_CACHE_MAX=%s is not a size, using the default\n", p ) ;
+        }
+        else
+        {
+            cache_max = sz ;
+        }
+    }
+
+    /* hash the command chain
+     */
+
+    chainhash[0] = 0 ;
+    chainhash[1] = 0 ;
+
+    for( i = 0 ; i < chain->nstages ; i++ )
+    {
+        hash_stage_identity( chain->stages + i ) ;
+    }
+
+    cache_enabled = TRUE ;
+
+    SJGF( "cache = %s", cachedir ) ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+int wrapcache_enabled()
+{
+    return cache_enabled ;
+}
+
+
+/**********************************************************************
+ */
+
+/* size of buffer needed for an entry path including the nul
+ */
+int wrapcache_pathlen()
+{
+    return cachedirlen + 4 + WRAPCACHE_HEXLEN ;
+}
+
+
+/**********************************************************************
+ */
+
+/* returns 0 and fills in key if the source could be hashed
+ */
+int wrapcache_key( char *source, wrapcache_key_t *key )
+{
+    int fd = -1 ;
+
+    struct stat st ;
+
+    uint64_t h[4] ;
+
+    void *map = NULL ;
+
+    if( ! cache_enabled )
+    {
+        return -1 ;
+    }
+
+    fd = open( source, O_RDONLY ) ;
+
+    if( fd == -1 )
+    {
+        return -1 ;
+    }
+
+    if( fstat( fd, &st ) != 0 )
+    {
+        close( fd ) ;
+
+        return -1 ;
+    }
+
+    if( st.st_size > 0 )
+    {
+        map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) ;
+
+        if( map == MAP_FAILED )
+        {
+            close( fd ) ;
+
+            return -1 ;
+        }
+
+        murmur3_128( map, st.st_size, 0, h ) ;
+
+        munmap( map, st.st_size ) ;
+    }
+    else
+    {
+        murmur3_128( "", 0, 0, h ) ;
+    }
+
+    close( fd ) ;
+
+    h[2] = chainhash[0] ;
+    h[3] = chainhash[1] ;
+
+    murmur3_128( h, sizeof( h ), 0, key->h ) ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* returns 0 if the whole path fitted in len chars
+ */
+static int entry_path( wrapcache_key_t *key, char *path, int len )
+{
+    char hex[WRAPCACHE_HEXLEN+1] ;
+
+    int n = 0 ;
+
+    snprintf( hex, sizeof( hex ), "%016" PRIx64 "%016" PRIx64, key->h[0], key->h[1] ) ;
+
+    n = snprintf( path, len, "%s/%.2s/%s", cachedir, hex, hex+2 ) ;
+
+    return ( ( n < 0 ) || ( n >= len ) ) ? -1 : 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* path must have room for wrapcache_pathlen() chars
+ *
+ * returns 0 on a hit with path naming the processed file
+ */
+int wrapcache_lookup( wrapcache_key_t *key, char *path )
+{
+    struct stat st ;
+
+    if( ! cache_enabled )
+    {
+        return -1 ;
+    }
+
+    if( entry_path( key, path, wrapcache_pathlen() ) != 0 )
+    {
+        return -1 ;
+    }
+
+    if( ( stat( path, &st ) != 0 ) || ! S_ISREG( st.st_mode ) )
+    {
+        SJGF( "cache miss %s", path ) ;
+
+        return -1 ;
+    }
+
+    if( time( NULL ) - st.st_mtime > WRAPCACHE_TOUCH_INTERVAL )
+    {
+        /* refresh the LRU timestamp
+         */
+
+        utimensat( AT_FDCWD, path, NULL, 0 ) ;
+    }
+
+    SJGF( "cache hit %s", path ) ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* copy all of src from the start without moving its offset
+ */
+static int copy_fd( int dest, int src )
+{
+    char buffer[16384] ;
+
+    off_t off = 0 ;
+
+    ssize_t n = 0 ;
+
+    /* sendfile() will do this in the kernel on any
+     * Linux since 2.6.33 but not every file system
+     * supports it.
+     */
+
+    do
+    {
+        n = sendfile( dest, src, &off, 1 << 30 ) ;
+    }
+    while( n > 0 ) ;
+
+    if( n == 0 )
+    {
+        return 0 ;
+    }
+
+    if( ( errno != EINVAL ) && ( errno != ENOSYS ) )
+    {
+        return -1 ;
+    }
+
+    while( ( n = pread( src, buffer, sizeof( buffer ), off ) ) > 0 )
+    {
+        if( write( dest, buffer, n ) != n )
+        {
+            return -1 ;
+        }
+
+        off += n ;
+    } ;
+
+    return ( n == 0 ) ? 0 : -1 ;
+}
+
+
+/**********************************************************************
+ */
+
+struct trimentry_s ;
+
+struct trimentry_s {
+    time_t          mtime ;
+    uint64_t        size ;
+    int             subdir ;
+    char            name[WRAPCACHE_HEXLEN] ;
+    } ;
+
+typedef struct trimentry_s trimentry_t ;
+
+
+static int cmp_trimentry( const void *a, const void *b )
+{
+    const trimentry_t *ta = (const trimentry_t *)a ;
+    const trimentry_t *tb = (const trimentry_t *)b ;
+
+    if( ta->mtime < tb->mtime )
+        return -1 ;
+
+    if( ta->mtime > tb->mtime )
+        return 1 ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Evict least recently used entries until the cache is back
+ * under 90% of the size cap.
+ */
+static void trim_cache()
+{
+    char path[PATH_MAX] ;
+
+    struct stat st ;
+
+    time_t now = time( NULL ) ;
+
+    /* only one trim every WRAPCACHE_TRIM_INTERVAL seconds
+     */
+
+    if( snprintf( path, PATH_MAX, "%s/.trimstamp", cachedir ) >= PATH_MAX )
+    {
+        return ;
+    }
+
+    if( ( stat( path, &st ) == 0 ) && ( now - st.st_mtime < WRAPCACHE_TRIM_INTERVAL ) )
+    {
+        return ;
+    }
+
+    /* and only one process trimming at a time
+     */
+
+    if( snprintf( path, PATH_MAX, "%s/.lock", cachedir ) >= PATH_MAX )
+    {
+        return ;
+    }
+
+    int lockfd = open( path, O_RDWR | O_CREAT | O_CLOEXEC, 0644 ) ;
+
+    if( lockfd == -1 )
+    {
+        return ;
+    }
+
+    if( flock( lockfd, LOCK_EX | LOCK_NB ) != 0 )
+    {
+        close( lockfd ) ;
+
+        return ;
+    }
+
+    int fd = -1 ;
+
+    if( snprintf( path, PATH_MAX, "%s/.trimstamp", cachedir ) < PATH_MAX )
+    {
+        fd = open( path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644 ) ;
+    }
+
+    if( fd != -1 )
+    {
+        futimens( fd, NULL ) ;
+
+        close( fd ) ;
+    }
+
+    /* gather every entry
+     */
+
+    trimentry_t *entries = NULL ;
+
+    size_t nentries = 0 ;
+    size_t maxentries = 0 ;
+
+    uint64_t total = 0 ;
+
+    int i = 0 ;
+
+    for( i = 0 ; i < 256 ; i++ )
+    {
+        if( snprintf( path, PATH_MAX, "%s/%02x", cachedir, i ) >= PATH_MAX )
+        {
+            break ;
+        }
+
+        DIR *dir = opendir( path ) ;
+
+        if( dir == NULL )
+        {
+            continue ;
+        }
+
+        struct dirent *de = NULL ;
+
+        while( ( de = readdir( dir ) ) != NULL )
+        {
+            if( de->d_name[0] == '.' )
+            {
+                /* remove temp files left by crashed processes
+                 */
+
+                if( strncmp( de->d_name, ".tmp.", 5 ) == 0 )
+                {
+                    if(    ( fstatat( dirfd( dir ), de->d_name, &st, 0 ) == 0 )
+                        && ( now - st.st_mtime > WRAPCACHE_STALE_TEMP )
+                      )
+                    {
+                        unlinkat( dirfd( dir ), de->d_name, 0 ) ;
+                    }
+                }
+
+                continue ;
+            }
+
+            if( strlen( de->d_name ) != WRAPCACHE_HEXLEN-2 )
+            {
+                continue ;
+            }
+
+            if( fstatat( dirfd( dir ), de->d_name, &st, 0 ) != 0 )
+            {
+                continue ;
+            }
+
+            if( nentries == maxentries )
+            {
+                maxentries = ( maxentries == 0 ) ? 1024 : 2*maxentries ;
+
+                trimentry_t *te = (trimentry_t *)realloc( entries, maxentries * sizeof( trimentry_t ) ) ;
+
+                if( te == NULL )
+                {
+                    break ;
+                }
+
+                entries = te ;
+            }
+
+            entries[nentries].mtime = st.st_mtime ;
+            entries[nentries].size = (uint64_t)st.st_size ;
+            entries[nentries].subdir = i ;
+
+            memcpy( entries[nentries].name, de->d_name, WRAPCACHE_HEXLEN-1 ) ;
+
+            total += (uint64_t)st.st_size ;
+
+            nentries++ ;
+        } ;
+
+        closedir( dir ) ;
+    }
+
+    SJGF( "cache holds %zu entries, %" PRIu64 " bytes", nentries, total ) ;
+
+    if( total > cache_max )
+    {
+        uint64_t target = cache_max - cache_max / 10 ;
+
+        size_t k = 0 ;
+
+        qsort( entries, nentries, sizeof( trimentry_t ), cmp_trimentry ) ;
+
+        while( ( k < nentries ) && ( total > target ) )
+        {
+            if(    ( snprintf( path, PATH_MAX, "%s/%02x/%s", cachedir, entries[k].subdir, entries[k].name ) < PATH_MAX )
+                && ( unlink( path ) == 0 )
+              )
+            {
+                total -= entries[k].size ;
+            }
+
+            k++ ;
+        } ;
+
+        SJGF( "evicted %zu entries", k ) ;
+    }
+
+    free( entries ) ;
+
+    close( lockfd ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Copy a processed file, open for reading as fd, into the
+ * cache under key
+ *
+ * returns 0 if the entry is now in the cache
+ */
+int wrapcache_store( wrapcache_key_t *key, int fd )
+{
+    char path[PATH_MAX] ;
+    char temp[PATH_MAX] ;
+
+    int retv = -1 ;
+
+    int dest = -1 ;
+
+    if( ! cache_enabled )
+    {
+        return -1 ;
+    }
+
+    if( entry_path( key, path, PATH_MAX ) != 0 )
+    {
+        return -1 ;
+    }
+
+    if( access( path, F_OK ) == 0 )
+    {
+        /* someone else got there first
+         */
+
+        return 0 ;
+    }
+
+    /* make sure the sub-directory exists
+     */
+
+    path[cachedirlen+3] = 0 ;
+
+    if( ( mkdir( path, 0755 ) != 0 ) && ( errno != EEXIST ) )
+    {
+        return -1 ;
+    }
+
+    path[cachedirlen+3] = '/' ;
+
+    if( snprintf( temp, PATH_MAX, "%.*s/.tmp.%d.%u", cachedirlen+3, path, (int)getpid(), __atomic_fetch_add( &tempcounter, 1, __ATOMIC_RELAXED ) ) >= PATH_MAX )
+    {
+        return -1 ;
+    }
+
+    dest = open( temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644 ) ;
+
+    if( dest == -1 )
+    {
+        return -1 ;
+    }
+
+    retv = copy_fd( dest, fd ) ;
+
+    if( close( dest ) != 0 )
+    {
+        retv = -1 ;
+    }
+
+    /* publish the entry
+     */
+
+    if( retv == 0 )
+    {
+        retv = rename( temp, path ) ;
+    }
+
+    if( retv != 0 )
+    {
+        unlink( temp ) ;
+
+        return -1 ;
+    }
+
+    SJGF( "cache store %s", path ) ;
+
+    trim_cache() ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
@@ -0,0 +1,58 @@
+
+/*
+ * Include file wrapcache.h
+ *
+ * $Id$
+ *
+ * Persistent, content addressed cache of processed source files
+ * shared by every process ( and every build ) that uses
+ * wrap_open.so
+ */
+
+
+#ifndef __WRAPCACHE_H
+#  define __WRAPCACHE_H
+
+#include <stdint.h>
+
+#include "wrapchain.h"
+
+/**********************************************************************
+ */
+
+/* A cache key is a 128-bit hash of the source contents, the
+ * command chain string and the identity of the command binaries.
+ *
+ * The hex form is 32 chars and is used as the entry file name
+ * with the first two chars used as a sub-directory.
+ */
+
+#define WRAPCACHE_HEXLEN    32
+
+struct wrapcache_key_s ;
+
+struct wrapcache_key_s {
+    uint64_t    h[2] ;
+    } ;
+
+typedef struct wrapcache_key_s wrapcache_key_t ;
+
+
+/**********************************************************************
+ */
+
+extern int  wrapcache_init( wrapchain_t *chain ) ;
+
+extern int  wrapcache_enabled() ;
+
+extern int  wrapcache_pathlen() ;
+
+extern int  wrapcache_key( char *source, wrapcache_key_t *key ) ;
+
+extern int  wrapcache_lookup( wrapcache_key_t *key, char *path ) ;
+
+extern int  wrapcache_store( wrapcache_key_t *key, int fd ) ;
+
+
+#endif /* __WRAPCACHE_H */
+
@@ -0,0 +1,490 @@
+
+/*
+ * wrapchain.c
+ *
+ * Run the command chain on a source file without going through
+ * the shell or intermediate temp files.
+ *
+ * The commands are located on PATH once, when the chain is
+ * built, and spawned directly with posix_spawn().  Stage N's
+ * stdout is piped into stage N+1's stdin so all the stages of
+ * a chain run concurrently, and the last stage writes straight
+ * into the descriptor supplied by the caller.
+ *
+ * Children get an explicit environment without LD_PRELOAD so
+ * they never load wrap_open.so themselves.
+ *
+ * $Id$
+ */
+
+/* for pipe2()
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapchain.h"
+
+
+extern char **environ ;
+
+
+/**********************************************************************
+ */
+
+/* Locate a command the same way execvp() would
+ *
+ * returns a malloc'd path or NULL if it cannot be found
+ */
+static char *resolve_command( char *name )
+{
+    char path[PATH_MAX] ;
+
+    char *q = NULL ;
+    char *end = NULL ;
+
+    if( strchr( name, '/' ) != NULL )
+    {
+        if( access( name, X_OK ) == 0 )
+        {
+            return strdup( name ) ;
+        }
+
+        return NULL ;
+    }
+
+    q = getenv( "PATH" ) ;
+
+    while( ( q != NULL ) && ( *q != 0 ) )
+    {
+        end = strchr( q, ':' ) ;
+
+        if( end == NULL )
+        {
+            end = q + strlen( q ) ;
+        }
+
+        if( end == q )
+        {
+            /* an empty PATH element means the current directory
+             */
+
+            snprintf( path, PATH_MAX, "%s", name ) ;
+        }
+        else
+        {
+            snprintf( path, PATH_MAX, "%.*s/%s", (int)( end - q ), q, name ) ;
+        }
+
+        struct stat st ;
+
+        if( ( stat( path, &st ) == 0 ) && S_ISREG( st.st_mode ) && ( access( path, X_OK ) == 0 ) )
+        {
+            return strdup( path ) ;
+        }
+
+        q = ( *end == ':' ) ? end+1 : end ;
+    } ;
+
+    return NULL ;
+}
+
+
+/**********************************************************************
+ */
+
+/* copy the environment leaving out LD_PRELOAD
+ */
+static char **build_envp()
+{
+    char **envp = NULL ;
+
+    char *p = NULL ;
+
+    size_t n = 0 ;
+    size_t sz = 0 ;
+
+    int i = 0 ;
+
+    for( i = 0 ; environ[i] != NULL ; i++ )
+    {
+        n++ ;
+        sz += strlen( environ[i] ) + 1 ;
+    }
+
+    /* one block for the pointers and the strings
+     */
+
+    envp = (char **)malloc( ( n+1 ) * sizeof( char * ) + sz ) ;
+
+    if( envp == NULL )
+    {
+        return NULL ;
+    }
+
+    p = (char *)( envp + n + 1 ) ;
+
+    n = 0 ;
+
+    for( i = 0 ; environ[i] != NULL ; i++ )
+    {
+        if( strncmp( environ[i], "LD_PRELOAD=", 11 ) == 0 )
+        {
+            continue ;
+        }
+
+        sz = strlen( environ[i] ) + 1 ;
+
+        memcpy( p, environ[i], sz ) ;
+
+        envp[n++] = p ;
+
+        p += sz ;
+    }
+
+    envp[n] = NULL ;
+
+    return envp ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Build a chain from the double nul terminated command list
+ *
+ * Each command may carry its own arguments separated by
+ * spaces.  Returns NULL if any command cannot be found.
+ */
+wrapchain_t *wrapchain_new( char *commandlist )
+{
+    wrapchain_t *chain = NULL ;
+
+    char *p = NULL ;
+
+    size_t len = 0 ;
+
+    int n = 0 ;
+    int i = 0 ;
+
+    if( commandlist == NULL )
+    {
+        return NULL ;
+    }
+
+    p = commandlist ;
+
+    while( *p != 0 )
+    {
+        n++ ;
+
+        p += strlen( p ) + 1 ;
+    } ;
+
+    len = p - commandlist + 1 ;
+
+    if( n == 0 )
+    {
+        return NULL ;
+    }
+
+    chain = (wrapchain_t *)calloc( 1, sizeof( wrapchain_t ) ) ;
+
+    if( chain == NULL )
+    {
+        return NULL ;
+    }
+
+    chain->stages = (wrapchain_stage_t *)calloc( n, sizeof( wrapchain_stage_t ) ) ;
+
+    /* two copies of the list, one kept whole and one
+     * split into arguments
+     */
+
+    chain->strings = (char *)malloc( 2*len ) ;
+
+    chain->envp = build_envp() ;
+
+    if( ( chain->stages == NULL ) || ( chain->strings == NULL ) || ( chain->envp == NULL ) )
+    {
+        wrapchain_free( chain ) ;
+
+        return NULL ;
+    }
+
+    memcpy( chain->strings, commandlist, len ) ;
+    memcpy( chain->strings + len, commandlist, len ) ;
+
+    chain->nstages = n ;
+
+    char *whole = chain->strings ;
+    char *split = chain->strings + len ;
+
+    for( i = 0 ; i < n ; i++ )
+    {
+        wrapchain_stage_t *st = chain->stages + i ;
+
+        st->command = whole ;
+
+        whole += strlen( whole ) + 1 ;
+
+        p = split ;
+
+        split += strlen( split ) + 1 ;
+
+        /* split into words
+         */
+
+        while( ( *p != 0 ) && ( st->argc < WRAPCHAIN_MAXARGS ) )
+        {
+            while( ( *p == ' ' ) || ( *p == '\t' ) )
+            {
+                *p++ = 0 ;
+            } ;
+
+            if( *p == 0 )
+            {
+                break ;
+            }
+
+            st->argv[ st->argc++ ] = p ;
+
+            while( ( *p != 0 ) && ( *p != ' ' ) && ( *p != '\t' ) )
+            {
+                p++ ;
+            } ;
+        } ;
+
+        if( st->argc == 0 )
+        {
+            wrapchain_free( chain ) ;
+
+            return NULL ;
+        }
+
+        st->path = resolve_command( st->argv[0] ) ;
+
+        if( st->path == NULL )
+        {
+            errorf( "Cannot find command %s", st->argv[0] ) ;
+
+            wrapchain_free( chain ) ;
+
+            return NULL ;
+        }
+
+        /* the fixed tail of the argument list
+         */
+
+        st->argv[ st->argc ] = "-o" ;
+        st->argv[ st->argc+1 ] = "/dev/stdout" ;
+        st->argv[ st->argc+2 ] = "/dev/stdin" ;
+        st->argv[ st->argc+3 ] = NULL ;
+
+        SJGF( "stage %d = %s ( %s )", i, st->command, st->path ) ;
+    }
+
+    return chain ;
+}
+
+
+/**********************************************************************
+ */
+
+void wrapchain_free( wrapchain_t *chain )
+{
+    int i = 0 ;
+
+    if( chain == NULL )
+    {
+        return ;
+    }
+
+    if( chain->stages != NULL )
+    {
+        for( i = 0 ; i < chain->nstages ; i++ )
+        {
+            free( chain->stages[i].path ) ;
+        }
+
+        free( chain->stages ) ;
+    }
+
+    free( chain->strings ) ;
+
+    free( chain->envp ) ;
+
+    free( chain ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Run the chain on source writing the result to outfd
+ *
+ * returns 0 if every stage succeeded, 1 if a stage exited with
+ * an error ( the output may still be usable ) and -1 if the
+ * chain could not be run at all.
+ */
+int wrapchain_run( wrapchain_t *chain, char *source, int outfd )
+{
+    pid_t pids[chain->nstages] ;
+
+    struct timespec started[chain->nstages] ;
+    struct timespec reaped[chain->nstages] ;
+
+    posix_spawn_file_actions_t fa ;
+
+    int pipefd[2] = { -1, -1 } ;
+
+    int infd = -1 ;
+
+    int retv = 0 ;
+
+    int status = 0 ;
+
+    int i = 0 ;
+    int n = 0 ;
+
+    char *argv[WRAPCHAIN_MAXARGS+4] ;
+
+    for( i = 0 ; i < chain->nstages ; i++ )
+    {
+        wrapchain_stage_t *st = chain->stages + i ;
+
+        int lastst = ( i == chain->nstages-1 ) ;
+
+        if( ! lastst )
+        {
+            if( pipe2( pipefd, O_CLOEXEC ) != 0 )
+            {
+                retv = -1 ;
+
+                break ;
+            }
+        }
+
+        memcpy( argv, st->argv, sizeof( argv ) ) ;
+
+        if( i == 0 )
+        {
+            argv[ st->argc+2 ] = source ;
+        }
+
+        posix_spawn_file_actions_init( &fa ) ;
+
+        if( infd != -1 )
+        {
+            posix_spawn_file_actions_adddup2( &fa, infd, 0 ) ;
+        }
+
+        posix_spawn_file_actions_adddup2( &fa, lastst ? outfd : pipefd[1], 1 ) ;
+
+        if( chain->trace != NULL )
+        {
+            clock_gettime( CLOCK_MONOTONIC, started+i ) ;
+        }
+
+        retv = posix_spawn( pids+i, st->path, &fa, NULL, argv, chain->envp ) ;
+
+        posix_spawn_file_actions_destroy( &fa ) ;
+
+        /* the parent has no more use for these ends
+         */
+
+        if( infd != -1 )
+        {
+            close( infd ) ;
+
+            infd = -1 ;
+        }
+
+        if( ! lastst )
+        {
+            close( pipefd[1] ) ;
+
+            infd = pipefd[0] ;
+        }
+
+        if( retv != 0 )
+        {
+            SJGF( "posix_spawn( %s ) failed", st->path ) ;
+
+            retv = -1 ;
+
+            break ;
+        }
+
+        n++ ;
+    }
+
+    if( infd != -1 )
+    {
+        close( infd ) ;
+    }
+
+    /* reap every stage that was started
+     */
+
+    for( i = 0 ; i < n ; i++ )
+    {
+        while( waitpid( pids[i], &status, 0 ) == -1 )
+        {
+            if( errno != EINTR )
+            {
+                status = -1 ;
+
+                break ;
+            }
+        } ;
+
+        if( chain->trace != NULL )
+        {
+            clock_gettime( CLOCK_MONOTONIC, reaped+i ) ;
+        }
+
+        if( ! WIFEXITED( status ) || ( WEXITSTATUS( status ) != 0 ) )
+        {
+            SJGF( "stage %d failed ( status %x )", i, status ) ;
+
+            if( retv == 0 )
+            {
+                retv = 1 ;
+            }
+        }
+    }
+
+    if( chain->trace != NULL )
+    {
+        for( i = 0 ; i < n ; i++ )
+        {
+            chain->trace( chain->stages + i, source, started+i, reaped+i ) ;
+        }
+    }
+
+    return retv ;
+}
+
+
+/**********************************************************************
+ */
+
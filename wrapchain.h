@@ -0,0 +1,74 @@
+
+/*
+ * Include file wrapchain.h
+ *
+ * $Id$
+ *
+ * Runs the WRAP_OPEN_COMMAND chain of preprocessors as a
+ * pipeline of directly spawned processes.
+ */
+
+
+#ifndef __WRAPCHAIN_H
+#  define __WRAPCHAIN_H
+
+#include <time.h>
+
+/**********************************************************************
+ */
+
+/* Each stage is run as :
+ *
+ *   <path> [<args>] -o /dev/stdout <input>
+ *
+ * where <input> is the source file for the first stage and
+ * /dev/stdin for every later stage, so each stage reads the
+ * output of the previous one through a pipe.
+ */
+
+#define WRAPCHAIN_MAXARGS   32
+
+struct wrapchain_stage_s ;
+
+struct wrapchain_stage_s {
+    char        *command ;
+    char        *path ;
+    int          argc ;
+    char        *argv[WRAPCHAIN_MAXARGS+4] ;
+    } ;
+
+typedef struct wrapchain_stage_s wrapchain_stage_t ;
+
+
+/* If set, called once every stage of a run has been reaped with
+ * the times, from CLOCK_MONOTONIC, at which it was spawned and
+ * reaped
+ */
+typedef void ( *wrapchain_trace_fn_t )( wrapchain_stage_t *st, char *source, struct timespec *start, struct timespec *end ) ;
+
+
+struct wrapchain_s ;
+
+struct wrapchain_s {
+    int                  nstages ;
+    wrapchain_stage_t   *stages ;
+    char               **envp ;
+    char                *strings ;
+    wrapchain_trace_fn_t trace ;
+    } ;
+
+typedef struct wrapchain_s wrapchain_t ;
+
+
+/**********************************************************************
+ */
+
+extern wrapchain_t *wrapchain_new( char *commandlist ) ;
+
+extern int  wrapchain_run( wrapchain_t *chain, char *source, int outfd ) ;
+
+extern void wrapchain_free( wrapchain_t *chain ) ;
+
+
+#endif /* __WRAPCHAIN_H */
+
@@ -0,0 +1,497 @@
+/*
+ * wrapexec.c
+ *
+ * Start the programs the compiler driver runs without
+ * wrap_open.so unless they are preprocessing front ends.
+ *
+ * gcc runs as, collect2, ld and lto-wrapper as well as cc1 and
+ * they all inherit LD_PRELOAD.  None of them reads a source
+ * file, so loading the library into them only costs time and
+ * risks redirecting something that should be left alone.  The
+ * exec calls and posix_spawn() are wrapped and, for anything
+ * not on the front end list, wrap_open.so is taken out of
+ * LD_PRELOAD in the environment the new program gets.
+ *
+ * The compiler drivers count as front ends too, since a script
+ * or ccache may stand between gccwrap and gcc, and gcc has to
+ * pass the library on to cc1.  The gcc-ar, gcc-nm and
+ * gcc-ranlib wrappers look like drivers but are not, so the
+ * default list excludes them by name.
+ *
+ * gcc may run its children from a vfork() child, so the new
+ * environment is built on the stack and nothing here calls
+ * malloc().
+ *
+ * The execl() family is not wrapped, the C library turns it
+ * into an execve() we never see.
+ *
+ * $Id$
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <spawn.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapexec.h"
+
+
+extern char **environ ;
+
+
+/**********************************************************************
+ */
+
+typedef int ( *execve_fn_t )( const char *path, char *const argv[], char *const envp[] ) ;
+
+typedef int ( *execv_fn_t )( const char *path, char *const argv[] ) ;
+
+typedef int ( *spawn_fn_t )( pid_t *pid, const char *path,
+                             const posix_spawn_file_actions_t *fa, const posix_spawnattr_t *attr,
+                             char *const argv[], char *const envp[] ) ;
+
+static execve_fn_t old_execve = NULL ;
+
+static execv_fn_t old_execv = NULL ;
+
+static execv_fn_t old_execvp = NULL ;
+
+static execve_fn_t old_execvpe = NULL ;
+
+static spawn_fn_t old_posix_spawn = NULL ;
+
+static spawn_fn_t old_posix_spawnp = NULL ;
+
+
+/* the last part of the path we were loaded from, which is how
+ * we are recognised in LD_PRELOAD
+ */
+static const char *ourname = NULL ;
+
+static size_t ourlen = 0 ;
+
+
+/**********************************************************************
+ */
+
+/* Called from my_init(), and by the wrappers should a program
+ * exec something before that
+ */
+void wrapexec_init()
+{
+    Dl_info info ;
+
+    const char *p = NULL ;
+
+    if( __atomic_load_n( &old_execve, __ATOMIC_ACQUIRE ) != NULL )
+    {
+        return ;
+    }
+
+    old_execv = ( execv_fn_t )dlsym( RTLD_NEXT, "execv" ) ;
+    old_execvp = ( execv_fn_t )dlsym( RTLD_NEXT, "execvp" ) ;
+    old_execvpe = ( execve_fn_t )dlsym( RTLD_NEXT, "execvpe" ) ;
+    old_posix_spawn = ( spawn_fn_t )dlsym( RTLD_NEXT, "posix_spawn" ) ;
+    old_posix_spawnp = ( spawn_fn_t )dlsym( RTLD_NEXT, "posix_spawnp" ) ;
+
+    if( ( dladdr( (void *)wrapexec_init, &info ) != 0 ) && ( info.dli_fname != NULL ) )
+    {
+        p = strrchr( info.dli_fname, '/' ) ;
+
+        ourname = ( p != NULL ) ? p+1 : info.dli_fname ;
+
+        ourlen = strlen( ourname ) ;
+    }
+
+    SJGF( "loaded as %s", ourname ) ;
+
+    /* last, it is what says the others are done
+     */
+
+    __atomic_store_n( &old_execve, ( execve_fn_t )dlsym( RTLD_NEXT, "execve" ), __ATOMIC_RELEASE ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Does name match the pattern of len bytes at q
+ */
+static int name_match( const char *name, size_t namelen, const char *q, size_t len )
+{
+    const char *p = NULL ;
+
+    int lead = FALSE ;
+    int trail = FALSE ;
+
+    lead = ( len > 0 ) && ( q[0] == '*' ) ;
+
+    trail = ( len > 1 ) && ( q[len-1] == '*' ) ;
+
+    p = q + lead ;
+
+    len -= lead + trail ;
+
+    if( ( lead == 0 ) && ( len == 0 ) )
+    {
+        return FALSE ;
+    }
+
+    if( len > namelen )
+    {
+        return FALSE ;
+    }
+
+    if( lead && trail )
+        return ( memmem( name, namelen, p, len ) != NULL ) ;
+    else if( lead )
+        return ( strncmp( name + namelen - len, p, len ) == 0 ) ;
+    else if( trail )
+        return ( strncmp( name, p, len ) == 0 ) ;
+    else
+        return ( len == namelen ) && ( strncmp( name, p, len ) == 0 ) ;
+}
+
+
+/* Is path a program which should keep wrap_open.so
+ *
+ * A name matching any pattern starting with ! never does,
+ * wherever that pattern is in the list.
+ */
+static int is_frontend( const char *path )
+{
+    const char *name = NULL ;
+    const char *q = NULL ;
+    const char *end = NULL ;
+
+    size_t namelen = 0 ;
+
+    int found = FALSE ;
+
+    name = strrchr( path, '/' ) ;
+
+    name = ( name != NULL ) ? name+1 : path ;
+
+    namelen = strlen( name ) ;
+
+    q = getenv( WRAPEXEC_ENV ) ;
+
+    if( ( q == NULL ) || ( *q == 0 ) )
+    {
+        q = WRAPEXEC_DEFAULT ;
+    }
+
+    while( *q != 0 )
+    {
+        end = q + strcspn( q, ",:" ) ;
+
+        if( *q == '!' )
+        {
+            if( name_match( name, namelen, q+1, end - ( q+1 ) ) )
+            {
+                return FALSE ;
+            }
+        }
+        else if( name_match( name, namelen, q, end - q ) )
+        {
+            found = TRUE ;
+        }
+
+        q = ( *end != 0 ) ? end+1 : end ;
+    } ;
+
+    return found ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Is the LD_PRELOAD entry of len bytes at p wrap_open.so
+ */
+static int is_us( const char *p, size_t len )
+{
+    const char *q = NULL ;
+
+    for( q = p+len ; ( q > p ) && ( q[-1] != '/' ) ; q-- )
+    {
+    }
+
+    len -= q - p ;
+
+    return ( len == ourlen ) && ( strncmp( q, ourname, len ) == 0 ) ;
+}
+
+
+/* Count the entries in envp and find the space needed to
+ * rewrite LD_PRELOAD.
+ *
+ * returns TRUE if wrap_open.so is in it
+ */
+static int preloaded( char *const envp[], size_t *n, size_t *sz )
+{
+    const char *q = NULL ;
+    const char *end = NULL ;
+
+    int found = FALSE ;
+
+    size_t i = 0 ;
+
+    if( ( envp == NULL ) || ( ourname == NULL ) )
+    {
+        return FALSE ;
+    }
+
+    for( i = 0 ; envp[i] != NULL ; i++ )
+    {
+        if( strncmp( envp[i], "LD_PRELOAD=", 11 ) != 0 )
+        {
+            continue ;
+        }
+
+        *sz = strlen( envp[i] ) + 1 ;
+
+        /* entries are separated by spaces or colons
+         */
+
+        for( q = envp[i] + 11 ; *q != 0 ; q = end )
+        {
+            q += strspn( q, " :" ) ;
+
+            end = q + strcspn( q, " :" ) ;
+
+            if( ( end > q ) && is_us( q, end - q ) )
+            {
+                found = TRUE ;
+            }
+        }
+    }
+
+    *n = i ;
+
+    return found ;
+}
+
+
+/* Copy envp to newenv rewriting LD_PRELOAD into buf without
+ * wrap_open.so, or leaving it out if nothing else is in it
+ */
+static void strip_preload( char *const envp[], char **newenv, char *buf )
+{
+    const char *q = NULL ;
+    const char *end = NULL ;
+
+    char *p = NULL ;
+
+    size_t i = 0 ;
+    size_t n = 0 ;
+
+    for( i = 0 ; envp[i] != NULL ; i++ )
+    {
+        if( strncmp( envp[i], "LD_PRELOAD=", 11 ) != 0 )
+        {
+            newenv[n++] = envp[i] ;
+
+            continue ;
+        }
+
+        memcpy( buf, envp[i], 11 ) ;
+
+        p = buf + 11 ;
+
+        for( q = envp[i] + 11 ; *q != 0 ; q = end )
+        {
+            q += strspn( q, " :" ) ;
+
+            end = q + strcspn( q, " :" ) ;
+
+            if( ( end == q ) || is_us( q, end - q ) )
+            {
+                continue ;
+            }
+
+            if( p != buf + 11 )
+            {
+                *p++ = ' ' ;
+            }
+
+            memcpy( p, q, end - q ) ;
+
+            p += end - q ;
+        }
+
+        *p = 0 ;
+
+        if( p != buf + 11 )
+        {
+            newenv[n++] = buf ;
+        }
+    }
+
+    newenv[n] = NULL ;
+}
+
+
+/**********************************************************************
+ */
+
+int execve( const char *path, char *const argv[], char *const envp[] )
+{
+    size_t n = 0 ;
+    size_t sz = 0 ;
+
+    wrapexec_init() ;
+
+    if( is_frontend( path ) || ! preloaded( envp, &n, &sz ) )
+    {
+        return old_execve( path, argv, envp ) ;
+    }
+
+    char *newenv[n+1] ;
+    char buf[sz] ;
+
+    strip_preload( envp, newenv, buf ) ;
+
+    SJGF( "%s without preload", path ) ;
+
+    return old_execve( path, argv, newenv ) ;
+}
+
+
+int execv( const char *path, char *const argv[] )
+{
+    size_t n = 0 ;
+    size_t sz = 0 ;
+
+    wrapexec_init() ;
+
+    if( is_frontend( path ) || ! preloaded( environ, &n, &sz ) )
+    {
+        return old_execv( path, argv ) ;
+    }
+
+    char *newenv[n+1] ;
+    char buf[sz] ;
+
+    strip_preload( environ, newenv, buf ) ;
+
+    SJGF( "%s without preload", path ) ;
+
+    return old_execve( path, argv, newenv ) ;
+}
+
+
+int execvp( const char *file, char *const argv[] )
+{
+    size_t n = 0 ;
+    size_t sz = 0 ;
+
+    wrapexec_init() ;
+
+    if( is_frontend( file ) || ! preloaded( environ, &n, &sz ) )
+    {
+        return old_execvp( file, argv ) ;
+    }
+
+    char *newenv[n+1] ;
+    char buf[sz] ;
+
+    strip_preload( environ, newenv, buf ) ;
+
+    SJGF( "%s without preload", file ) ;
+
+    return old_execvpe( file, argv, newenv ) ;
+}
+
+
+int execvpe( const char *file, char *const argv[], char *const envp[] )
+{
+    size_t n = 0 ;
+    size_t sz = 0 ;
+
+    wrapexec_init() ;
+
+    if( is_frontend( file ) || ! preloaded( envp, &n, &sz ) )
+    {
+        return old_execvpe( file, argv, envp ) ;
+    }
+
+    char *newenv[n+1] ;
+    char buf[sz] ;
+
+    strip_preload( envp, newenv, buf ) ;
+
+    SJGF( "%s without preload", file ) ;
+
+    return old_execvpe( file, argv, newenv ) ;
+}
+
+
+/**********************************************************************
+ */
+
+int posix_spawn( pid_t *pid, const char *path,
+                 const posix_spawn_file_actions_t *fa, const posix_spawnattr_t *attr,
+                 char *const argv[], char *const envp[] )
+{
+    size_t n = 0 ;
+    size_t sz = 0 ;
+
+    wrapexec_init() ;
+
+    if( is_frontend( path ) || ! preloaded( envp, &n, &sz ) )
+    {
+        return old_posix_spawn( pid, path, fa, attr, argv, envp ) ;
+    }
+
+    char *newenv[n+1] ;
+    char buf[sz] ;
+
+    strip_preload( envp, newenv, buf ) ;
+
+    SJGF( "%s without preload", path ) ;
+
+    return old_posix_spawn( pid, path, fa, attr, argv, newenv ) ;
+}
+
+
+int posix_spawnp( pid_t *pid, const char *file,
+                  const posix_spawn_file_actions_t *fa, const posix_spawnattr_t *attr,
+                  char *const argv[], char *const envp[] )
+{
+    size_t n = 0 ;
+    size_t sz = 0 ;
+
+    wrapexec_init() ;
+
+    if( is_frontend( file ) || ! preloaded( envp, &n, &sz ) )
+    {
+        return old_posix_spawnp( pid, file, fa, attr, argv, envp ) ;
+    }
+
+    char *newenv[n+1] ;
+    char buf[sz] ;
+
+    strip_preload( envp, newenv, buf ) ;
+
+    SJGF( "%s without preload", file ) ;
+
+    return old_posix_spawnp( pid, file, fa, attr, argv, newenv ) ;
+}
+
+
+/**********************************************************************
+ */
+
@@ -0,0 +1,47 @@
+
+/*
+ * Include file wrapexec.h
+ *
+ * $Id$
+ *
+ * Keeps wrap_open.so out of the programs the compiler driver
+ * runs which never read source files.
+ */
+
+
+#ifndef __WRAPEXEC_H
+#  define __WRAPEXEC_H
+
+/**********************************************************************
+ */
+
+/* Only the programs named in WRAP_OPEN_FRONTENDS are started
+ * with wrap_open.so still in LD_PRELOAD, every other program,
+ * as, ld, collect2 and so on, is started without it.
+ *
+ * Names are separated by commas or colons and compared with the
+ * last part of the path being run.  A * at the end matches any
+ * name starting with what comes before it, one at the start
+ * any name ending with what follows it.  A name matching a
+ * pattern which starts with ! is never a front end.
+ *
+ *   WRAP_OPEN_FRONTENDS="cc1*,cpp,*gcc*,clang*,mypp,!*gcc-ar*"
+ *
+ * The compiler drivers have to be on the list as well, so they
+ * can pass the library on to the real front ends.
+ *
+ * WRAP_OPEN_FRONTENDS=* keeps wrap_open.so in every program.
+ */
+#define WRAPEXEC_ENV            "WRAP_OPEN_FRONTENDS"
+
+#define WRAPEXEC_DEFAULT        "cc1*,cpp,cc,c++,*gcc*,*g++*,clang*,!*gcc-ar*,!*gcc-nm*,!*gcc-ranlib*"
+
+
+/**********************************************************************
+ */
+
+extern void     wrapexec_init() ;
+
+
+#endif /* __WRAPEXEC_H */
+
@@ -0,0 +1,173 @@
+/*
+ * wraphash.c
+ *
+ * The open addressing hash table ( see wraphash.h ) behind the
+ * name, memo, sniff, marker and prefetch tables, and FNV-1a.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wraphash.h"
+
+
+/**********************************************************************
+ */
+
+/* FNV-1a, continuing from h
+ */
+uint64_t wraphash_fnv( const void *p, size_t len, uint64_t h )
+{
+    const unsigned char *s = (const unsigned char *)p ;
+
+    size_t i = 0 ;
+
+    for( i = 0 ; i < len ; i++ )
+    {
+        h ^= (uint64_t)s[i] ;
+        h *= UINT64_C(0x100000001b3) ;
+    }
+
+    return h ;
+}
+
+
+/**********************************************************************
+ */
+
+/* returns the first entry stored with key, or NULL
+ */
+void *wraphash_find( wraphash_t *tab, uint64_t key )
+{
+    uint64_t *e = NULL ;
+
+    WRAPHASH_WALK(  *tab,
+                    key,
+                    uint64_t,
+                    e,
+
+                    return e ;
+                 )
+
+    return NULL ;
+}
+
+
+/**********************************************************************
+ */
+
+/* must be serialised with every other add to tab
+ *
+ * ent is copied in, its key last.
+ *
+ * returns 0 on success
+ */
+int wraphash_add( wraphash_t *tab, const void *ent )
+{
+    wraphash_arr_t *a = tab->arr ;
+
+    uint64_t key = *(const uint64_t *)ent ;
+
+    uint64_t *e = NULL ;
+
+    uint32_t i = 0 ;
+
+    if( ( a == NULL ) || ( ( tab->count + 1 ) * 4 > a->size * 3 ) )
+    {
+        uint32_t newsize = ( a == NULL ) ? WRAPHASH_MINSIZE : a->size * 2 ;
+
+        wraphash_arr_t *na = NULL ;
+
+        na = (wraphash_arr_t *)calloc( 1, sizeof( wraphash_arr_t ) + (size_t)newsize * tab->entsize ) ;
+
+        if( na == NULL )
+        {
+            return -1 ;
+        }
+
+        na->size = newsize ;
+
+        for( i = 0 ; ( a != NULL ) && ( i < a->size ) ; i++ )
+        {
+            e = WRAPHASH_SLOT( a, tab->entsize, i ) ;
+
+            if( *e != 0 )
+            {
+                uint32_t j = (uint32_t)*e & ( newsize - 1 ) ;
+
+                while( *WRAPHASH_SLOT( na, tab->entsize, j ) != 0 )
+                {
+                    j = ( j + 1 ) & ( newsize - 1 ) ;
+                } ;
+
+                memcpy( WRAPHASH_SLOT( na, tab->entsize, j ), e, tab->entsize ) ;
+            }
+        }
+
+        if( a != NULL )
+        {
+            a->next = tab->retired ;
+            tab->retired = a ;
+        }
+
+        __atomic_store_n( &( tab->arr ), na, __ATOMIC_RELEASE ) ;
+
+        a = na ;
+    }
+
+    i = (uint32_t)key & ( a->size - 1 ) ;
+
+    while( *WRAPHASH_SLOT( a, tab->entsize, i ) != 0 )
+    {
+        i = ( i + 1 ) & ( a->size - 1 ) ;
+    } ;
+
+    e = WRAPHASH_SLOT( a, tab->entsize, i ) ;
+
+    memcpy( e + 1, (const uint64_t *)ent + 1, tab->entsize - sizeof( uint64_t ) ) ;
+
+    __atomic_store_n( e, key, __ATOMIC_RELEASE ) ;
+
+    tab->count++ ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* free the table and every slot array it has replaced
+ */
+void wraphash_free( wraphash_t *tab )
+{
+    wraphash_arr_t *a = NULL ;
+    wraphash_arr_t *next = NULL ;
+
+    LIST_WALK(  tab->retired,
+                a,
+                next,
+
+                free( a ) ;
+             )
+
+    free( tab->arr ) ;
+
+    tab->arr = NULL ;
+    tab->retired = NULL ;
+    tab->count = 0 ;
+}
+
+
+/**********************************************************************
+ */
@@ -0,0 +1,118 @@
+/*
+ * Include file wraphash.h
+ *
+ * $Id$
+ *
+ * The open addressing hash table and the FNV-1a hash shared by
+ * the caches in wrap_open.so, gccwrap and gccwrap-server.
+ */
+
+
+#ifndef __WRAPHASH_H
+#  define __WRAPHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**********************************************************************
+ */
+
+/* FNV-1a offset basis, the usual starting value for
+ * wraphash_fnv()
+ */
+#define WRAPHASH_FNV_BASIS  UINT64_C(0xcbf29ce484222325)
+
+#define WRAPHASH_MINSIZE    256
+
+/* Make a hash usable as a key.  The top bit is set rather than
+ * the bottom one, which would leave every even home slot empty.
+ */
+#define WRAPHASH_KEY( _h )  ( (uint64_t)(_h) | UINT64_C(0x8000000000000000) )
+
+
+/* Linear probing over a power of two number of slots, doubled
+ * whenever it gets three quarters full.
+ *
+ * Every entry is a struct whose first member is its uint64_t
+ * key, and a key of zero marks an empty slot so callers must
+ * never use it, WRAPHASH_KEY() sees to that.  The same key
+ * may be added more than once.
+ *
+ * Adds must be serialised by the caller.  Lookups take no lock:
+ * an entry is filled in before its key is published, a grown
+ * table is published as a whole, nothing is ever removed and
+ * replaced slot arrays are only freed by wraphash_free(), so a
+ * reader can never be left looking at freed memory.
+ */
+
+struct wraphash_arr_s ;
+
+struct wraphash_arr_s {
+    struct wraphash_arr_s   *next ;
+    uint32_t                 size ;
+    uint64_t                 ents[] ;
+    } ;
+
+typedef struct wraphash_arr_s wraphash_arr_t ;
+
+
+struct wraphash_s ;
+
+struct wraphash_s {
+    wraphash_arr_t  *arr ;
+    uint32_t         entsize ;
+    uint32_t         count ;
+    wraphash_arr_t  *retired ;
+    } ;
+
+typedef struct wraphash_s wraphash_t ;
+
+
+#define WRAPHASH_INIT( _type )  { NULL, sizeof( _type ), 0, NULL }
+
+#define WRAPHASH_SLOT( _a, _entsize, _i ) \
+                        ( (uint64_t *)( (char *)( (_a)->ents ) + (size_t)(_i) * (_entsize) ) )
+
+
+/* Walk every entry of type _type stored with key _k.  _code
+ * decides whether _v is the one it wants, and may break out.
+ */
+#define WRAPHASH_WALK( _tab, _k, _type, _v, _code )  \
+                        { \
+                            wraphash_arr_t *_a = __atomic_load_n( &( (_tab).arr ), __ATOMIC_ACQUIRE ) ; \
+                            \
+                            if( _a != NULL ) \
+                            { \
+                                uint32_t _i = (uint32_t)(_k) & ( _a->size - 1 ) ; \
+                                \
+                                uint64_t _key = 0 ; \
+                                \
+                                while( ( _key = __atomic_load_n( WRAPHASH_SLOT( _a, (_tab).entsize, _i ), __ATOMIC_ACQUIRE ) ) != 0 ) \
+                                { \
+                                    if( _key == (_k) ) \
+                                    { \
+                                        (_v) = (_type *)WRAPHASH_SLOT( _a, (_tab).entsize, _i ) ; \
+                                        \
+                                        _code \
+                                    } \
+                                    \
+                                    _i = ( _i + 1 ) & ( _a->size - 1 ) ; \
+                                } ; \
+                            } \
+                        }
+
+
+/**********************************************************************
+ */
+
+extern void    *wraphash_find( wraphash_t *tab, uint64_t key ) ;
+
+extern int      wraphash_add( wraphash_t *tab, const void *ent ) ;
+
+extern void     wraphash_free( wraphash_t *tab ) ;
+
+extern uint64_t wraphash_fnv( const void *p, size_t len, uint64_t h ) ;
+
+
+#endif /* __WRAPHASH_H */
+
@@ -0,0 +1,716 @@
+
+/*
+ * wrapprefetch.c
+ *
+ * Speculative include prefetch.
+ *
+ * Once a file has been processed its output is scanned for
+ * #include "..." lines.  Each header is resolved the way the
+ * compiler would resolve it, first against the directory of
+ * the including file and then the -iquote and -I directories
+ * on our own command line, and queued.  A small pool of worker
+ * threads hands queued headers back to wrap_open.c, which
+ * processes them exactly as if the compiler had opened them.
+ *
+ * By the time the compiler gets round to opening a header it
+ * has usually been processed already, or is being processed
+ * and the compiler only waits for the remainder.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapprefetch.h"
+
+#include "wraphash.h"
+
+
+/**********************************************************************
+ */
+
+DEF_LISTNODE(   job,
+                char        *path ;
+            )
+
+
+static wrapprefetch_fn_t fetchfn = NULL ;
+
+static int nworkers = 0 ;
+
+static int started = 0 ;
+
+static int active = 0 ;
+
+static int stopping = FALSE ;
+
+static job_t *head = NULL ;
+
+static job_t *tail = NULL ;
+
+static pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER ;
+
+/* work is waiting
+ */
+static pthread_cond_t qcond = PTHREAD_COND_INITIALIZER ;
+
+/* a worker has finished a job
+ */
+static pthread_cond_t idlecond = PTHREAD_COND_INITIALIZER ;
+
+
+/* Hashes of every path ever queued, so a header included from
+ * many places is only queued once.  A collision only costs a
+ * missed prefetch.
+ */
+static wraphash_t seen = WRAPHASH_INIT( uint64_t ) ;
+
+
+/* -iquote directories followed by -I directories, in order
+ */
+static char **incdirs = NULL ;
+
+static int nincdirs = 0 ;
+
+
+/**********************************************************************
+ */
+
+/* must be called with qlock held
+ *
+ * returns TRUE if h was not already in the set
+ */
+static int seen_add( uint64_t h )
+{
+    if( wraphash_find( &seen, h ) != NULL )
+    {
+        return FALSE ;
+    }
+
+    return ( wraphash_add( &seen, &h ) == 0 ) ;
+}
+
+
+/**********************************************************************
+ */
+
+static void *worker( void *arg )
+{
+    job_t *job = NULL ;
+
+    (void)arg ;
+
+    pthread_mutex_lock( &qlock ) ;
+
+    while( TRUE )
+    {
+        while( ( head == NULL ) && ! stopping )
+        {
+            pthread_cond_wait( &qcond, &qlock ) ;
+        } ;
+
+        if( stopping )
+        {
+            break ;
+        }
+
+        job = head ;
+        head = job->next ;
+
+        if( head == NULL )
+        {
+            tail = NULL ;
+        }
+
+        active++ ;
+
+        pthread_mutex_unlock( &qlock ) ;
+
+        SJGF( "prefetching %s", job->path ) ;
+
+        fetchfn( job->path ) ;
+
+        free( job->path ) ;
+        free( job ) ;
+
+        pthread_mutex_lock( &qlock ) ;
+
+        active-- ;
+
+        pthread_cond_broadcast( &idlecond ) ;
+    } ;
+
+    pthread_mutex_unlock( &qlock ) ;
+
+    return NULL ;
+}
+
+
+/**********************************************************************
+ */
+
+static void enqueue( char *path )
+{
+    job_t *job = NULL ;
+
+    pthread_t tid ;
+
+    pthread_attr_t attr ;
+
+    pthread_mutex_lock( &qlock ) ;
+
+    if( stopping || ! seen_add( WRAPHASH_KEY( wraphash_fnv( path, strlen( path ), WRAPHASH_FNV_BASIS ) ) ) )
+    {
+        pthread_mutex_unlock( &qlock ) ;
+
+        return ;
+    }
+
+    job = (job_t *)malloc( sizeof( job_t ) ) ;
+
+    if( job != NULL )
+    {
+        job->path = strdup( path ) ;
+        job->next = NULL ;
+
+        if( job->path == NULL )
+        {
+            free( job ) ;
+
+            job = NULL ;
+        }
+    }
+
+    if( job != NULL )
+    {
+        if( tail == NULL )
+        {
+            head = job ;
+        }
+        else
+        {
+            tail->next = job ;
+        }
+
+        tail = job ;
+
+        /* threads are only started once there is work
+         */
+
+        if( started < nworkers )
+        {
+            pthread_attr_init( &attr ) ;
+
+            pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED ) ;
+
+            if( pthread_create( &tid, &attr, worker, NULL ) == 0 )
+            {
+                started++ ;
+            }
+
+            pthread_attr_destroy( &attr ) ;
+        }
+
+        pthread_cond_signal( &qcond ) ;
+    }
+
+    pthread_mutex_unlock( &qlock ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Resolve a quoted include the way the compiler will and queue
+ * what it finds
+ */
+static void resolve( char *includer, char *name, int len )
+{
+    char path[PATH_MAX] ;
+
+    char *slash = NULL ;
+
+    int i = 0 ;
+
+    if( name[0] == '/' )
+    {
+        if( len < PATH_MAX )
+        {
+            memcpy( path, name, len ) ;
+
+            path[len] = 0 ;
+
+            if( access( path, R_OK ) == 0 )
+            {
+                enqueue( path ) ;
+            }
+        }
+
+        return ;
+    }
+
+    slash = strrchr( includer, '/' ) ;
+
+    if( ( slash != NULL ) && ( snprintf( path, PATH_MAX, "%.*s/%.*s", (int)( slash - includer ), includer, len, name ) < PATH_MAX ) )
+    {
+        if( access( path, R_OK ) == 0 )
+        {
+            enqueue( path ) ;
+
+            return ;
+        }
+    }
+
+    for( i = 0 ; i < nincdirs ; i++ )
+    {
+        if( snprintf( path, PATH_MAX, "%s/%.*s", incdirs[i], len, name ) >= PATH_MAX )
+        {
+            continue ;
+        }
+
+        if( access( path, R_OK ) == 0 )
+        {
+            enqueue( path ) ;
+
+            return ;
+        }
+    }
+}
+
+
+/**********************************************************************
+ */
+
+/* Queue the local headers included by a processed file
+ */
+void wrapprefetch_scan( char *includer, int fd )
+{
+    struct stat st ;
+
+    char *data = NULL ;
+    char *p = NULL ;
+    char *end = NULL ;
+    char *name = NULL ;
+
+    if( ( fetchfn == NULL ) || ( fstat( fd, &st ) != 0 ) || ( st.st_size == 0 ) )
+    {
+        return ;
+    }
+
+    data = (char *)mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) ;
+
+    if( data == MAP_FAILED )
+    {
+        return ;
+    }
+
+    p = data ;
+    end = data + st.st_size ;
+
+    while( p < end )
+    {
+        /* at the start of a line
+         */
+
+        while( ( p < end ) && ( ( *p == ' ' ) || ( *p == '\t' ) ) )
+        {
+            p++ ;
+        } ;
+
+        if( ( p < end ) && ( *p == '#' ) )
+        {
+            p++ ;
+
+            while( ( p < end ) && ( ( *p == ' ' ) || ( *p == '\t' ) ) )
+            {
+                p++ ;
+            } ;
+
+            if( ( end - p > 7 ) && ( memcmp( p, "include", 7 ) == 0 ) )
+            {
+                p += 7 ;
+
+                while( ( p < end ) && ( ( *p == ' ' ) || ( *p == '\t' ) ) )
+                {
+                    p++ ;
+                } ;
+
+                if( ( p < end ) && ( *p == '"' ) )
+                {
+                    name = ++p ;
+
+                    while( ( p < end ) && ( *p != '"' ) && ( *p != '\n' ) )
+                    {
+                        p++ ;
+                    } ;
+
+                    if( ( p < end ) && ( *p == '"' ) && ( p > name ) )
+                    {
+                        resolve( includer, name, (int)( p - name ) ) ;
+                    }
+                }
+            }
+        }
+
+        p = memchr( p, '\n', end - p ) ;
+
+        if( p == NULL )
+        {
+            break ;
+        }
+
+        p++ ;
+    } ;
+
+    munmap( data, st.st_size ) ;
+}
+
+
+/**********************************************************************
+ */
+
+static void add_incdir( char *dir, char **list, int *np )
+{
+    char rp[PATH_MAX] ;
+
+    if( ( *dir != 0 ) && ( realpath( dir, rp ) != NULL ) )
+    {
+        list[ (*np)++ ] = strdup( rp ) ;
+
+        if( list[ *np - 1 ] == NULL )
+        {
+            (*np)-- ;
+        }
+    }
+}
+
+
+/**********************************************************************
+ */
+
+/* Pick the -iquote and -I directories out of our own command
+ * line, which is the compiler proper's
+ */
+static void read_incdirs()
+{
+    char *buf = NULL ;
+
+    char **quote = NULL ;
+    char **bracket = NULL ;
+
+    int nquote = 0 ;
+    int nbracket = 0 ;
+
+    size_t len = 0 ;
+    size_t cap = 4096 ;
+    size_t off = 0 ;
+
+    ssize_t n = 0 ;
+
+    int fd = -1 ;
+
+    int argc = 0 ;
+
+    int i = 0 ;
+
+    char *p = NULL ;
+
+    fd = open( "/proc/self/cmdline", O_RDONLY | O_CLOEXEC ) ;
+
+    if( fd == -1 )
+    {
+        return ;
+    }
+
+    buf = (char *)malloc( cap + 1 ) ;
+
+    while( buf != NULL )
+    {
+        n = read( fd, buf + len, cap - len ) ;
+
+        if( n <= 0 )
+        {
+            break ;
+        }
+
+        len += n ;
+
+        if( len == cap )
+        {
+            cap *= 2 ;
+
+            char *newbuf = (char *)realloc( buf, cap + 1 ) ;
+
+            if( newbuf == NULL )
+            {
+                free( buf ) ;
+            }
+
+            buf = newbuf ;
+        }
+    } ;
+
+    close( fd ) ;
+
+    if( buf == NULL )
+    {
+        return ;
+    }
+
+    buf[len] = 0 ;
+
+    for( off = 0 ; off < len ; off++ )
+    {
+        if( buf[off] == 0 )
+        {
+            argc++ ;
+        }
+    }
+
+    quote = (char **)calloc( argc + 1, sizeof( char * ) ) ;
+    bracket = (char **)calloc( argc + 1, sizeof( char * ) ) ;
+
+    incdirs = (char **)calloc( argc + 1, sizeof( char * ) ) ;
+
+    if( ( quote == NULL ) || ( bracket == NULL ) || ( incdirs == NULL ) )
+    {
+        free( incdirs ) ;
+
+        incdirs = NULL ;
+
+        goto err_exit ;
+    }
+
+    for( p = buf ; p < buf + len ; p += strlen( p ) + 1 )
+    {
+        char *next = p + strlen( p ) + 1 ;
+
+        if( next >= buf + len )
+        {
+            next = NULL ;
+        }
+
+        if( strcmp( p, "-iquote" ) == 0 )
+        {
+            if( next != NULL )
+            {
+                add_incdir( next, quote, &nquote ) ;
+
+                p = next ;
+            }
+        }
+        else if( strncmp( p, "-iquote", 7 ) == 0 )
+        {
+            add_incdir( p + 7, quote, &nquote ) ;
+        }
+        else if( strcmp( p, "-I" ) == 0 )
+        {
+            if( next != NULL )
+            {
+                add_incdir( next, bracket, &nbracket ) ;
+
+                p = next ;
+            }
+        }
+        else if( strncmp( p, "-I", 2 ) == 0 )
+        {
+            add_incdir( p + 2, bracket, &nbracket ) ;
+        }
+    }
+
+    for( i = 0 ; i < nquote ; i++ )
+    {
+        incdirs[ nincdirs++ ] = quote[i] ;
+    }
+
+    for( i = 0 ; i < nbracket ; i++ )
+    {
+        incdirs[ nincdirs++ ] = bracket[i] ;
+    }
+
+err_exit:
+
+    free( quote ) ;
+    free( bracket ) ;
+    free( buf ) ;
+}
+
+
+/**********************************************************************
+ */
+
+static void prefork()
+{
+    pthread_mutex_lock( &qlock ) ;
+}
+
+
+static void postfork_parent()
+{
+    pthread_mutex_unlock( &qlock ) ;
+}
+
+
+static void postfork_child()
+{
+    /* the workers stayed behind in the parent, new ones are
+     * started when there is more work
+     */
+
+    started = 0 ;
+    active = 0 ;
+
+    pthread_cond_init( &qcond, NULL ) ;
+    pthread_cond_init( &idlecond, NULL ) ;
+
+    pthread_mutex_unlock( &qlock ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* returns 0 if prefetching is on
+ */
+int wrapprefetch_init( wrapprefetch_fn_t fetch )
+{
+    char *p = getenv( WRAPPREFETCH_ENV ) ;
+
+    int n = WRAPPREFETCH_DEFAULT ;
+
+    if( ( p != NULL ) && ( *p != 0 ) )
+    {
+        n = atoi( p ) ;
+    }
+
+    return wrapprefetch_start( fetch, n ) ;
+}
+
+
+/* Set up a pool of n workers calling fetch
+ *
+ * returns 0 unless n is 0
+ */
+int wrapprefetch_start( wrapprefetch_fn_t fetch, int n )
+{
+    if( n <= 0 )
+    {
+        return -1 ;
+    }
+
+    nworkers = n ;
+
+    read_incdirs() ;
+
+    fetchfn = fetch ;
+
+    pthread_atfork( prefork, postfork_parent, postfork_child ) ;
+
+    SJGF( "prefetching with %d threads and %d include dirs", nworkers, nincdirs ) ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Queue a file which is not included from anywhere we know of,
+ * e.g. a source named on the command line
+ */
+void wrapprefetch_add( char *path )
+{
+    if( fetchfn != NULL )
+    {
+        enqueue( path ) ;
+    }
+}
+
+
+/**********************************************************************
+ */
+
+/* Wait until everything queued, and everything it led to, has
+ * been fetched
+ */
+void wrapprefetch_wait()
+{
+    if( fetchfn == NULL )
+    {
+        return ;
+    }
+
+    pthread_mutex_lock( &qlock ) ;
+
+    while( ( ( head != NULL ) || ( active > 0 ) ) && ( started > 0 ) )
+    {
+        pthread_cond_wait( &idlecond, &qlock ) ;
+    } ;
+
+    pthread_mutex_unlock( &qlock ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Stop taking work and wait for jobs in progress, which may
+ * still be using the caller's data, to finish
+ */
+void wrapprefetch_stop()
+{
+    job_t *job = NULL ;
+    job_t *next = NULL ;
+
+    if( fetchfn == NULL )
+    {
+        return ;
+    }
+
+    pthread_mutex_lock( &qlock ) ;
+
+    stopping = TRUE ;
+
+    pthread_cond_broadcast( &qcond ) ;
+
+    while( active > 0 )
+    {
+        pthread_cond_wait( &idlecond, &qlock ) ;
+    } ;
+
+    LIST_WALK(  head,
+                job,
+                next,
+
+                free( job->path ) ;
+                free( job ) ;
+             )
+
+    head = NULL ;
+    tail = NULL ;
+
+    pthread_mutex_unlock( &qlock ) ;
+}
+
+
+/**********************************************************************
+ */
+
@@ -0,0 +1,49 @@
+
+/*
+ * Include file wrapprefetch.h
+ *
+ * $Id$
+ *
+ * Speculative preprocessing of the local headers a file
+ * includes, in background threads, before the compiler asks
+ * for them.
+ */
+
+
+#ifndef __WRAPPREFETCH_H
+#  define __WRAPPREFETCH_H
+
+/**********************************************************************
+ */
+
+/* WRAP_OPEN_PREFETCH=0 turns prefetching off, any other number
+ * sets the number of worker threads
+ */
+#define WRAPPREFETCH_ENV        "WRAP_OPEN_PREFETCH"
+
+#define WRAPPREFETCH_DEFAULT    2
+
+/* Called from a worker thread with the absolute path of a
+ * header which should be processed
+ */
+typedef void ( *wrapprefetch_fn_t )( char *path ) ;
+
+
+/**********************************************************************
+ */
+
+extern int  wrapprefetch_init( wrapprefetch_fn_t fetch ) ;
+
+extern int  wrapprefetch_start( wrapprefetch_fn_t fetch, int n ) ;
+
+extern void wrapprefetch_add( char *path ) ;
+
+extern void wrapprefetch_wait() ;
+
+extern void wrapprefetch_scan( char *includer, int fd ) ;
+
+extern void wrapprefetch_stop() ;
+
+
+#endif /* __WRAPPREFETCH_H */
+
@@ -0,0 +1,319 @@
+/*
+ * wrapprepass.c
+ *
+ * Process the sources on a gccwrap command line before the
+ * compiler is started.
+ *
+ * The driver compiles its sources one after another and each
+ * cc1 runs the command chain on a file only when it opens it,
+ * so a command line with many sources keeps one core busy.
+ * Here every source is queued on a pool of threads, one per
+ * core, and each processed file is scanned for the local
+ * headers it includes, which are queued in turn the same way
+ * wrap_open.so prefetches them.
+ *
+ * The results go into the build session.  When cc1 opens a
+ * file wrap_open.so finds it already published there, exactly
+ * as if another compiler in the session had processed it.
+ * Files are checked against the rules, sniffed and looked up
+ * in the cache first, just as wrap_open.so would.
+ *
+ * $Id$
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapchain.h"
+
+#include "wrapcache.h"
+
+#include "wrapsession.h"
+
+#include "wraprules.h"
+
+#include "wrapsniff.h"
+
+#include "wrapprefetch.h"
+
+#include "wrapprepass.h"
+
+
+/**********************************************************************
+ */
+
+static wrapchain_t *chain = NULL ;
+
+static int use_rules = FALSE ;
+
+static int use_sniff = FALSE ;
+
+
+/**********************************************************************
+ */
+
+/* Would wrap_open.so process the file at rp ?
+ */
+static int wanted( char *rp )
+{
+    int len = strlen( rp ) ;
+
+    int state = WRAPRULES_NOMATCH ;
+
+    /* the same extension filter wrap_open.so applies, so .def
+     * and X-macro files are left alone here too
+     */
+    if( ! wraprules_source( rp, len, use_rules ) )
+    {
+        return FALSE ;
+    }
+
+    if( use_rules )
+    {
+        state = wraprules_location( rp, len ) ;
+    }
+
+    if( state == WRAPRULES_NOMATCH )
+    {
+        state = ( strncmp( rp, "/usr/", 5 ) == 0 ) ? WRAPRULES_EXCLUDE : WRAPRULES_INCLUDE ;
+    }
+
+    return ( state == WRAPRULES_INCLUDE ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Queue the headers the file at path includes, reading it from
+ * the file named by contents.  Quoted includes are resolved
+ * against path, so a cached copy is scanned as the source.
+ */
+static void scan_file( char *path, char *contents )
+{
+    int fd = open( contents, O_RDONLY | O_CLOEXEC ) ;
+
+    if( fd != -1 )
+    {
+        wrapprefetch_scan( path, fd ) ;
+
+        close( fd ) ;
+    }
+}
+
+
+/**********************************************************************
+ */
+
+/* Called from a worker for each source and header
+ */
+static void prepass_fetch( char *path )
+{
+    char rp[PATH_MAX] ;
+
+    char cachename[ wrapcache_pathlen() ] ;
+
+    struct stat st ;
+
+    wrapcache_key_t key ;
+
+    wrapsession_slot_t *slot = NULL ;
+
+    int havekey = FALSE ;
+
+    int status = 0 ;
+
+    int fd = -1 ;
+
+    if( ( realpath( path, rp ) == NULL ) || ! wanted( rp ) || ( stat( rp, &st ) != 0 ) )
+    {
+        return ;
+    }
+
+    /* nothing to do, but it may include something that needs
+     * processing
+     */
+
+    if( use_sniff && ! wrapsniff_needed( rp, &st ) )
+    {
+        SJGF( "%s as it is", rp ) ;
+
+        scan_file( rp, rp ) ;
+
+        return ;
+    }
+
+    /* the compiler will use a cached copy directly
+     */
+
+    if( wrapcache_key( rp, &key ) == 0 )
+    {
+        havekey = TRUE ;
+
+        if( wrapcache_lookup( &key, cachename ) == 0 )
+        {
+            SJGF( "%s cached", rp ) ;
+
+            scan_file( rp, cachename ) ;
+
+            return ;
+        }
+    }
+
+    if( wrapsession_claim( rp, &st, &slot ) != WRAPSESSION_OWNER )
+    {
+        /* done, or being done, by someone else
+         */
+
+        return ;
+    }
+
+    fd = memfd_create( "wrapprepass", MFD_CLOEXEC ) ;
+
+    if( fd == -1 )
+    {
+        goto err_exit ;
+    }
+
+    status = wrapchain_run( chain, rp, fd ) ;
+
+    if( status == 0 )
+    {
+        if( havekey )
+        {
+            wrapcache_store( &key, fd ) ;
+        }
+
+        wrapsession_publish( slot, fd ) ;
+
+        SJGF( "%s published", rp ) ;
+    }
+
+    /* the output says what it includes, the scan reads it
+     * through its own mapping
+     */
+
+    if( status != -1 )
+    {
+        wrapprefetch_scan( rp, fd ) ;
+    }
+
+    close( fd ) ;
+
+err_exit:
+
+    wrapsession_fail( slot ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Process the sources in wa, and what they include, into the
+ * session and wait for them all to be done
+ *
+ * returns 0 if the pre-pass ran
+ */
+int wrapprepass_run( char *commandstr, wrapargs_t *wa )
+{
+    char *commandlist = NULL ;
+    char *p = NULL ;
+
+    int n = 0 ;
+    int i = 0 ;
+
+    if( wa->nsources < WRAPPREPASS_MINSOURCES )
+    {
+        return -1 ;
+    }
+
+    p = getenv( WRAPPREPASS_ENV ) ;
+
+    n = ( ( p != NULL ) && ( *p != 0 ) ) ? atoi( p ) : (int)sysconf( _SC_NPROCESSORS_ONLN ) ;
+
+    if( n <= 0 )
+    {
+        return -1 ;
+    }
+
+    /* the results have nowhere to go without a session
+     */
+
+    if( getenv( WRAPSESSION_ENV ) == NULL )
+    {
+        return -1 ;
+    }
+
+    /* the chain wants a double nul terminated list
+     */
+
+    commandlist = (char *)calloc( 1, strlen( commandstr ) + 2 ) ;
+
+    if( commandlist == NULL )
+    {
+        return -1 ;
+    }
+
+    for( p = commandstr, i = 0 ; *p != 0 ; p++, i++ )
+    {
+        commandlist[i] = ( *p == ',' ) ? 0 : *p ;
+    }
+
+    chain = wrapchain_new( commandlist ) ;
+
+    free( commandlist ) ;
+
+    if( chain == NULL )
+    {
+        return -1 ;
+    }
+
+    wrapcache_init( chain ) ;
+
+    use_sniff = ( wrapsniff_init( chain ) == 0 ) ;
+
+    use_rules = ( getenv( WRAPRULES_FD_ENV ) != NULL ) && ( wraprules_attach( FALSE ) == 0 ) ;
+
+    if( wrapprefetch_start( prepass_fetch, n ) != 0 )
+    {
+        return -1 ;
+    }
+
+    SJGF( "pre-pass of %d sources on %d threads", wa->nsources, n ) ;
+
+    for( i = 0 ; i < wa->argc ; i++ )
+    {
+        if( wa->kinds[i] == WRAPARGS_SOURCE )
+        {
+            wrapprefetch_add( wa->argv[i] ) ;
+        }
+    }
+
+    wrapprefetch_wait() ;
+
+    wrapprefetch_stop() ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
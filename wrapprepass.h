@@ -0,0 +1,39 @@
+
+/*
+ * Include file wrapprepass.h
+ *
+ * $Id$
+ *
+ * Processes every source on a gccwrap command line, and the
+ * local headers they include, in parallel before the compiler
+ * is started.
+ */
+
+
+#ifndef __WRAPPREPASS_H
+#  define __WRAPPREPASS_H
+
+#include "wrapargs.h"
+
+/**********************************************************************
+ */
+
+/* WRAP_OPEN_PREPASS=0 turns the pre-pass off, any other number
+ * sets the number of threads, by default one per online CPU
+ */
+#define WRAPPREPASS_ENV         "WRAP_OPEN_PREPASS"
+
+/* how many sources there must be before it is worth it, a
+ * single source gets the same from the prefetch in wrap_open.so
+ */
+#define WRAPPREPASS_MINSOURCES  2
+
+
+/**********************************************************************
+ */
+
+extern int  wrapprepass_run( char *commandstr, wrapargs_t *wa ) ;
+
+
+#endif /* __WRAPPREPASS_H */
+
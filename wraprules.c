@@ -0,0 +1,1311 @@
+
+/*
+ * wraprules.c
+ *
+ * Compile the rules file ( see wraprules.h ) into a flat image
+ * and match paths against it.
+ *
+ * The image holds :
+ *
+ *   a trie of every prefix rule
+ *   a trie of every ext rule, built from the reversed strings
+ *     so it can be walked backwards from the end of a path
+ *   a table of glob rules
+ *   a table of marker rules
+ *
+ * Everything in the image is addressed by offsets from its start
+ * so it can be mapped anywhere.  gccwrap builds it once in a
+ * memfd and every interposer below it maps the same pages.
+ *
+ * Matching a path never allocates.  Marker rules need to look
+ * at the file system, so their answers are cached per directory.
+ *
+ * $Id$
+ */
+
+/* for memfd_create()
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wraprules.h"
+
+#include "wraphash.h"
+
+
+/**********************************************************************
+ */
+
+#define WRAPRULES_MAGIC     0x4c525257      /* "WRRL" */
+
+#define WRAPRULES_MAXLINE   4096
+
+
+struct wraprules_hdr_s ;
+
+struct wraprules_hdr_s {
+    uint32_t    magic ;
+    uint32_t    size ;
+    uint32_t    nrules ;
+    uint32_t    verdicts ;
+    uint32_t    prefixes ;
+    uint32_t    suffixes ;
+    uint32_t    nglobs ;
+    uint32_t    globs ;
+    uint32_t    nmarkers ;
+    uint32_t    markers ;
+    } ;
+
+typedef struct wraprules_hdr_s wraprules_hdr_t ;
+
+
+/* A trie node is followed by its edges, sorted by character
+ */
+struct wraprules_node_s ;
+
+struct wraprules_node_s {
+    int32_t     rule ;
+    uint32_t    nedges ;
+    } ;
+
+typedef struct wraprules_node_s wraprules_node_t ;
+
+
+struct wraprules_edge_s ;
+
+struct wraprules_edge_s {
+    uint32_t    c ;
+    uint32_t    child ;
+    } ;
+
+typedef struct wraprules_edge_s wraprules_edge_t ;
+
+
+/* glob and marker rules
+ */
+struct wraprules_pat_s ;
+
+struct wraprules_pat_s {
+    int32_t     rule ;
+    uint32_t    str ;
+    } ;
+
+typedef struct wraprules_pat_s wraprules_pat_t ;
+
+
+#define IMG_AT( _type, _off )   ( (_type *)( image + (_off) ) )
+
+
+static char *image = NULL ;
+
+static wraprules_hdr_t *hdr = NULL ;
+
+/* guards the marker cache further down
+ */
+static pthread_mutex_t marklock = PTHREAD_MUTEX_INITIALIZER ;
+
+
+/**********************************************************************
+ */
+
+/* While compiling, the tries are ordinary linked nodes
+ */
+DEF_LISTNODE(   tnode,
+                int                  rule ;
+                unsigned char        c ;
+                struct tnode_s      *kids ;
+            )
+
+
+DEF_LISTNODE(   pat,
+                int          rule ;
+                char        *str ;
+            )
+
+
+struct build_s ;
+
+struct build_s {
+    char            *buf ;
+    uint32_t         len ;
+    uint32_t         cap ;
+    int              nrules ;
+    unsigned char   *verdicts ;
+    tnode_t         *prefixes ;
+    tnode_t         *suffixes ;
+    pat_t           *globs ;
+    pat_t           *markers ;
+    int              nglobs ;
+    int              nmarkers ;
+    } ;
+
+typedef struct build_s build_t ;
+
+
+/**********************************************************************
+ */
+
+static tnode_t *new_tnode( unsigned char c )
+{
+    tnode_t *tn = (tnode_t *)calloc( 1, sizeof( tnode_t ) ) ;
+
+    if( tn != NULL )
+    {
+        tn->rule = -1 ;
+        tn->c = c ;
+    }
+
+    return tn ;
+}
+
+
+/**********************************************************************
+ */
+
+/* add a string to a trie, backwards if reverse is set
+ */
+static int tnode_add( tnode_t **rootp, char *s, int reverse, int rule )
+{
+    tnode_t *tn = NULL ;
+    tnode_t **pp = NULL ;
+
+    int len = strlen( s ) ;
+
+    int i = 0 ;
+
+    unsigned char c = 0 ;
+
+    if( *rootp == NULL )
+    {
+        *rootp = new_tnode( 0 ) ;
+
+        if( *rootp == NULL )
+        {
+            return -1 ;
+        }
+    }
+
+    tn = *rootp ;
+
+    for( i = 0 ; i < len ; i++ )
+    {
+        c = (unsigned char)( reverse ? s[len-1-i] : s[i] ) ;
+
+        /* children are kept sorted
+         */
+
+        pp = &( tn->kids ) ;
+
+        while( ( *pp != NULL ) && ( (*pp)->c < c ) )
+        {
+            pp = &( (*pp)->next ) ;
+        } ;
+
+        if( ( *pp == NULL ) || ( (*pp)->c != c ) )
+        {
+            tnode_t *nn = new_tnode( c ) ;
+
+            if( nn == NULL )
+            {
+                return -1 ;
+            }
+
+            nn->next = *pp ;
+            *pp = nn ;
+        }
+
+        tn = *pp ;
+    }
+
+    /* the earliest rule wins
+     */
+
+    if( tn->rule == -1 )
+    {
+        tn->rule = rule ;
+    }
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+static void tnode_free( tnode_t *tn )
+{
+    tnode_t *kid = NULL ;
+    tnode_t *next = NULL ;
+
+    if( tn == NULL )
+    {
+        return ;
+    }
+
+    LIST_WALK(  tn->kids,
+                kid,
+                next,
+
+                tnode_free( kid ) ;
+             )
+
+    free( tn ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* reserve zeroed, 4 byte aligned space in the image
+ *
+ * returns its offset or 0 on failure
+ */
+static uint32_t img_reserve( build_t *b, uint32_t n )
+{
+    uint32_t off = b->len ;
+
+    n = ( n + 3 ) & ~(uint32_t)3 ;
+
+    while( b->len + n > b->cap )
+    {
+        uint32_t newcap = ( b->cap == 0 ) ? 4096 : b->cap * 2 ;
+
+        char *newbuf = (char *)realloc( b->buf, newcap ) ;
+
+        if( newbuf == NULL )
+        {
+            return 0 ;
+        }
+
+        memset( newbuf + b->cap, 0, newcap - b->cap ) ;
+
+        b->buf = newbuf ;
+        b->cap = newcap ;
+    } ;
+
+    b->len += n ;
+
+    return off ;
+}
+
+
+/**********************************************************************
+ */
+
+static uint32_t img_string( build_t *b, char *s )
+{
+    uint32_t off = img_reserve( b, strlen( s ) + 1 ) ;
+
+    if( off != 0 )
+    {
+        strcpy( b->buf + off, s ) ;
+    }
+
+    return off ;
+}
+
+
+/**********************************************************************
+ */
+
+/* returns the offset of the serialised node or 0 on failure
+ */
+static uint32_t img_trie( build_t *b, tnode_t *tn )
+{
+    tnode_t *kid = NULL ;
+
+    uint32_t off = 0 ;
+    uint32_t child = 0 ;
+    uint32_t n = 0 ;
+    uint32_t i = 0 ;
+
+    for( kid = tn->kids ; kid != NULL ; kid = kid->next )
+    {
+        n++ ;
+    }
+
+    off = img_reserve( b, sizeof( wraprules_node_t ) + n * sizeof( wraprules_edge_t ) ) ;
+
+    if( off == 0 )
+    {
+        return 0 ;
+    }
+
+    ( (wraprules_node_t *)( b->buf + off ) )->rule = tn->rule ;
+    ( (wraprules_node_t *)( b->buf + off ) )->nedges = n ;
+
+    for( kid = tn->kids, i = 0 ; kid != NULL ; kid = kid->next, i++ )
+    {
+        child = img_trie( b, kid ) ;
+
+        if( child == 0 )
+        {
+            return 0 ;
+        }
+
+        /* b->buf may have moved
+         */
+
+        wraprules_edge_t *e = (wraprules_edge_t *)( b->buf + off + sizeof( wraprules_node_t ) ) + i ;
+
+        e->c = kid->c ;
+        e->child = child ;
+    }
+
+    return off ;
+}
+
+
+/**********************************************************************
+ */
+
+static uint32_t img_pats( build_t *b, pat_t *list, int n )
+{
+    uint32_t off = 0 ;
+    uint32_t str = 0 ;
+
+    int i = 0 ;
+
+    off = img_reserve( b, n * sizeof( wraprules_pat_t ) + 4 ) ;
+
+    if( off == 0 )
+    {
+        return 0 ;
+    }
+
+    /* the lists were built backwards
+     */
+
+    for( i = n-1 ; list != NULL ; list = list->next, i-- )
+    {
+        str = img_string( b, list->str ) ;
+
+        if( str == 0 )
+        {
+            return 0 ;
+        }
+
+        ( (wraprules_pat_t *)( b->buf + off ) + i )->rule = list->rule ;
+        ( (wraprules_pat_t *)( b->buf + off ) + i )->str = str ;
+    }
+
+    return off ;
+}
+
+
+/**********************************************************************
+ */
+
+static int add_pat( pat_t **listp, int *np, int rule, char *s )
+{
+    pat_t *pt = (pat_t *)malloc( sizeof( pat_t ) ) ;
+
+    if( pt == NULL )
+    {
+        return -1 ;
+    }
+
+    pt->rule = rule ;
+    pt->str = strdup( s ) ;
+
+    if( pt->str == NULL )
+    {
+        free( pt ) ;
+
+        return -1 ;
+    }
+
+    pt->next = *listp ;
+    *listp = pt ;
+
+    (*np)++ ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+static void free_pats( pat_t *list )
+{
+    pat_t *pt = NULL ;
+    pat_t *next = NULL ;
+
+    LIST_WALK(  list,
+                pt,
+                next,
+
+                free( pt->str ) ;
+                free( pt ) ;
+             )
+}
+
+
+/**********************************************************************
+ */
+
+/* Parse one line of the rules file
+ *
+ * returns 0 on success
+ */
+static int parse_line( build_t *b, char *line, char *rulesfile, int lineno )
+{
+    char *words[3] ;
+
+    char *save = NULL ;
+    char *arg = NULL ;
+
+    int verdict = 0 ;
+
+    int retv = 0 ;
+
+    words[0] = strtok_r( line, " \t\r\n", &save ) ;
+
+    if( ( words[0] == NULL ) || ( words[0][0] == '#' ) )
+    {
+        return 0 ;
+    }
+
+    words[1] = strtok_r( NULL, " \t\r\n", &save ) ;
+
+    if( strcmp( words[0], "include" ) == 0 )
+    {
+        verdict = WRAPRULES_INCLUDE ;
+    }
+    else if( strcmp( words[0], "exclude" ) == 0 )
+    {
+        verdict = WRAPRULES_EXCLUDE ;
+    }
+    else
+    {
+        errorf( "%s:%d: expected include or exclude\n", rulesfile, lineno ) ;
+
+        return -1 ;
+    }
+
+    if(    ( words[1] == NULL )
+        || (    ( strcmp( words[1], "ext" ) != 0 )
+             && ( strcmp( words[1], "prefix" ) != 0 )
+             && ( strcmp( words[1], "glob" ) != 0 )
+             && ( strcmp( words[1], "marker" ) != 0 )
+           )
+      )
+    {
+        errorf( "%s:%d: expected ext, prefix, glob or marker\n", rulesfile, lineno ) ;
+
+        return -1 ;
+    }
+
+    arg = strtok_r( NULL, " \t\r\n", &save ) ;
+
+    if( arg == NULL )
+    {
+        errorf( "%s:%d: nothing to %s\n", rulesfile, lineno, words[0] ) ;
+
+        return -1 ;
+    }
+
+    /* every argument is a rule of its own
+     */
+
+    while( ( arg != NULL ) && ( retv == 0 ) )
+    {
+        unsigned char *v = (unsigned char *)realloc( b->verdicts, b->nrules + 1 ) ;
+
+        if( v == NULL )
+        {
+            return -1 ;
+        }
+
+        b->verdicts = v ;
+        b->verdicts[ b->nrules ] = verdict ;
+
+        switch( words[1][0] )
+        {
+            case 'e' :
+                retv = tnode_add( &( b->suffixes ), arg, TRUE, b->nrules ) ;
+                break ;
+
+            case 'p' :
+                retv = tnode_add( &( b->prefixes ), arg, FALSE, b->nrules ) ;
+                break ;
+
+            case 'g' :
+                retv = add_pat( &( b->globs ), &( b->nglobs ), b->nrules, arg ) ;
+                break ;
+
+            default :
+                if( strchr( arg, '/' ) != NULL )
+                {
+                    errorf( "%s:%d: a marker is a file name, not a path\n", rulesfile, lineno ) ;
+
+                    return -1 ;
+                }
+
+                retv = add_pat( &( b->markers ), &( b->nmarkers ), b->nrules, arg ) ;
+                break ;
+        }
+
+        b->nrules++ ;
+
+        arg = strtok_r( NULL, " \t\r\n", &save ) ;
+    } ;
+
+    return retv ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Compile a rules file into a memfd
+ *
+ * returns the descriptor, which is left open across exec(),
+ * or -1 on failure
+ */
+int wraprules_compile( char *rulesfile )
+{
+    build_t b ;
+
+    wraprules_hdr_t h ;
+
+    char line[WRAPRULES_MAXLINE] ;
+
+    FILE *fp = NULL ;
+
+    int lineno = 0 ;
+
+    int fd = -1 ;
+
+    uint32_t off = 0 ;
+
+    memset( &b, 0, sizeof( b ) ) ;
+    memset( &h, 0, sizeof( h ) ) ;
+
+    fp = fopen( rulesfile, "r" ) ;
+
+    if( fp == NULL )
+    {
+        errorf( "Could not read rules from %s\n", rulesfile ) ;
+
+        return -1 ;
+    }
+
+    while( fgets( line, sizeof( line ), fp ) != NULL )
+    {
+        lineno++ ;
+
+        if( parse_line( &b, line, rulesfile, lineno ) != 0 )
+        {
+            goto err_exit ;
+        }
+    } ;
+
+    /* lay out the image, the header goes first
+     */
+
+    img_reserve( &b, sizeof( h ) ) ;
+
+    if( b.len == 0 )
+    {
+        goto err_exit ;
+    }
+
+    h.magic = WRAPRULES_MAGIC ;
+    h.nrules = b.nrules ;
+
+    if( b.nrules > 0 )
+    {
+        h.verdicts = img_reserve( &b, b.nrules ) ;
+
+        if( h.verdicts == 0 )
+        {
+            goto err_exit ;
+        }
+
+        memcpy( b.buf + h.verdicts, b.verdicts, b.nrules ) ;
+    }
+
+    if( b.prefixes != NULL )
+    {
+        h.prefixes = img_trie( &b, b.prefixes ) ;
+
+        if( h.prefixes == 0 )
+        {
+            goto err_exit ;
+        }
+    }
+
+    if( b.suffixes != NULL )
+    {
+        h.suffixes = img_trie( &b, b.suffixes ) ;
+
+        if( h.suffixes == 0 )
+        {
+            goto err_exit ;
+        }
+    }
+
+    h.nglobs = b.nglobs ;
+
+    if( ( b.nglobs > 0 ) && ( ( h.globs = img_pats( &b, b.globs, b.nglobs ) ) == 0 ) )
+    {
+        goto err_exit ;
+    }
+
+    h.nmarkers = b.nmarkers ;
+
+    if( ( b.nmarkers > 0 ) && ( ( h.markers = img_pats( &b, b.markers, b.nmarkers ) ) == 0 ) )
+    {
+        goto err_exit ;
+    }
+
+    h.size = b.len ;
+
+    memcpy( b.buf, &h, sizeof( h ) ) ;
+
+    fd = memfd_create( "gccwrap-rules", 0 ) ;
+
+    if( fd != -1 )
+    {
+        for( off = 0 ; off < b.len ; )
+        {
+            ssize_t n = write( fd, b.buf + off, b.len - off ) ;
+
+            if( n <= 0 )
+            {
+                close( fd ) ;
+
+                fd = -1 ;
+
+                break ;
+            }
+
+            off += n ;
+        } ;
+    }
+
+    SJGF( "Compiled %d rules from %s into %u bytes", b.nrules, rulesfile, b.len ) ;
+
+err_exit:
+
+    fclose( fp ) ;
+
+    free( b.buf ) ;
+    free( b.verdicts ) ;
+
+    tnode_free( b.prefixes ) ;
+    tnode_free( b.suffixes ) ;
+
+    free_pats( b.globs ) ;
+    free_pats( b.markers ) ;
+
+    return fd ;
+}
+
+
+/**********************************************************************
+ */
+
+/* returns 0 if fd holds a valid image, which is then mapped
+ */
+static int map_image( int fd )
+{
+    struct stat st ;
+
+    wraprules_hdr_t h ;
+
+    if( ( fstat( fd, &st ) != 0 ) || ! S_ISREG( st.st_mode ) )
+    {
+        return -1 ;
+    }
+
+    if( pread( fd, &h, sizeof( h ), 0 ) != sizeof( h ) )
+    {
+        return -1 ;
+    }
+
+    if( ( h.magic != WRAPRULES_MAGIC ) || ( h.size != (uint64_t)st.st_size ) )
+    {
+        return -1 ;
+    }
+
+    image = (char *)mmap( NULL, h.size, PROT_READ, MAP_SHARED, fd, 0 ) ;
+
+    if( image == MAP_FAILED )
+    {
+        image = NULL ;
+
+        return -1 ;
+    }
+
+    hdr = (wraprules_hdr_t *)image ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+static void prefork()
+{
+    pthread_mutex_lock( &marklock ) ;
+}
+
+
+static void postfork()
+{
+    pthread_mutex_unlock( &marklock ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Map the rules gccwrap compiled for us, or if compile is set
+ * and we were started some other way compile them here
+ *
+ * returns 0 if there are rules to use
+ */
+int wraprules_attach( int compile )
+{
+    char *p = NULL ;
+    char *end = NULL ;
+
+    int fd = -1 ;
+
+    p = getenv( WRAPRULES_FD_ENV ) ;
+
+    if( ( p != NULL ) && ( *p != 0 ) )
+    {
+        fd = (int)strtol( p, &end, 10 ) ;
+
+        if( ( *end == 0 ) && ( fd >= 0 ) && ( map_image( fd ) == 0 ) )
+        {
+            SJGF( "Mapped rules from %d", fd ) ;
+
+            pthread_atfork( prefork, postfork, postfork ) ;
+
+            return 0 ;
+        }
+    }
+
+    p = getenv( WRAPRULES_ENV ) ;
+
+    if( ( ! compile ) || ( p == NULL ) || ( *p == 0 ) )
+    {
+        return -1 ;
+    }
+
+    fd = wraprules_compile( p ) ;
+
+    if( fd == -1 )
+    {
+        return -1 ;
+    }
+
+    if( map_image( fd ) != 0 )
+    {
+        close( fd ) ;
+
+        return -1 ;
+    }
+
+    close( fd ) ;
+
+    pthread_atfork( prefork, postfork, postfork ) ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Walk a trie along path, forwards or backwards
+ *
+ * returns the earliest rule on the way or -1
+ */
+static int trie_walk( uint32_t off, const char *path, int len, int reverse )
+{
+    wraprules_node_t *tn = NULL ;
+    wraprules_edge_t *e = NULL ;
+
+    int best = -1 ;
+
+    int i = 0 ;
+
+    unsigned char c = 0 ;
+
+    uint32_t lo = 0 ;
+    uint32_t hi = 0 ;
+    uint32_t mid = 0 ;
+
+    if( off == 0 )
+    {
+        return -1 ;
+    }
+
+    tn = IMG_AT( wraprules_node_t, off ) ;
+
+    for( i = 0 ; i < len ; i++ )
+    {
+        c = (unsigned char)( reverse ? path[len-1-i] : path[i] ) ;
+
+        e = (wraprules_edge_t *)( tn + 1 ) ;
+
+        lo = 0 ;
+        hi = tn->nedges ;
+
+        while( lo < hi )
+        {
+            mid = ( lo + hi ) / 2 ;
+
+            if( e[mid].c < c )
+            {
+                lo = mid + 1 ;
+            }
+            else
+            {
+                hi = mid ;
+            }
+        } ;
+
+        if( ( lo == tn->nedges ) || ( e[lo].c != c ) )
+        {
+            break ;
+        }
+
+        tn = IMG_AT( wraprules_node_t, e[lo].child ) ;
+
+        if( ( tn->rule != -1 ) && ( ( best == -1 ) || ( tn->rule < best ) ) )
+        {
+            best = tn->rule ;
+        }
+    }
+
+    return best ;
+}
+
+
+/**********************************************************************
+ */
+
+/* * matches anything at all, including '/', and ? any one char
+ */
+static int glob_match( const char *pat, const char *s )
+{
+    const char *star = NULL ;
+    const char *retry = NULL ;
+
+    while( *s != 0 )
+    {
+        if( *pat == '*' )
+        {
+            star = ++pat ;
+            retry = s ;
+
+            continue ;
+        }
+
+        if( ( *pat == '?' ) || ( *pat == *s ) )
+        {
+            pat++ ;
+            s++ ;
+
+            continue ;
+        }
+
+        if( star == NULL )
+        {
+            return FALSE ;
+        }
+
+        pat = star ;
+        s = ++retry ;
+    } ;
+
+    while( *pat == '*' )
+    {
+        pat++ ;
+    } ;
+
+    return ( *pat == 0 ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Which directories have a marker in them or above them
+ */
+
+struct markent_s ;
+
+struct markent_s {
+    uint64_t    key ;
+    int         found ;
+    } ;
+
+typedef struct markent_s markent_t ;
+
+
+static wraphash_t markcache = WRAPHASH_INIT( markent_t ) ;
+
+
+/* must be called with marklock held
+ */
+static void markcache_put( uint64_t key, int found )
+{
+    markent_t *e = (markent_t *)wraphash_find( &markcache, key ) ;
+
+    markent_t ent ;
+
+    if( e != NULL )
+    {
+        e->found = found ;
+
+        return ;
+    }
+
+    memset( &ent, 0, sizeof( ent ) ) ;
+
+    ent.key = key ;
+    ent.found = found ;
+
+    wraphash_add( &markcache, &ent ) ;
+}
+
+
+/* must be called with marklock held
+ *
+ * returns -1 if key is not cached
+ */
+static int markcache_get( uint64_t key )
+{
+    markent_t *e = (markent_t *)wraphash_find( &markcache, key ) ;
+
+    return ( e != NULL ) ? e->found : -1 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* is the marker in dir or any directory above it ?
+ *
+ * must be called with marklock held
+ */
+static int marker_in( int m, char *marker, const char *dir, int dirlen )
+{
+    char path[PATH_MAX] ;
+
+    uint64_t key = WRAPHASH_KEY( wraphash_fnv( dir, dirlen, WRAPHASH_FNV_BASIS ^ (uint64_t)m ) ) ;
+
+    int found = FALSE ;
+
+    int i = 0 ;
+
+    found = markcache_get( key ) ;
+
+    if( found != -1 )
+    {
+        return found ;
+    }
+
+    found = FALSE ;
+
+    if( snprintf( path, PATH_MAX, "%.*s/%s", dirlen, dir, marker ) < PATH_MAX )
+    {
+        found = ( access( path, F_OK ) == 0 ) ;
+    }
+
+    if( ( ! found ) && ( dirlen > 0 ) )
+    {
+        /* on to the parent
+         */
+
+        i = dirlen - 1 ;
+
+        while( ( i > 0 ) && ( dir[i] != '/' ) )
+        {
+            i-- ;
+        } ;
+
+        found = marker_in( m, marker, dir, i ) ;
+    }
+
+    markcache_put( key, found ) ;
+
+    return found ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Should a file with this name count as source ?
+ */
+int wraprules_ext( const char *path, int len )
+{
+    int rule = -1 ;
+
+    if( hdr == NULL )
+    {
+        return WRAPRULES_NOMATCH ;
+    }
+
+    rule = trie_walk( hdr->suffixes, path, len, TRUE ) ;
+
+    if( rule == -1 )
+    {
+        return WRAPRULES_NOMATCH ;
+    }
+
+    return IMG_AT( unsigned char, hdr->verdicts )[rule] ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Should a file at this canonical path be intercepted ?
+ */
+int wraprules_location( const char *path, int len )
+{
+    wraprules_pat_t *pt = NULL ;
+
+    int best = -1 ;
+
+    int dirlen = 0 ;
+
+    uint32_t i = 0 ;
+
+    if( hdr == NULL )
+    {
+        return WRAPRULES_NOMATCH ;
+    }
+
+    best = trie_walk( hdr->prefixes, path, len, FALSE ) ;
+
+    /* only earlier rules than the best so far matter, and
+     * the tables are in rule order
+     */
+
+    pt = IMG_AT( wraprules_pat_t, hdr->globs ) ;
+
+    for( i = 0 ; i < hdr->nglobs ; i++ )
+    {
+        if( ( best != -1 ) && ( pt[i].rule > best ) )
+        {
+            break ;
+        }
+
+        if( glob_match( IMG_AT( char, pt[i].str ), path ) )
+        {
+            best = pt[i].rule ;
+
+            break ;
+        }
+    }
+
+    pt = IMG_AT( wraprules_pat_t, hdr->markers ) ;
+
+    dirlen = len ;
+
+    while( ( dirlen > 0 ) && ( path[dirlen-1] != '/' ) )
+    {
+        dirlen-- ;
+    } ;
+
+    if( dirlen > 0 )
+    {
+        /* no trailing slash
+         */
+
+        dirlen-- ;
+    }
+
+    for( i = 0 ; i < hdr->nmarkers ; i++ )
+    {
+        if( ( best != -1 ) && ( pt[i].rule > best ) )
+        {
+            break ;
+        }
+
+        pthread_mutex_lock( &marklock ) ;
+
+        int found = marker_in( (int)i, IMG_AT( char, pt[i].str ), path, dirlen ) ;
+
+        pthread_mutex_unlock( &marklock ) ;
+
+        if( found )
+        {
+            best = pt[i].rule ;
+
+            break ;
+        }
+    }
+
+    if( best == -1 )
+    {
+        return WRAPRULES_NOMATCH ;
+    }
+
+    return IMG_AT( unsigned char, hdr->verdicts )[best] ;
+}
+
+
+/**********************************************************************
+ */
+
+/* These macros just make the code easier to manage
+ */
+
+#define cmp2(a,b)       ( ( fn[len-3] == (a) ) && ( fn[len-2] == (b) ) )
+
+#define cmp3(a,b,c)     ( ( fn[len-3] == (a) ) && ( fn[len-2] == (b) ) && ( fn[len-1] == (c) ) )
+
+
+/* Would wrap_open.so process a file with this name ?  ext rules,
+ * when they are in use, come before the built in list of C-like
+ * extensions.  Shared by the interposer and the gccwrap pre-pass
+ * so the two always agree.
+ */
+int wraprules_source( const char *fn, int len, int use_rules )
+{
+    int retb = FALSE ;
+
+    if( use_rules )
+    {
+        retb = wraprules_ext( fn, len ) ;
+
+        if( retb != WRAPRULES_NOMATCH )
+        {
+            return ( retb == WRAPRULES_INCLUDE ) ;
+        }
+
+        retb = FALSE ;
+    }
+
+    if( len < 3 )
+        return FALSE ;
+
+    if(    ( fn[len-2] == '.' )
+        && (
+                ( fn[len-1] == 'c' )
+            ||  ( fn[len-1] == 'h' )
+            ||  ( fn[len-1] == 'm' )
+            ||  ( fn[len-1] == 'M' )
+            ||  ( fn[len-1] == 'C' )
+            ||  ( fn[len-1] == 'H' )
+           )
+       )
+    {
+        /* One of the standard single character extensions
+         * for C-like source files
+         *
+         *  .c
+         *  .h
+         *  .m
+         *  .M
+         *  .C
+         *  .H
+         */
+
+        return TRUE ;
+    }
+
+    if( len < 4 )
+        return FALSE ;
+
+    if(    ( fn[len-3] == '.' )
+        && (
+                cmp2( 'm', 'm' )
+             || cmp2( 'c', 'c' )
+             || cmp2( 'h', 'h' )
+             || cmp2( 'h', 'p' )
+           )
+       )
+    {
+        /* One of the standard two character extensions
+         * for C-like source files
+         *
+         *  .mm
+         *  ,cc
+         *  .hh
+         *  .hp
+         */
+
+        return TRUE ;
+    }
+
+    if( len < 5 )
+        return FALSE ;
+
+    if(    ( fn[len-4] == '.' )
+        && (
+                cmp3( 'c', 'x', 'x' )
+             || cmp3( 'c', 'p', 'p' )
+             || cmp3( 'C', 'P', 'P' )
+             || cmp3( 'c', '+', '+' )
+             || cmp3( 'h', 'x', 'x' )
+             || cmp3( 'h', 'p', 'p' )
+             || cmp3( 'H', 'P', 'P' )
+             || cmp3( 'h', '+', '+' )
+             || cmp3( 't', 'c', 'c' )
+             || cmp3( 'i', 'n', 'c' )
+           )
+       )
+    {
+        /* One of the standard three character extensions
+         * for C-like source files
+         *
+         *  .cxx
+         *  .cpp
+         *  .CPP
+         *  .c++
+         *  .hxx
+         *  .hpp
+         *  .HPP
+         *  .h++
+         *  .tcc
+         *  .inc
+         *
+         * Note : ".inc" is used by some programmers for files which
+         * are included as pseudo-templates.
+         */
+
+        return TRUE ;
+    }
+
+    // SJGF( "%s NOT recognised as source file", fn ) ;
+
+    return retb ;
+}
+
+
+/**********************************************************************
+ */
@@ -0,0 +1,59 @@
+
+/*
+ * Include file wraprules.h
+ *
+ * $Id$
+ *
+ * Rules deciding which files are intercepted, compiled into a
+ * flat image that every process can map.
+ */
+
+
+#ifndef __WRAPRULES_H
+#  define __WRAPRULES_H
+
+/**********************************************************************
+ */
+
+/* The rules file is named by WRAP_OPEN_RULES.  gccwrap compiles
+ * it into a memfd once and passes the descriptor on in
+ * WRAP_OPEN_RULES_FD so the interposers only have to map it.
+ *
+ * Each line of the file is one of :
+ *
+ *   include|exclude ext <.ext> ...
+ *   include|exclude prefix <dir/> ...
+ *   include|exclude glob <pattern> ...
+ *   include|exclude marker <filename> ...
+ *
+ * ext rules decide what counts as a source file, the others
+ * where it may live.  For each question the first matching rule
+ * wins, and with no match the built in behaviour applies.
+ */
+#define WRAPRULES_ENV           "WRAP_OPEN_RULES"
+
+#define WRAPRULES_FD_ENV        "WRAP_OPEN_RULES_FD"
+
+/* Results of wraprules_ext() and wraprules_location()
+ */
+#define WRAPRULES_NOMATCH       -1
+#define WRAPRULES_EXCLUDE       0
+#define WRAPRULES_INCLUDE       1
+
+
+/**********************************************************************
+ */
+
+extern int  wraprules_compile( char *rulesfile ) ;
+
+extern int  wraprules_attach( int compile ) ;
+
+extern int  wraprules_ext( const char *path, int len ) ;
+
+extern int  wraprules_location( const char *path, int len ) ;
+
+extern int  wraprules_source( const char *path, int len, int use_rules ) ;
+
+
+#endif /* __WRAPRULES_H */
+
@@ -0,0 +1,404 @@
+
+/*
+ * wrapserver.c
+ *
+ * Client side of the gccwrap-server protocol, plus the pieces
+ * shared with the server itself.
+ *
+ * A request costs one connect() and one round trip.  The
+ * processed file comes back as a memfd passed with SCM_RIGHTS.
+ *
+ * $Id$
+ */
+
+/* for struct ucred
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapserver.h"
+
+
+/**********************************************************************
+ */
+
+/* Fill in the path of the server socket
+ *
+ * returns 0 on success
+ */
+int wrapserver_path( char *path, int len )
+{
+    char *p = NULL ;
+
+    int n = 0 ;
+
+    p = getenv( WRAPSERVER_ENV ) ;
+
+    if( ( p != NULL ) && ( *p != 0 ) )
+    {
+        n = snprintf( path, len, "%s", p ) ;
+    }
+    else if( ( ( p = getenv( "XDG_RUNTIME_DIR" ) ) != NULL ) && ( *p != 0 ) )
+    {
+        n = snprintf( path, len, "%s/gccwrap.sock", p ) ;
+    }
+    else
+    {
+        n = snprintf( path, len, "/tmp/gccwrap-%d/gccwrap.sock", (int)getuid() ) ;
+    }
+
+    if( ( n < 0 ) || ( n >= len ) )
+    {
+        return -1 ;
+    }
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Make sure the directory holding the socket is there and that
+ * nobody else can put things in it.  It is created 0700 if it
+ * is missing, otherwise it must be a real directory belonging
+ * to us ( or to root, for a socket placed in /tmp itself ).
+ *
+ * returns 0 on success
+ */
+int wrapserver_mkdir( char *sockpath )
+{
+    char dir[PATH_MAX] ;
+
+    struct stat st ;
+
+    char *p = NULL ;
+
+    if( snprintf( dir, sizeof( dir ), "%s", sockpath ) >= (int)sizeof( dir ) )
+    {
+        return -1 ;
+    }
+
+    p = strrchr( dir, '/' ) ;
+
+    if( p == NULL )
+    {
+        return 0 ;
+    }
+
+    if( p == dir )
+    {
+        p++ ;
+    }
+
+    *p = 0 ;
+
+    if( mkdir( dir, 0700 ) == 0 )
+    {
+        return 0 ;
+    }
+
+    if( ( errno != EEXIST ) || ( lstat( dir, &st ) != 0 ) )
+    {
+        return -1 ;
+    }
+
+    if( ( ! S_ISDIR( st.st_mode ) ) || ( ( st.st_uid != getuid() ) && ( st.st_uid != 0 ) ) )
+    {
+        errno = EPERM ;
+
+        return -1 ;
+    }
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Is the other end of a connected socket running as us ?
+ */
+int wrapserver_peer_ok( int sock )
+{
+    struct ucred cred ;
+
+    socklen_t len = sizeof( cred ) ;
+
+    if( getsockopt( sock, SOL_SOCKET, SO_PEERCRED, &cred, &len ) != 0 )
+    {
+        return FALSE ;
+    }
+
+    return ( cred.uid == getuid() ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* write everything or fail
+ */
+static int send_all( int sock, struct iovec *iov, int iovcnt )
+{
+    ssize_t n = 0 ;
+
+    while( iovcnt > 0 )
+    {
+        n = writev( sock, iov, iovcnt ) ;
+
+        if( n < 0 )
+        {
+            if( errno == EINTR )
+            {
+                continue ;
+            }
+
+            return -1 ;
+        }
+
+        while( ( iovcnt > 0 ) && ( (size_t)n >= iov->iov_len ) )
+        {
+            n -= iov->iov_len ;
+
+            iov++ ;
+            iovcnt-- ;
+        } ;
+
+        if( iovcnt > 0 )
+        {
+            iov->iov_base = (char *)( iov->iov_base ) + n ;
+            iov->iov_len -= n ;
+        }
+    } ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Ask the server for the processed version of source
+ *
+ * returns a descriptor for the processed file, -1 if the server
+ * could not process it or WRAPSERVER_DOWN if there is no server
+ * to ask.
+ */
+int wrapserver_request( char *sockpath, char *commandstr, char *source )
+{
+    struct sockaddr_un addr ;
+
+    wrapserver_req_t req ;
+
+    struct iovec iov[4] ;
+
+    char cwd[PATH_MAX] ;
+
+    int sock = -1 ;
+
+    int fd = -1 ;
+
+    int32_t status = -1 ;
+
+    ssize_t n = 0 ;
+
+    if( strlen( sockpath ) >= sizeof( addr.sun_path ) )
+    {
+        return WRAPSERVER_DOWN ;
+    }
+
+    /* commands may depend on where they are run from, so the
+     * server keeps results apart by it
+     */
+
+    if( getcwd( cwd, sizeof( cwd ) ) == NULL )
+    {
+        return -1 ;
+    }
+
+    sock = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ;
+
+    if( sock == -1 )
+    {
+        return WRAPSERVER_DOWN ;
+    }
+
+    memset( &addr, 0, sizeof( addr ) ) ;
+
+    addr.sun_family = AF_UNIX ;
+
+    strcpy( addr.sun_path, sockpath ) ;
+
+    if( connect( sock, (struct sockaddr *)&addr, sizeof( addr ) ) != 0 )
+    {
+        SJGF( "No server at %s", sockpath ) ;
+
+        close( sock ) ;
+
+        return WRAPSERVER_DOWN ;
+    }
+
+    /* never hand source paths to, or take output from, a server
+     * belonging to somebody else
+     */
+    if( ! wrapserver_peer_ok( sock ) )
+    {
+        SJGF( "Server at %s is not ours", sockpath ) ;
+
+        close( sock ) ;
+
+        return WRAPSERVER_DOWN ;
+    }
+
+    req.magic = WRAPSERVER_MAGIC ;
+    req.cmdlen = strlen( commandstr ) ;
+    req.cwdlen = strlen( cwd ) ;
+    req.pathlen = strlen( source ) ;
+
+    iov[0].iov_base = &req ;
+    iov[0].iov_len = sizeof( req ) ;
+    iov[1].iov_base = commandstr ;
+    iov[1].iov_len = req.cmdlen ;
+    iov[2].iov_base = cwd ;
+    iov[2].iov_len = req.cwdlen ;
+    iov[3].iov_base = source ;
+    iov[3].iov_len = req.pathlen ;
+
+    if( send_all( sock, iov, 4 ) != 0 )
+    {
+        close( sock ) ;
+
+        return -1 ;
+    }
+
+    /* the reply, with the descriptor riding along
+     */
+
+    union {
+        char            buf[CMSG_SPACE( sizeof( int ) )] ;
+        struct cmsghdr  align ;
+        } ctrl ;
+
+    struct msghdr msg ;
+
+    struct cmsghdr *cmsg = NULL ;
+
+    memset( &msg, 0, sizeof( msg ) ) ;
+
+    iov[0].iov_base = &status ;
+    iov[0].iov_len = sizeof( status ) ;
+
+    msg.msg_iov = iov ;
+    msg.msg_iovlen = 1 ;
+    msg.msg_control = ctrl.buf ;
+    msg.msg_controllen = sizeof( ctrl.buf ) ;
+
+    do
+    {
+        n = recvmsg( sock, &msg, MSG_CMSG_CLOEXEC ) ;
+    }
+    while( ( n == -1 ) && ( errno == EINTR ) ) ;
+
+    close( sock ) ;
+
+    if( n != sizeof( status ) )
+    {
+        return -1 ;
+    }
+
+    for( cmsg = CMSG_FIRSTHDR( &msg ) ; cmsg != NULL ; cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+    {
+        if( ( cmsg->cmsg_level == SOL_SOCKET ) && ( cmsg->cmsg_type == SCM_RIGHTS ) )
+        {
+            memcpy( &fd, CMSG_DATA( cmsg ), sizeof( int ) ) ;
+        }
+    }
+
+    if( ( status != 0 ) && ( fd != -1 ) )
+    {
+        close( fd ) ;
+
+        fd = -1 ;
+    }
+
+    SJGF( "server status %d fd %d for %s", (int)status, fd, source ) ;
+
+    return fd ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Send a reply, with fd attached if it is not -1
+ */
+int wrapserver_send_fd( int sock, int32_t status, int fd )
+{
+    union {
+        char            buf[CMSG_SPACE( sizeof( int ) )] ;
+        struct cmsghdr  align ;
+        } ctrl ;
+
+    struct msghdr msg ;
+
+    struct iovec iov ;
+
+    struct cmsghdr *cmsg = NULL ;
+
+    ssize_t n = 0 ;
+
+    memset( &msg, 0, sizeof( msg ) ) ;
+
+    iov.iov_base = &status ;
+    iov.iov_len = sizeof( status ) ;
+
+    msg.msg_iov = &iov ;
+    msg.msg_iovlen = 1 ;
+
+    if( fd != -1 )
+    {
+        msg.msg_control = ctrl.buf ;
+        msg.msg_controllen = sizeof( ctrl.buf ) ;
+
+        cmsg = CMSG_FIRSTHDR( &msg ) ;
+
+        cmsg->cmsg_level = SOL_SOCKET ;
+        cmsg->cmsg_type = SCM_RIGHTS ;
+        cmsg->cmsg_len = CMSG_LEN( sizeof( int ) ) ;
+
+        memcpy( CMSG_DATA( cmsg ), &fd, sizeof( int ) ) ;
+    }
+
+    do
+    {
+        n = sendmsg( sock, &msg, MSG_NOSIGNAL ) ;
+    }
+    while( ( n == -1 ) && ( errno == EINTR ) ) ;
+
+    return ( n == sizeof( status ) ) ? 0 : -1 ;
+}
+
+
+/**********************************************************************
+ */
+
@@ -0,0 +1,73 @@
+
+/*
+ * Include file wrapserver.h
+ *
+ * $Id$
+ *
+ * The protocol spoken between wrap_open.so and gccwrap-server
+ * over a Unix socket.
+ */
+
+
+#ifndef __WRAPSERVER_H
+#  define __WRAPSERVER_H
+
+#include <stdint.h>
+
+/**********************************************************************
+ */
+
+/* The socket is $WRAP_OPEN_SERVER if that is set, otherwise
+ * gccwrap.sock in $XDG_RUNTIME_DIR or in /tmp/gccwrap-<uid>/,
+ * a directory only its owner can enter.  Either end talks only
+ * to a peer running as the same user.
+ */
+#define WRAPSERVER_ENV      "WRAP_OPEN_SERVER"
+
+#define WRAPSERVER_MAGIC    0x32535257      /* "WRS2" */
+
+#define WRAPSERVER_MAXCMD   65536
+
+/* returned by wrapserver_request() when there is no server
+ */
+#define WRAPSERVER_DOWN     -2
+
+
+/* A request is this header followed by the WRAP_OPEN_COMMAND
+ * string, the client's working directory and the canonical
+ * path of the source file, none of them nul terminated.
+ *
+ * The reply is a single int32_t status.  A status of 0 comes
+ * with a descriptor for the processed file, passed with
+ * SCM_RIGHTS.  Every reply gets a file of its own, so clients
+ * never share a file offset.
+ */
+
+struct wrapserver_req_s ;
+
+struct wrapserver_req_s {
+    uint32_t    magic ;
+    uint32_t    cmdlen ;
+    uint32_t    cwdlen ;
+    uint32_t    pathlen ;
+    } ;
+
+typedef struct wrapserver_req_s wrapserver_req_t ;
+
+
+/**********************************************************************
+ */
+
+extern int  wrapserver_path( char *path, int len ) ;
+
+extern int  wrapserver_mkdir( char *sockpath ) ;
+
+extern int  wrapserver_peer_ok( int sock ) ;
+
+extern int  wrapserver_request( char *sockpath, char *commandstr, char *source ) ;
+
+extern int  wrapserver_send_fd( int sock, int32_t status, int fd ) ;
+
+
+#endif /* __WRAPSERVER_H */
+
@@ -0,0 +1,680 @@
+
+/*
+ * wrapsession.c
+ *
+ * A build session index of processed files in shared memory.
+ *
+ * gccwrap creates the segment when it starts and every process
+ * started under it ( the compiler driver, each cc1, or a whole
+ * make -j run ) maps the same segment.  The first process to
+ * want a file claims its slot, runs the command chain and
+ * publishes the result.  Every other process then copies the
+ * result instead of running the chain again, so each file is
+ * processed exactly once per session.
+ *
+ * Inserts and lookups are lock-free.  A slot is claimed by a
+ * compare-and-swap of its key and the result is published with
+ * a release store of its state, after the data is in place.
+ *
+ * $Id$
+ */
+
+/* for memfd_create()
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapsession.h"
+
+#include "wraphash.h"
+
+
+/**********************************************************************
+ */
+
+#define WRAPSESSION_MAGIC       0x53505257      /* "WRPS" */
+
+/* must be a power of two
+ */
+#define WRAPSESSION_NSLOTS      16384
+
+/* Default size of the data area in MB.  The segment is sparse
+ * so only the pages actually used cost any memory.
+ */
+#define WRAPSESSION_DEFAULT_MB  256
+
+/* How long to wait for another process to finish a file
+ * before giving up and processing it ourselves ( in ms ).
+ */
+#define WRAPSESSION_WAIT_MS     60000
+
+/* How long to wait for a slot that has been won to have its
+ * path filled in ( in ms ).  That takes microseconds unless
+ * the winner died in between.
+ */
+#define WRAPSESSION_CLAIM_MS    1000
+
+
+/* slot states
+ */
+#define SLOT_EMPTY      0
+#define SLOT_BUSY       1
+#define SLOT_READY      2
+#define SLOT_FAILED     3
+
+
+struct wrapsession_hdr_s ;
+
+struct wrapsession_hdr_s {
+    uint32_t    magic ;
+    uint32_t    nslots ;
+    uint64_t    size ;
+    uint64_t    datatop ;
+    } ;
+
+typedef struct wrapsession_hdr_s wrapsession_hdr_t ;
+
+
+struct wrapsession_slot_s {
+    uint64_t    key ;
+    uint32_t    state ;
+    int32_t     owner ;
+    uint64_t    chainid ;
+    uint64_t    pathoff ;
+    uint64_t    pathlen ;
+    uint64_t    dev ;
+    uint64_t    ino ;
+    uint64_t    mtime_sec ;
+    uint64_t    mtime_nsec ;
+    uint64_t    srcsize ;
+    uint64_t    dataoff ;
+    uint64_t    datalen ;
+    } ;
+
+
+static char *base = NULL ;
+
+static wrapsession_hdr_t *hdr = NULL ;
+
+static wrapsession_slot_t *slots = NULL ;
+
+static uint64_t chainid = 0 ;
+
+
+#define ALIGN8(n)   ( ( (n) + 7 ) & ~ (uint64_t)7 )
+
+
+/**********************************************************************
+ */
+
+/* Create a new session segment
+ *
+ * returns the descriptor, which is left open across exec(),
+ * or -1 on failure
+ */
+int wrapsession_create()
+{
+    int fd = -1 ;
+
+    char *p = NULL ;
+
+    uint64_t size = 0 ;
+
+    wrapsession_hdr_t *h = NULL ;
+
+    size = WRAPSESSION_DEFAULT_MB ;
+
+    p = getenv( "WRAP_OPEN_SESSION_MB" ) ;
+
+    if( ( p != NULL ) && ( *p != 0 ) )
+    {
+        size = strtoull( p, NULL, 10 ) ;
+    }
+
+    size <<= 20 ;
+
+    size += sizeof( wrapsession_hdr_t ) + WRAPSESSION_NSLOTS * sizeof( wrapsession_slot_t ) ;
+
+    fd = memfd_create( "gccwrap-session", 0 ) ;
+
+    if( fd == -1 )
+    {
+        return -1 ;
+    }
+
+    if( ftruncate( fd, size ) != 0 )
+    {
+        close( fd ) ;
+
+        return -1 ;
+    }
+
+    h = (wrapsession_hdr_t *)mmap( NULL, sizeof( wrapsession_hdr_t ), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 ) ;
+
+    if( h == MAP_FAILED )
+    {
+        close( fd ) ;
+
+        return -1 ;
+    }
+
+    /* the slots are already zero ( SLOT_EMPTY )
+     */
+
+    h->nslots = WRAPSESSION_NSLOTS ;
+    h->size = size ;
+    h->datatop = sizeof( wrapsession_hdr_t ) + WRAPSESSION_NSLOTS * sizeof( wrapsession_slot_t ) ;
+    h->magic = WRAPSESSION_MAGIC ;
+
+    munmap( h, sizeof( wrapsession_hdr_t ) ) ;
+
+    SJGF( "Created session segment %d ( %" PRIu64 " bytes )", fd, size ) ;
+
+    return fd ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Map the session named in the environment, if there is one
+ *
+ * commandstr is the WRAP_OPEN_COMMAND string, so sessions can
+ * be shared by compilers using different command chains.
+ *
+ * returns 0 if attached
+ */
+int wrapsession_attach( char *commandstr )
+{
+    char *p = NULL ;
+    char *end = NULL ;
+
+    int fd = -1 ;
+
+    struct stat st ;
+
+    wrapsession_hdr_t h ;
+
+    p = getenv( WRAPSESSION_ENV ) ;
+
+    if( ( p == NULL ) || ( *p == 0 ) )
+    {
+        return -1 ;
+    }
+
+    fd = (int)strtol( p, &end, 10 ) ;
+
+    if( ( *end != 0 ) || ( fd < 0 ) )
+    {
+        return -1 ;
+    }
+
+    /* check it really is a session before mapping it
+     */
+
+    if( ( fstat( fd, &st ) != 0 ) || ! S_ISREG( st.st_mode ) )
+    {
+        return -1 ;
+    }
+
+    if( pread( fd, &h, sizeof( h ), 0 ) != sizeof( h ) )
+    {
+        return -1 ;
+    }
+
+    if( ( h.magic != WRAPSESSION_MAGIC ) || ( h.size != (uint64_t)st.st_size ) )
+    {
+        return -1 ;
+    }
+
+    base = (char *)mmap( NULL, h.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 ) ;
+
+    if( base == MAP_FAILED )
+    {
+        base = NULL ;
+
+        return -1 ;
+    }
+
+    hdr = (wrapsession_hdr_t *)base ;
+
+    slots = (wrapsession_slot_t *)( base + sizeof( wrapsession_hdr_t ) ) ;
+
+    chainid = wraphash_fnv( commandstr, strlen( commandstr ), WRAPHASH_FNV_BASIS ) ;
+
+    SJGF( "Attached session %d", fd ) ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* bump allocate from the data area
+ *
+ * returns 0 if there is no room left
+ */
+static uint64_t session_alloc( uint64_t len )
+{
+    uint64_t off = 0 ;
+
+    off = __atomic_fetch_add( &( hdr->datatop ), ALIGN8( len ), __ATOMIC_RELAXED ) ;
+
+    if( off + len > hdr->size )
+    {
+        return 0 ;
+    }
+
+    return off ;
+}
+
+
+/**********************************************************************
+ */
+
+static int same_source( wrapsession_slot_t *slot, struct stat *st )
+{
+    return     ( slot->dev == (uint64_t)st->st_dev )
+            && ( slot->ino == (uint64_t)st->st_ino )
+            && ( slot->srcsize == (uint64_t)st->st_size )
+            && ( slot->mtime_sec == (uint64_t)st->st_mtim.tv_sec )
+            && ( slot->mtime_nsec == (uint64_t)st->st_mtim.tv_nsec ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* record the source file the caller is about to process
+ */
+static void take_slot( wrapsession_slot_t *slot, struct stat *st )
+{
+    slot->dev = (uint64_t)st->st_dev ;
+    slot->ino = (uint64_t)st->st_ino ;
+    slot->srcsize = (uint64_t)st->st_size ;
+    slot->mtime_sec = (uint64_t)st->st_mtim.tv_sec ;
+    slot->mtime_nsec = (uint64_t)st->st_mtim.tv_nsec ;
+}
+
+
+/**********************************************************************
+ */
+
+/* wait for another process to finish with a slot
+ *
+ * A slot whose owner failed, or died, is taken over by the first
+ * waiter to notice, which then processes the file itself.
+ */
+static int wait_for_slot( wrapsession_slot_t *slot, struct stat *st )
+{
+    struct timespec ts ;
+
+    uint32_t state = 0 ;
+
+    int32_t owner = 0 ;
+
+    long waited = 0 ;
+    long delay = 1 ;
+
+    while( TRUE )
+    {
+        state = __atomic_load_n( &( slot->state ), __ATOMIC_ACQUIRE ) ;
+
+        if( state == SLOT_READY )
+        {
+            if( same_source( slot, st ) )
+            {
+                return WRAPSESSION_HIT ;
+            }
+
+            /* the file changed during the session
+             */
+
+            return WRAPSESSION_NONE ;
+        }
+
+        if( state == SLOT_FAILED )
+        {
+            if( __atomic_compare_exchange_n( &( slot->state ), &state, SLOT_BUSY, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+            {
+                __atomic_store_n( &( slot->owner ), (int32_t)getpid(), __ATOMIC_RELEASE ) ;
+
+                take_slot( slot, st ) ;
+
+                return WRAPSESSION_OWNER ;
+            }
+
+            continue ;
+        }
+
+        if( state == SLOT_BUSY )
+        {
+            owner = __atomic_load_n( &( slot->owner ), __ATOMIC_ACQUIRE ) ;
+
+            if( ( kill( (pid_t)owner, 0 ) != 0 ) && ( errno == ESRCH ) )
+            {
+                /* the owner died, only one waiter gets to
+                 * replace it
+                 */
+
+                if( __atomic_compare_exchange_n( &( slot->owner ), &owner, (int32_t)getpid(), FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+                {
+                    take_slot( slot, st ) ;
+
+                    return WRAPSESSION_OWNER ;
+                }
+
+                continue ;
+            }
+
+            /* give up if it takes too long
+             */
+
+            if( waited > WRAPSESSION_WAIT_MS )
+            {
+                return WRAPSESSION_NONE ;
+            }
+        }
+
+        ts.tv_sec = 0 ;
+        ts.tv_nsec = delay * 1000000L ;
+
+        nanosleep( &ts, NULL ) ;
+
+        waited += delay ;
+
+        if( delay < 16 )
+        {
+            delay *= 2 ;
+        }
+    } ;
+
+    return WRAPSESSION_NONE ;
+}
+
+
+/**********************************************************************
+ */
+
+/* wait for the winner of a slot to fill in its path
+ *
+ * returns FALSE if it never does, e.g. because it died first.
+ * The slot is then marked failed, with no path, so later
+ * callers pass over it without waiting.
+ */
+static int wait_for_claim( wrapsession_slot_t *slot )
+{
+    struct timespec ts ;
+
+    uint32_t empty = SLOT_EMPTY ;
+
+    long waited = 0 ;
+
+    int spins = 0 ;
+
+    while( __atomic_load_n( &( slot->state ), __ATOMIC_ACQUIRE ) == SLOT_EMPTY )
+    {
+        if( spins < 1000 )
+        {
+            spins++ ;
+
+            sched_yield() ;
+
+            continue ;
+        }
+
+        if( waited > WRAPSESSION_CLAIM_MS )
+        {
+            __atomic_compare_exchange_n( &( slot->state ), &empty, SLOT_FAILED, FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) ;
+
+            return FALSE ;
+        }
+
+        ts.tv_sec = 0 ;
+        ts.tv_nsec = 1000000L ;
+
+        nanosleep( &ts, NULL ) ;
+
+        waited++ ;
+    } ;
+
+    return TRUE ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Find or claim the slot for a source file
+ *
+ * returns WRAPSESSION_HIT if another process already published
+ * the processed file, WRAPSESSION_OWNER if the caller must
+ * process the file and then call wrapsession_publish() or
+ * wrapsession_fail(), or WRAPSESSION_NONE if the session
+ * cannot help.  A slot left failed, or by an owner which died,
+ * is handed to the next caller as WRAPSESSION_OWNER.
+ */
+int wrapsession_claim( char *path, struct stat *st, wrapsession_slot_t **slotp )
+{
+    wrapsession_slot_t *slot = NULL ;
+
+    uint64_t len = 0 ;
+    uint64_t key = 0 ;
+    uint64_t k = 0 ;
+    uint64_t off = 0 ;
+
+    uint32_t mask = 0 ;
+    uint32_t i = 0 ;
+    uint32_t probes = 0 ;
+
+    int retv = WRAPSESSION_NONE ;
+
+    *slotp = NULL ;
+
+    if( base == NULL )
+    {
+        return WRAPSESSION_NONE ;
+    }
+
+    len = strlen( path ) ;
+
+    key = WRAPHASH_KEY( wraphash_fnv( path, len, chainid ) ) ;
+
+    mask = hdr->nslots - 1 ;
+
+    i = (uint32_t)key & mask ;
+
+    for( probes = 0 ; probes < hdr->nslots ; probes++ )
+    {
+        slot = slots + i ;
+
+        k = __atomic_load_n( &( slot->key ), __ATOMIC_ACQUIRE ) ;
+
+        if( k == 0 )
+        {
+            uint64_t zero = 0 ;
+
+            if( __atomic_compare_exchange_n( &( slot->key ), &zero, key, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+            {
+                /* the slot is ours
+                 */
+
+                off = session_alloc( len+1 ) ;
+
+                if( off == 0 )
+                {
+                    __atomic_store_n( &( slot->state ), SLOT_FAILED, __ATOMIC_RELEASE ) ;
+
+                    return WRAPSESSION_NONE ;
+                }
+
+                memcpy( base + off, path, len+1 ) ;
+
+                slot->pathoff = off ;
+                slot->pathlen = len ;
+                slot->chainid = chainid ;
+                slot->owner = (int32_t)getpid() ;
+
+                take_slot( slot, st ) ;
+
+                __atomic_store_n( &( slot->state ), SLOT_BUSY, __ATOMIC_RELEASE ) ;
+
+                *slotp = slot ;
+
+                SJGF( "session OWNER %s", path ) ;
+
+                return WRAPSESSION_OWNER ;
+            }
+
+            /* lost the race so see who won
+             */
+
+            k = zero ;
+        }
+
+        /* a slot whose path never gets filled in is passed over,
+         * the file then gets a slot further on
+         */
+
+        if( ( k == key ) && wait_for_claim( slot ) )
+        {
+            if(    ( slot->pathlen == len )
+                && ( slot->chainid == chainid )
+                && ( memcmp( base + slot->pathoff, path, len ) == 0 )
+              )
+            {
+                *slotp = slot ;
+
+                retv = wait_for_slot( slot, st ) ;
+
+                SJGF( "session %s %s", ( retv == WRAPSESSION_HIT ) ? "HIT" : ( retv == WRAPSESSION_OWNER ) ? "OWNER" : "NONE", path ) ;
+
+                return retv ;
+            }
+        }
+
+        i = ( i + 1 ) & mask ;
+    }
+
+    return retv ;
+}
+
+
+/**********************************************************************
+ */
+
+int wrapsession_data( wrapsession_slot_t *slot, char **datap, size_t *lenp )
+{
+    if( ( slot == NULL ) || ( slot->state != SLOT_READY ) )
+    {
+        return -1 ;
+    }
+
+    *datap = base + slot->dataoff ;
+    *lenp = (size_t)slot->datalen ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Copy the processed file open as fd into the session
+ *
+ * returns 0 on success.  On failure the slot is marked as
+ * failed so waiting processes go their own way.
+ */
+int wrapsession_publish( wrapsession_slot_t *slot, int fd )
+{
+    struct stat st ;
+
+    uint64_t off = 0 ;
+    uint64_t done = 0 ;
+
+    ssize_t n = 0 ;
+
+    if( fstat( fd, &st ) != 0 )
+    {
+        wrapsession_fail( slot ) ;
+
+        return -1 ;
+    }
+
+    off = session_alloc( (uint64_t)st.st_size ) ;
+
+    if( off == 0 )
+    {
+        wrapsession_fail( slot ) ;
+
+        return -1 ;
+    }
+
+    while( done < (uint64_t)st.st_size )
+    {
+        n = pread( fd, base + off + done, st.st_size - done, done ) ;
+
+        if( n <= 0 )
+        {
+            wrapsession_fail( slot ) ;
+
+            return -1 ;
+        }
+
+        done += n ;
+    } ;
+
+    slot->dataoff = off ;
+    slot->datalen = done ;
+
+    __atomic_store_n( &( slot->state ), SLOT_READY, __ATOMIC_RELEASE ) ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Mark a claimed slot as failed
+ *
+ * A slot that has already been published is left alone.
+ */
+void wrapsession_fail( wrapsession_slot_t *slot )
+{
+    uint32_t busy = SLOT_BUSY ;
+
+    if( slot == NULL )
+    {
+        return ;
+    }
+
+    __atomic_compare_exchange_n( &( slot->state ), &busy, SLOT_FAILED, FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) ;
+}
+
+
+/**********************************************************************
+ */
+
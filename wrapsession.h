@@ -0,0 +1,58 @@
+
+/*
+ * Include file wrapsession.h
+ *
+ * $Id$
+ *
+ * A shared memory index of processed files shared by every
+ * compiler process started under one gccwrap invocation.
+ */
+
+
+#ifndef __WRAPSESSION_H
+#  define __WRAPSESSION_H
+
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**********************************************************************
+ */
+
+/* The segment is a memfd created by gccwrap and inherited by
+ * every child process.  Its descriptor number is passed on in
+ * this environment variable.
+ */
+#define WRAPSESSION_ENV         "WRAP_OPEN_SESSION"
+
+/* Results of wrapsession_claim()
+ */
+#define WRAPSESSION_NONE        0
+#define WRAPSESSION_HIT         1
+#define WRAPSESSION_OWNER       2
+
+
+struct wrapsession_slot_s ;
+
+typedef struct wrapsession_slot_s wrapsession_slot_t ;
+
+
+/**********************************************************************
+ */
+
+extern int  wrapsession_create() ;
+
+extern int  wrapsession_attach( char *commandstr ) ;
+
+extern int  wrapsession_claim( char *path, struct stat *st, wrapsession_slot_t **slotp ) ;
+
+extern int  wrapsession_data( wrapsession_slot_t *slot, char **datap, size_t *lenp ) ;
+
+extern int  wrapsession_publish( wrapsession_slot_t *slot, int fd ) ;
+
+extern void wrapsession_fail( wrapsession_slot_t *slot ) ;
+
+
+#endif /* __WRAPSESSION_H */
+
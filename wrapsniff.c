@@ -0,0 +1,564 @@
+/*
+ * wrapsniff.c
+ *
+ * Decide whether the command chain would change a file at all.
+ *
+ * Every stage of the chain declares the directives it acts on,
+ * e.g. #quote or #def for cap.  The file is mapped and searched
+ * with memchr(), which the C library vectorises, for each
+ * character that can start a directive, and only where one is
+ * found is the word after it compared with the triggers.
+ *
+ * A file with no triggers in it can be handed to the compiler
+ * as it is, without running the chain or writing a copy.  The
+ * verdict is remembered against the file's inode, mtime and
+ * size so it is only worked out once per process.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapsniff.h"
+
+#include "wraphash.h"
+
+
+/**********************************************************************
+ */
+
+/* The directives cap acts on, as listed in process() in cap.c.
+ * Any of them in a file means cap has to see it.
+ */
+static char *cap_keywords[] = {
+    "skipoff",
+    "skipon",
+    "macrochar",
+    "debugon",
+    "debugoff",
+    "quote",
+    "comment",
+    "def",
+    "constants",
+    "flags",
+    "constants-values",
+    "constants-negative",
+    "command",
+    "redefine",
+    "brace_macros_on",
+    "brace_macros_off",
+    "def_open_brace",
+    "def_close_brace",
+    "return_macro_on",
+    "return_macro_off",
+    "def_return_macro",
+    NULL
+    } ;
+
+
+/* For each character that can start a directive a list of the
+ * words which may follow it, each nul terminated with an extra
+ * nul at the end of the list.
+ */
+static char *triggers[256] ;
+
+static size_t triggerslen[256] ;
+
+static unsigned char leadchars[256] ;
+
+static int nleadchars = 0 ;
+
+
+/* Verdicts already worked out
+ */
+
+struct sniffent_s ;
+
+struct sniffent_s {
+    uint64_t    key ;
+    dev_t       dev ;
+    ino_t       ino ;
+    off_t       size ;
+    int64_t     mtime ;
+    int64_t     mtimens ;
+    int         needed ;
+    } ;
+
+typedef struct sniffent_s sniffent_t ;
+
+
+static wraphash_t sniffcache = WRAPHASH_INIT( sniffent_t ) ;
+
+static pthread_mutex_t snifflock = PTHREAD_MUTEX_INITIALIZER ;
+
+
+/**********************************************************************
+ */
+
+static int add_trigger( unsigned char c, char *word, int len )
+{
+    char *p = NULL ;
+
+    if( len <= 0 )
+    {
+        return 0 ;
+    }
+
+    p = (char *)realloc( triggers[c], triggerslen[c] + len + 2 ) ;
+
+    if( p == NULL )
+    {
+        return -1 ;
+    }
+
+    if( triggers[c] == NULL )
+    {
+        leadchars[ nleadchars++ ] = c ;
+    }
+
+    triggers[c] = p ;
+
+    memcpy( p + triggerslen[c], word, len ) ;
+
+    triggerslen[c] += len ;
+
+    p[ triggerslen[c]++ ] = 0 ;
+    p[ triggerslen[c] ] = 0 ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Find the triggers declared for the command name in the
+ * WRAP_OPEN_SNIFF list
+ *
+ * returns 0 if name was declared, -1 if not
+ */
+static int add_declared( char *decls, char *name )
+{
+    char *p = decls ;
+    char *end = NULL ;
+    char *eq = NULL ;
+    char *w = NULL ;
+
+    int namelen = strlen( name ) ;
+
+    while( ( p != NULL ) && ( *p != 0 ) )
+    {
+        end = strchr( p, ';' ) ;
+
+        if( end == NULL )
+        {
+            end = p + strlen( p ) ;
+        }
+
+        eq = memchr( p, '=', end - p ) ;
+
+        if( ( eq != NULL ) && ( eq - p == namelen ) && ( memcmp( p, name, namelen ) == 0 ) )
+        {
+            p = eq + 1 ;
+
+            while( p < end )
+            {
+                w = p ;
+
+                while( ( p < end ) && ( *p != ',' ) )
+                {
+                    p++ ;
+                } ;
+
+                if( p - w > 1 )
+                {
+                    if( add_trigger( (unsigned char)*w, w+1, p - w - 1 ) != 0 )
+                    {
+                        return -1 ;
+                    }
+                }
+
+                p++ ;
+            } ;
+
+            return 0 ;
+        }
+
+        p = ( *end == ';' ) ? end+1 : end ;
+    } ;
+
+    return -1 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Learn what triggers one stage of the chain
+ *
+ * returns 0 if the stage is sniffable
+ */
+static int add_stage( wrapchain_stage_t *st, char *decls )
+{
+    char *name = NULL ;
+
+    unsigned char c = '#' ;
+
+    int i = 0 ;
+
+    name = strrchr( st->argv[0], '/' ) ;
+
+    name = ( name == NULL ) ? st->argv[0] : name+1 ;
+
+    if( add_declared( decls, name ) == 0 )
+    {
+        SJGF( "%s declared sniffable", name ) ;
+
+        return 0 ;
+    }
+
+    if( strcmp( name, "cap" ) != 0 )
+    {
+        SJGF( "%s is not sniffable", name ) ;
+
+        return -1 ;
+    }
+
+    /* cap -m <c> changes the macrochar
+     */
+
+    for( i = 1 ; i < st->argc ; i++ )
+    {
+        if( ( strcmp( st->argv[i], "-m" ) == 0 ) && ( i+1 < st->argc ) )
+        {
+            c = (unsigned char)st->argv[++i][0] ;
+        }
+    }
+
+    for( i = 0 ; cap_keywords[i] != NULL ; i++ )
+    {
+        if( add_trigger( c, cap_keywords[i], strlen( cap_keywords[i] ) ) != 0 )
+        {
+            return -1 ;
+        }
+    }
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+static void prefork()
+{
+    pthread_mutex_lock( &snifflock ) ;
+}
+
+
+static void postfork()
+{
+    pthread_mutex_unlock( &snifflock ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* returns 0 if files can be sniffed for this chain
+ */
+int wrapsniff_init( wrapchain_t *chain )
+{
+    char *decls = getenv( WRAPSNIFF_ENV ) ;
+
+    int i = 0 ;
+
+    if( ( decls != NULL ) && ( strcmp( decls, "0" ) == 0 ) )
+    {
+        return -1 ;
+    }
+
+    for( i = 0 ; i < chain->nstages ; i++ )
+    {
+        if( add_stage( chain->stages + i, decls ) != 0 )
+        {
+            nleadchars = 0 ;
+
+            return -1 ;
+        }
+    }
+
+    pthread_atfork( prefork, postfork, postfork ) ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* does the word of length len appear in the list ?
+ */
+static int is_trigger( char *list, const char *word, size_t len )
+{
+    size_t n = 0 ;
+
+    while( *list != 0 )
+    {
+        n = strlen( list ) ;
+
+        if( ( n == len ) && ( memcmp( list, word, len ) == 0 ) )
+        {
+            return TRUE ;
+        }
+
+        list += n + 1 ;
+    } ;
+
+    return FALSE ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Look for a trigger anywhere in the data, as cap does allowing
+ * spaces between the lead character and the word.  Finding one
+ * that is really inside a comment or a string only costs a run
+ * of the chain.
+ */
+static int scan( const char *data, size_t len )
+{
+    const char *end = data + len ;
+    const char *p = NULL ;
+    const char *w = NULL ;
+
+    unsigned char c = 0 ;
+
+    int i = 0 ;
+
+    for( i = 0 ; i < nleadchars ; i++ )
+    {
+        c = leadchars[i] ;
+
+        p = data ;
+
+        while( ( p = memchr( p, c, end - p ) ) != NULL )
+        {
+            p++ ;
+
+            while( ( p < end ) && ( ( *p == ' ' ) || ( *p == '\t' ) ) )
+            {
+                p++ ;
+            } ;
+
+            w = p ;
+
+            while( ( p < end ) && ( ! isspace( (unsigned char)*p ) ) )
+            {
+                p++ ;
+            } ;
+
+            if( ( p > w ) && is_trigger( triggers[c], w, p - w ) )
+            {
+                return TRUE ;
+            }
+        } ;
+    }
+
+    return FALSE ;
+}
+
+
+/**********************************************************************
+ */
+
+static uint64_t sniff_key( struct stat *st )
+{
+    uint64_t h = ( (uint64_t)st->st_dev * UINT64_C(0x9e3779b97f4a7c15) ) ^ (uint64_t)st->st_ino ;
+
+    h *= UINT64_C(0xff51afd7ed558ccd) ;
+
+    h ^= h >> 33 ;
+
+    /* zero marks an empty slot
+     */
+
+    return WRAPHASH_KEY( h ) ;
+}
+
+
+#define SAME_FILE( _e, _st )    (    ( (_e)->dev == (_st)->st_dev ) \
+                                  && ( (_e)->ino == (_st)->st_ino ) \
+                                  && ( (_e)->size == (_st)->st_size ) \
+                                  && ( (_e)->mtime == (int64_t)(_st)->st_mtim.tv_sec ) \
+                                  && ( (_e)->mtimens == (int64_t)(_st)->st_mtim.tv_nsec ) )
+
+
+/* must be called with snifflock held
+ *
+ * returns -1 if the file has no verdict yet
+ */
+static int sniffcache_get( uint64_t key, struct stat *st )
+{
+    sniffent_t *e = NULL ;
+
+    WRAPHASH_WALK(  sniffcache,
+                    key,
+                    sniffent_t,
+                    e,
+
+                    if( SAME_FILE( e, st ) )
+                    {
+                        return e->needed ;
+                    }
+                 )
+
+    return -1 ;
+}
+
+
+/* must be called with snifflock held
+ *
+ * A file which has changed gets a new entry, the old one is
+ * simply never matched again.
+ */
+static void sniffcache_put( uint64_t key, struct stat *st, int needed )
+{
+    sniffent_t ent ;
+
+    memset( &ent, 0, sizeof( ent ) ) ;
+
+    ent.key = key ;
+    ent.dev = st->st_dev ;
+    ent.ino = st->st_ino ;
+    ent.size = st->st_size ;
+    ent.mtime = (int64_t)st->st_mtim.tv_sec ;
+    ent.mtimens = (int64_t)st->st_mtim.tv_nsec ;
+    ent.needed = needed ;
+
+    wraphash_add( &sniffcache, &ent ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Does the chain need to run on path ?  st is the result of a
+ * stat() of path.
+ *
+ * returns FALSE only when the file certainly has no triggers in
+ * it, anything unexpected means the chain runs as usual.
+ */
+int wrapsniff_needed( char *path, struct stat *st )
+{
+    struct stat fst ;
+
+    uint64_t key = 0 ;
+
+    char *data = NULL ;
+
+    int needed = TRUE ;
+
+    int fd = -1 ;
+
+    if( nleadchars == 0 )
+    {
+        return TRUE ;
+    }
+
+    if( ! S_ISREG( st->st_mode ) )
+    {
+        return TRUE ;
+    }
+
+    key = sniff_key( st ) ;
+
+    pthread_mutex_lock( &snifflock ) ;
+
+    needed = sniffcache_get( key, st ) ;
+
+    pthread_mutex_unlock( &snifflock ) ;
+
+    if( needed != -1 )
+    {
+        SJGF( "%s %s ( cached )", path, needed ? "needs the chain" : "has no directives" ) ;
+
+        return needed ;
+    }
+
+    needed = TRUE ;
+
+    fd = open( path, O_RDONLY | O_CLOEXEC ) ;
+
+    /* the file may have changed since st, so what is sniffed
+     * is recorded against what was actually opened
+     */
+
+    if( ( fd == -1 ) || ( fstat( fd, &fst ) != 0 ) || ! S_ISREG( fst.st_mode ) )
+    {
+        if( fd != -1 )
+        {
+            close( fd ) ;
+        }
+
+        return TRUE ;
+    }
+
+    st = &fst ;
+
+    key = sniff_key( st ) ;
+
+    if( st->st_size == 0 )
+    {
+        needed = FALSE ;
+    }
+    else
+    {
+        data = (char *)mmap( NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) ;
+
+        if( data != MAP_FAILED )
+        {
+            madvise( data, st->st_size, MADV_SEQUENTIAL ) ;
+
+            needed = scan( data, st->st_size ) ;
+
+            munmap( data, st->st_size ) ;
+        }
+    }
+
+    close( fd ) ;
+
+    SJGF( "%s %s", path, needed ? "needs the chain" : "has no directives" ) ;
+
+    pthread_mutex_lock( &snifflock ) ;
+
+    sniffcache_put( key, st, needed ) ;
+
+    pthread_mutex_unlock( &snifflock ) ;
+
+    return needed ;
+}
+
+
+/**********************************************************************
+ */
+
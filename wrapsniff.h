@@ -0,0 +1,45 @@
+
+/*
+ * Include file wrapsniff.h
+ *
+ * $Id$
+ *
+ * Looks inside a source file for the directives the command
+ * chain acts on, so files without any can be used as they are.
+ */
+
+
+#ifndef __WRAPSNIFF_H
+#  define __WRAPSNIFF_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "wrapchain.h"
+
+/**********************************************************************
+ */
+
+/* A chain can only be skipped when every stage in it is
+ * sniffable.  cap is sniffable out of the box and any other
+ * command can be declared sniffable, with the directives which
+ * trigger it, in WRAP_OPEN_SNIFF :
+ *
+ *   WRAP_OPEN_SNIFF="mypp=#foo,#bar;otherpp=@baz"
+ *
+ * The first character of each trigger is the character which
+ * starts the directive.  WRAP_OPEN_SNIFF=0 turns sniffing off.
+ */
+#define WRAPSNIFF_ENV           "WRAP_OPEN_SNIFF"
+
+
+/**********************************************************************
+ */
+
+extern int  wrapsniff_init( wrapchain_t *chain ) ;
+
+extern int  wrapsniff_needed( char *path, struct stat *st ) ;
+
+
+#endif /* __WRAPSNIFF_H */
+
@@ -0,0 +1,530 @@
+/*
+ * wrapsplit.c
+ *
+ * Run "gccwrap cap -c a.c b.c c.c ..." as one compiler per
+ * source instead of one compiler for all of them.
+ *
+ * The driver compiles its sources strictly one after another,
+ * so a makefile that passes dozens of sources on one command
+ * line leaves every other core idle.  Each source is given to a
+ * compiler of its own, with every option in the same place, so
+ * the object files get exactly the names they would have had.
+ *
+ * Up to WRAP_OPEN_SPLIT compilers run at once.  Under a make
+ * with a jobserver the first compiler runs on the token make
+ * gave us and each further one needs a token of its own, so
+ * the whole build still keeps to make's -j.
+ *
+ * Each compiler's output goes to memory files and is copied
+ * out in command line order, so the diagnostics read just as
+ * they would from one compiler.  The exit status is the worst
+ * of the compilers'.
+ *
+ * $Id$
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+#include <poll.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wrapsplit.h"
+
+
+extern char **environ ;
+
+
+/**********************************************************************
+ */
+
+#define JOB_WAITING     0
+#define JOB_RUNNING     1
+#define JOB_DONE        2
+
+struct job_s ;
+
+struct job_s {
+    int          arg ;          /* wa->argv index of the input */
+    int          state ;
+    pid_t        pid ;
+    int          outfd ;
+    int          errfd ;
+    int          status ;
+    } ;
+
+typedef struct job_s job_t ;
+
+
+/* our own ends of the make jobserver, or -1
+ */
+static int jsread = -1 ;
+
+static int jswrite = -1 ;
+
+
+/**********************************************************************
+ */
+
+/* Find the jobserver in MAKEFLAGS, either
+ *
+ *   --jobserver-auth=fifo:<path>       ( make 4.4 )
+ *   --jobserver-auth=<r>,<w>           ( or --jobserver-fds )
+ *
+ * The read end is opened again non blocking, so waiting for a
+ * token never stops us reaping our own compilers, without
+ * changing the descriptor make and its other children share.
+ */
+static void jobserver_open()
+{
+    char path[PATH_MAX] ;
+
+    char *flags = getenv( "MAKEFLAGS" ) ;
+    char *p = NULL ;
+    char *q = NULL ;
+
+    int r = -1 ;
+    int w = -1 ;
+
+    if( flags == NULL )
+    {
+        return ;
+    }
+
+    /* the last one wins
+     */
+
+    for( q = flags ; ( q = strstr( q, "--jobserver-" ) ) != NULL ; q++ )
+    {
+        if( ( strncmp( q, "--jobserver-auth=", 17 ) == 0 ) || ( strncmp( q, "--jobserver-fds=", 16 ) == 0 ) )
+        {
+            p = strchr( q, '=' ) + 1 ;
+        }
+    }
+
+    if( p == NULL )
+    {
+        return ;
+    }
+
+    if( strncmp( p, "fifo:", 5 ) == 0 )
+    {
+        snprintf( path, PATH_MAX, "%.*s", (int)strcspn( p+5, " " ), p+5 ) ;
+
+        jsread = open( path, O_RDONLY | O_NONBLOCK | O_CLOEXEC ) ;
+
+        jswrite = open( path, O_WRONLY | O_CLOEXEC ) ;
+    }
+    else if( sscanf( p, "%d,%d", &r, &w ) == 2 )
+    {
+        /* make does not pass the descriptors to commands it
+         * does not think are recursive
+         */
+
+        if( ( fcntl( r, F_GETFD ) == -1 ) || ( fcntl( w, F_GETFD ) == -1 ) )
+        {
+            return ;
+        }
+
+        snprintf( path, PATH_MAX, "/proc/self/fd/%d", r ) ;
+
+        jsread = open( path, O_RDONLY | O_NONBLOCK | O_CLOEXEC ) ;
+
+        jswrite = w ;
+    }
+
+    if( ( jsread == -1 ) || ( jswrite == -1 ) )
+    {
+        if( jsread != -1 )
+        {
+            close( jsread ) ;
+        }
+
+        jsread = -1 ;
+        jswrite = -1 ;
+    }
+
+    SJGF( "jobserver %d,%d", jsread, jswrite ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Start a compiler on one input with its output going to
+ * memory files
+ */
+static void start_job( char *compiler, wrapargs_t *wa, job_t *job )
+{
+    posix_spawn_file_actions_t fa ;
+
+    char *argv[ wa->argc - wa->ninputs + 3 ] ;
+
+    int kind = 0 ;
+
+    int n = 0 ;
+    int i = 0 ;
+
+    argv[n++] = compiler ;
+
+    for( i = 0 ; i < wa->argc ; i++ )
+    {
+        kind = wa->kinds[i] ;
+
+        if( ( ( kind != WRAPARGS_INPUT ) && ( kind != WRAPARGS_SOURCE ) ) || ( i == job->arg ) )
+        {
+            argv[n++] = wa->argv[i] ;
+        }
+    }
+
+    argv[n] = NULL ;
+
+    job->outfd = memfd_create( "wrapsplit", MFD_CLOEXEC ) ;
+    job->errfd = memfd_create( "wrapsplit", MFD_CLOEXEC ) ;
+
+    job->state = JOB_RUNNING ;
+
+    posix_spawn_file_actions_init( &fa ) ;
+
+    if( ( job->outfd != -1 ) && ( job->errfd != -1 ) )
+    {
+        posix_spawn_file_actions_adddup2( &fa, job->outfd, 1 ) ;
+        posix_spawn_file_actions_adddup2( &fa, job->errfd, 2 ) ;
+    }
+
+    if( posix_spawnp( &( job->pid ), compiler, &fa, NULL, argv, environ ) != 0 )
+    {
+        errorf( "Could not run %s for %s\n", compiler, wa->argv[ job->arg ] ) ;
+
+        job->state = JOB_DONE ;
+
+        job->status = W_EXITCODE( 127, 0 ) ;
+    }
+
+    posix_spawn_file_actions_destroy( &fa ) ;
+
+    SJGF( "%s %s is pid %d", compiler, wa->argv[ job->arg ], (int)job->pid ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Copy everything written to fd out to outfd
+ */
+static void copy_out( int fd, int outfd )
+{
+    char buf[65536] ;
+
+    off_t off = 0 ;
+
+    ssize_t n = 0 ;
+    ssize_t w = 0 ;
+    ssize_t done = 0 ;
+
+    if( fd == -1 )
+    {
+        return ;
+    }
+
+    while( ( n = pread( fd, buf, sizeof( buf ), off ) ) > 0 )
+    {
+        for( done = 0 ; done < n ; done += w )
+        {
+            w = write( outfd, buf + done, n - done ) ;
+
+            if( w <= 0 )
+            {
+                if( ( w == -1 ) && ( errno == EINTR ) )
+                {
+                    w = 0 ;
+
+                    continue ;
+                }
+
+                return ;
+            }
+        }
+
+        off += n ;
+    } ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Run one compiler per input if WRAP_OPEN_SPLIT asks for it and
+ * the command line allows it
+ *
+ * returns the exit status for gccwrap, or -1 if the command
+ * line should be run as it is
+ */
+int wrapsplit_run( char *compiler, wrapargs_t *wa )
+{
+    struct pollfd pfd ;
+
+    job_t *jobs = NULL ;
+    job_t *job = NULL ;
+
+    char *p = getenv( WRAPSPLIT_ENV ) ;
+
+    int limit = 0 ;
+
+    int njobs = 0 ;
+    int next = 0 ;
+    int running = 0 ;
+    int done = 0 ;
+    int shown = 0 ;
+
+    int wantmore = FALSE ;
+
+    int status = 0 ;
+    int code = 0 ;
+
+    int retv = 0 ;
+
+    int i = 0 ;
+
+    pid_t pid = 0 ;
+
+    if( ( p == NULL ) || ( ( limit = atoi( p ) ) <= 1 ) )
+    {
+        return -1 ;
+    }
+
+    /* only -c and -S give every input an output of its own, and
+     * an -o can only name the output of one
+     */
+
+    if( ( ( wa->mode != WRAPARGS_COMPILE ) && ( wa->mode != WRAPARGS_ASSEMBLE ) ) || ( wa->output != -1 ) || ( wa->ninputs < 2 ) )
+    {
+        return -1 ;
+    }
+
+    jobs = (job_t *)calloc( wa->ninputs, sizeof( job_t ) ) ;
+
+    if( jobs == NULL )
+    {
+        return -1 ;
+    }
+
+    for( i = 0 ; i < wa->argc ; i++ )
+    {
+        if( ( wa->kinds[i] == WRAPARGS_INPUT ) || ( wa->kinds[i] == WRAPARGS_SOURCE ) )
+        {
+            if( strcmp( wa->argv[i], "-" ) == 0 )
+            {
+                /* stdin can only be read once
+                 */
+
+                free( jobs ) ;
+
+                return -1 ;
+            }
+
+            jobs[njobs].arg = i ;
+            jobs[njobs].outfd = -1 ;
+            jobs[njobs].errfd = -1 ;
+
+            njobs++ ;
+        }
+    }
+
+    if( limit > njobs )
+    {
+        limit = njobs ;
+    }
+
+    jobserver_open() ;
+
+    /* tokens taken from the jobserver, to be given back the
+     * same
+     */
+
+    char tokens[limit] ;
+
+    int ntokens = 0 ;
+
+    SJGF( "splitting %d inputs over %d jobs", njobs, limit ) ;
+
+    while( done < njobs )
+    {
+        while( ( next < njobs ) && ( running < limit ) )
+        {
+            if( ( running > 0 ) && ( jsread != -1 ) )
+            {
+                if( read( jsread, tokens + ntokens, 1 ) != 1 )
+                {
+                    break ;
+                }
+
+                ntokens++ ;
+            }
+
+            start_job( compiler, wa, jobs + next ) ;
+
+            if( jobs[next].state == JOB_RUNNING )
+            {
+                running++ ;
+            }
+            else
+            {
+                done++ ;
+            }
+
+            next++ ;
+        } ;
+
+        if( done == njobs )
+        {
+            break ;
+        }
+
+        /* while a token could start another compiler keep
+         * looking for one as well as for compilers finishing
+         */
+
+        wantmore = ( next < njobs ) && ( running < limit ) && ( jsread != -1 ) ;
+
+        if( running == 0 )
+        {
+            pid = 0 ;
+        }
+        else
+        {
+            pid = waitpid( -1, &status, wantmore ? WNOHANG : 0 ) ;
+        }
+
+        if( pid == 0 )
+        {
+            pfd.fd = jsread ;
+            pfd.events = POLLIN ;
+
+            poll( &pfd, 1, 50 ) ;
+
+            continue ;
+        }
+
+        if( pid == -1 )
+        {
+            if( errno == EINTR )
+            {
+                continue ;
+            }
+
+            break ;
+        }
+
+        for( job = jobs ; job < jobs + next ; job++ )
+        {
+            if( ( job->state == JOB_RUNNING ) && ( job->pid == pid ) )
+            {
+                job->state = JOB_DONE ;
+
+                job->status = status ;
+
+                running-- ;
+
+                done++ ;
+
+                break ;
+            }
+        }
+
+        /* we only ever hold tokens for the compilers beyond
+         * the first
+         */
+
+        while( ( ntokens > 0 ) && ( ntokens >= running ) )
+        {
+            if( write( jswrite, tokens + --ntokens, 1 ) != 1 )
+            {
+                SJGF( "lost a jobserver token" ) ;
+            }
+        }
+
+        /* copy out what is finished in command line order
+         */
+
+        while( ( shown < next ) && ( jobs[shown].state == JOB_DONE ) )
+        {
+            job = jobs + shown++ ;
+
+            copy_out( job->outfd, 1 ) ;
+            copy_out( job->errfd, 2 ) ;
+        }
+    } ;
+
+    for( job = jobs ; job < jobs + njobs ; job++ )
+    {
+        if( shown <= job - jobs )
+        {
+            copy_out( job->outfd, 1 ) ;
+            copy_out( job->errfd, 2 ) ;
+        }
+
+        if( job->state != JOB_DONE )
+        {
+            code = 1 ;
+        }
+        else if( WIFEXITED( job->status ) )
+        {
+            code = WEXITSTATUS( job->status ) ;
+        }
+        else
+        {
+            code = 128 + WTERMSIG( job->status ) ;
+        }
+
+        if( code > retv )
+        {
+            retv = code ;
+        }
+
+        if( job->outfd != -1 )
+        {
+            close( job->outfd ) ;
+        }
+
+        if( job->errfd != -1 )
+        {
+            close( job->errfd ) ;
+        }
+    }
+
+    while( ntokens > 0 )
+    {
+        if( write( jswrite, tokens + --ntokens, 1 ) != 1 )
+        {
+            break ;
+        }
+    }
+
+    free( jobs ) ;
+
+    return retv ;
+}
+
+
+/**********************************************************************
+ */
+
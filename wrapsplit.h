@@ -0,0 +1,36 @@
+
+/*
+ * Include file wrapsplit.h
+ *
+ * $Id$
+ *
+ * Runs a compile of many sources as one compiler per source,
+ * several at a time.
+ */
+
+
+#ifndef __WRAPSPLIT_H
+#  define __WRAPSPLIT_H
+
+#include "wrapargs.h"
+
+/**********************************************************************
+ */
+
+/* WRAP_OPEN_SPLIT=<n> runs "gccwrap cap -c a.c b.c ..." as up to
+ * n compilers at once, each given one of the sources.  When make
+ * runs us with a jobserver every compiler after the first also
+ * needs a token from it.  Unset, 0 or 1 leaves the command line
+ * to the compiler as it is.
+ */
+#define WRAPSPLIT_ENV           "WRAP_OPEN_SPLIT"
+
+
+/**********************************************************************
+ */
+
+extern int  wrapsplit_run( char *compiler, wrapargs_t *wa ) ;
+
+
+#endif /* __WRAPSPLIT_H */
+
@@ -0,0 +1,322 @@
+/*
+ * wraptrace.c
+ *
+ * Record how long the interposer spends on each file and write
+ * it out as Chrome trace event JSON when the process exits.
+ *
+ * Events are complete ( "ph" : "X" ) events kept in memory
+ * until wraptrace_flush(), so tracing costs two clock reads and
+ * an append while the compiler is running.  Every event carries
+ * the pid it was recorded in, so a child forked with a copy of
+ * the events only writes its own.
+ *
+ * The per pid files can be merged with e.g.
+ *
+ *   jq -s '{ traceEvents : map( .traceEvents[] ) }' wraptrace-*.json
+ *
+ * and loaded into chrome://tracing or Perfetto.
+ *
+ * $Id$
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+#include "utils.h"
+
+// #define DEBUGME
+
+#include "debugme.h"
+
+#include "wraptrace.h"
+
+
+/**********************************************************************
+ */
+
+struct wraptrace_ev_s ;
+
+struct wraptrace_ev_s {
+    char        *cat ;
+    char        *name ;
+    char        *file ;
+    uint64_t     start ;
+    uint64_t     end ;
+    pid_t        pid ;
+    pid_t        tid ;
+    } ;
+
+typedef struct wraptrace_ev_s wraptrace_ev_t ;
+
+
+static char *tracedir = NULL ;
+
+static wraptrace_ev_t *events = NULL ;
+
+static size_t nevents = 0 ;
+
+static size_t maxevents = 0 ;
+
+static pthread_mutex_t tracelock = PTHREAD_MUTEX_INITIALIZER ;
+
+
+/**********************************************************************
+ */
+
+static void prefork()
+{
+    pthread_mutex_lock( &tracelock ) ;
+}
+
+
+static void postfork()
+{
+    pthread_mutex_unlock( &tracelock ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* returns 0 if tracing is on
+ */
+int wraptrace_init()
+{
+    char *p = getenv( WRAPTRACE_ENV ) ;
+
+    if( ( p == NULL ) || ( *p == 0 ) )
+    {
+        return -1 ;
+    }
+
+    tracedir = strdup( p ) ;
+
+    if( tracedir == NULL )
+    {
+        return -1 ;
+    }
+
+    pthread_atfork( prefork, postfork, postfork ) ;
+
+    return 0 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* in microseconds, which is what trace events use
+ */
+uint64_t wraptrace_now()
+{
+    struct timespec ts ;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts ) ;
+
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000 ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Record something that took from start to end.  file may be
+ * NULL.  Both strings are copied.
+ */
+void wraptrace_span( char *cat, const char *name, const char *file, uint64_t start, uint64_t end )
+{
+    wraptrace_ev_t *ev = NULL ;
+
+    if( tracedir == NULL )
+    {
+        return ;
+    }
+
+    pthread_mutex_lock( &tracelock ) ;
+
+    if( nevents == maxevents )
+    {
+        size_t newmax = ( maxevents == 0 ) ? 1024 : maxevents * 2 ;
+
+        ev = (wraptrace_ev_t *)realloc( events, newmax * sizeof( wraptrace_ev_t ) ) ;
+
+        if( ev == NULL )
+        {
+            pthread_mutex_unlock( &tracelock ) ;
+
+            return ;
+        }
+
+        events = ev ;
+        maxevents = newmax ;
+    }
+
+    ev = events + nevents++ ;
+
+    ev->cat = cat ;
+    ev->name = strdup( name ) ;
+    ev->file = ( file != NULL ) ? strdup( file ) : NULL ;
+    ev->start = start ;
+    ev->end = end ;
+    ev->pid = getpid() ;
+    ev->tid = (pid_t)syscall( SYS_gettid ) ;
+
+    pthread_mutex_unlock( &tracelock ) ;
+}
+
+
+/**********************************************************************
+ */
+
+static void put_string( FILE *fout, char *s )
+{
+    fputc( '"', fout ) ;
+
+    for( ; ( s != NULL ) && ( *s != 0 ) ; s++ )
+    {
+        if( ( *s == '"' ) || ( *s == '\\' ) )
+        {
+            fputc( '\\', fout ) ;
+
+            fputc( *s, fout ) ;
+        }
+        else if( (unsigned char)*s < 0x20 )
+        {
+            fprintf( fout, "\\u%04x", (unsigned char)*s ) ;
+        }
+        else
+        {
+            fputc( *s, fout ) ;
+        }
+    }
+
+    fputc( '"', fout ) ;
+}
+
+
+/**********************************************************************
+ */
+
+/* Write this process's events to its file in the trace
+ * directory and forget them
+ */
+void wraptrace_flush()
+{
+    char path[PATH_MAX] ;
+
+    FILE *fout = NULL ;
+
+    wraptrace_ev_t *ev = NULL ;
+
+    pid_t pid = getpid() ;
+
+    size_t i = 0 ;
+
+    if( tracedir == NULL )
+    {
+        return ;
+    }
+
+    pthread_mutex_lock( &tracelock ) ;
+
+    for( i = 0 ; i < nevents ; i++ )
+    {
+        if( events[i].pid == pid )
+        {
+            break ;
+        }
+    }
+
+    if( i == nevents )
+    {
+        goto err_exit ;
+    }
+
+    snprintf( path, PATH_MAX, "%s/wraptrace-%d.json", tracedir, (int)pid ) ;
+
+    fout = fopen( path, "w" ) ;
+
+    if( fout == NULL )
+    {
+        errorf( "Could not write trace %s\n", path ) ;
+
+        goto err_exit ;
+    }
+
+    fprintf( fout, "{\"traceEvents\":[\n" ) ;
+
+    /* name the process after the program, e.g. cc1, so the
+     * merged trace shows what each pid was
+     */
+
+    fprintf( fout, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":", (int)pid ) ;
+
+    put_string( fout, program_invocation_short_name ) ;
+
+    fprintf( fout, "}}" ) ;
+
+    for( i = 0 ; i < nevents ; i++ )
+    {
+        ev = events + i ;
+
+        if( ev->pid != pid )
+        {
+            continue ;
+        }
+
+        fprintf( fout, ",\n{\"ph\":\"X\",\"cat\":\"%s\",\"name\":", ev->cat ) ;
+
+        put_string( fout, ev->name ) ;
+
+        fprintf( fout, ",\"pid\":%d,\"tid\":%d,\"ts\":%" PRIu64 ",\"dur\":%" PRIu64,
+                        (int)ev->pid, (int)ev->tid, ev->start, ev->end - ev->start ) ;
+
+        if( ev->file != NULL )
+        {
+            fprintf( fout, ",\"args\":{\"file\":" ) ;
+
+            put_string( fout, ev->file ) ;
+
+            fputc( '}', fout ) ;
+        }
+
+        fputc( '}', fout ) ;
+    }
+
+    fprintf( fout, "\n],\"displayTimeUnit\":\"ms\"}\n" ) ;
+
+    fclose( fout ) ;
+
+err_exit:
+
+    for( i = 0 ; i < nevents ; i++ )
+    {
+        free( events[i].name ) ;
+        free( events[i].file ) ;
+    }
+
+    free( events ) ;
+
+    events = NULL ;
+    nevents = 0 ;
+    maxevents = 0 ;
+
+    pthread_mutex_unlock( &tracelock ) ;
+}
+
+
+/**********************************************************************
+ */
+
@@ -0,0 +1,49 @@
+
+/*
+ * Include file wraptrace.h
+ *
+ * $Id$
+ *
+ * Timing of what wrap_open.so does, written out as Chrome
+ * trace events.
+ */
+
+
+#ifndef __WRAPTRACE_H
+#  define __WRAPTRACE_H
+
+#include <stdint.h>
+
+/**********************************************************************
+ */
+
+/* WRAP_OPEN_TRACE names a directory.  Each process writes its
+ * events to wraptrace-<pid>.json in it when it exits.
+ *
+ * Times are from CLOCK_MONOTONIC so the files from every
+ * process in a build line up when they are merged.
+ */
+#define WRAPTRACE_ENV           "WRAP_OPEN_TRACE"
+
+/* event categories
+ */
+#define WRAPTRACE_OPEN          "open"
+#define WRAPTRACE_PROCESS       "process"
+#define WRAPTRACE_STAGE         "stage"
+#define WRAPTRACE_CACHE         "cache"
+
+
+/**********************************************************************
+ */
+
+extern int      wraptrace_init() ;
+
+extern uint64_t wraptrace_now() ;
+
+extern void     wraptrace_span( char *cat, const char *name, const char *file, uint64_t start, uint64_t end ) ;
+
+extern void     wraptrace_flush() ;
+
+
+#endif /* __WRAPTRACE_H */
+